@@ -0,0 +1,202 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/*
+ * Socket dispatch microbenchmark.
+ *
+ * Creates a number of UDP sockets (10000 by default), each with a datagram
+ * pending, so that all of them are found ready for read in every round. The
+ * time that fl_socket_process_reads() takes to dispatch the ready sockets to
+ * their nb_recv_method is measured, and reported per socket and per 10k
+ * sockets. Arming the sockets and waiting for them is not measured. Between
+ * rounds, the CPU caches are flushed by walking a large buffer, like an
+ * application that does other work between loops would.
+ *
+ * With the epoll backend, every dispatch also updates the epoll interest list
+ * (one epoll_ctl() per socket), which dominates the cost. The select backend
+ * updates fd bits in memory, and shows the cost of accessing the falco
+ * sockets. It is limited to sockets with fds below FD_SETSIZE.
+ *
+ * Usage: fl_bench_dispatch [nsockets [nrounds [epoll|select|uring|poll]]]
+ */
+
+#include <sys/resource.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "falco/fl_fds.h"
+#include "falco/fl_socket.h"
+#include "falco/fl_timer.h"
+#include "falco/fl_process.h"
+
+#define BENCH_EVICT_LEN (64 * 1024 * 1024)
+
+static u_int64_t ndispatched;
+static volatile unsigned char *evict_buf;
+
+static void bench_nb_recv(fl_socket_t *flsk)
+{
+  /* Touch what an application typically looks at */
+  ndispatched += (flsk->sockfd >= 0) + (flsk->crdata_len == 0) +
+    (flsk->flags != 0);
+}
+
+static u_int64_t bench_now_ns(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void bench_evict_caches(void)
+{
+  register size_t i;
+
+  for (i = 0; i < BENCH_EVICT_LEN; i += 64) {
+    evict_buf[i]++;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int nsockets = (argc > 1) ? atoi(argv[1]) : 10000;
+  int nrounds = (argc > 2) ? atoi(argv[2]) : 100;
+  fl_fds_backend_e backend = FL_FDS_BACKEND_EPOLL;
+  fl_socket_t **socks;
+  struct rlimit rl;
+  struct sockaddr_in sin;
+  socklen_t slen;
+  u_int64_t total_ns = 0, best_ns = UINT64_MAX;
+  int sender, i, r;
+  char byte = 0;
+
+  if ((argc > 3) && !strcmp(argv[3], "select")) {
+    backend = FL_FDS_BACKEND_SELECT;
+  } else if ((argc > 3) && !strcmp(argv[3], "uring")) {
+    backend = FL_FDS_BACKEND_URING;
+  } else if ((argc > 3) && !strcmp(argv[3], "poll")) {
+    backend = FL_FDS_BACKEND_POLL;
+  }
+
+  if ((nsockets <= 0) || (nrounds <= 0)) {
+    fprintf(stderr, "Usage: %s [nsockets [nrounds]]\n", argv[0]);
+    return 1;
+  }
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    (void) setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  if ((fl_fds_cfg_backend(backend) < 0) || (fl_init() < 0)) {
+    fprintf(stderr, "falco initialization failed\n");
+    return 1;
+  }
+
+  socks = calloc(nsockets, sizeof(*socks));
+  evict_buf = calloc(BENCH_EVICT_LEN, 1);
+  sender = socket(AF_INET, SOCK_DGRAM, 0);
+  if (!socks || !evict_buf || (sender < 0)) {
+    perror("setup");
+    return 1;
+  }
+
+  for (i = 0; i < nsockets; i++) {
+    socks[i] = fl_socket_socket(NULL, "bench", AF_INET, SOCK_DGRAM, 0);
+    if (!socks[i] || ((backend == FL_FDS_BACKEND_SELECT) &&
+                      (socks[i]->sockfd >= FD_SETSIZE))) {
+      fprintf(stderr, "Could not create socket %d of %d\n", i, nsockets);
+      return 1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    slen = sizeof(sin);
+    if ((fl_socket_bind(socks[i], (struct sockaddr_storage *) &sin,
+                        sizeof(sin)) < 0) ||
+        (getsockname(socks[i]->sockfd, (struct sockaddr *) &sin, &slen) < 0) ||
+        (sendto(sender, &byte, 1, 0, (struct sockaddr *) &sin, slen) != 1)) {
+      perror("socket setup");
+      return 1;
+    }
+
+    (void) fl_socket_setsockopt(socks[i], FL_SOCKOPT_NONBLOCKING, 1);
+    fl_socket_set_nb_recv_method(socks[i], bench_nb_recv);
+  }
+
+  for (r = 0; r < nrounds; r++) {
+    fd_set *rfds, *wfds, *efds;
+    u_int64_t start, elapsed;
+    int nfds;
+
+    for (i = 0; i < nsockets; i++) {
+      FL_FD_SET(socks[i]->sockfd, FL_FD_OP_READ);
+    }
+
+    nfds = fl_socket_select(&rfds, &wfds, &efds);
+    if (nfds <= 0) {
+      fprintf(stderr, "No sockets are ready in round %d\n", r);
+      return 1;
+    }
+    bench_evict_caches();
+
+    start = bench_now_ns();
+    fl_socket_process_reads(&nfds, rfds);
+    elapsed = bench_now_ns() - start;
+
+    total_ns += elapsed;
+    if (elapsed < best_ns) {
+      best_ns = elapsed;
+    }
+  }
+
+  printf("fl_socket_t size %zu bytes, %s backend, %d sockets, %d rounds, "
+         "%llu dispatches\n", sizeof(fl_socket_t),
+         (fl_fds_get_backend() == FL_FDS_BACKEND_SELECT) ? "select" :
+         (fl_fds_get_backend() == FL_FDS_BACKEND_URING) ? "io_uring" :
+         (fl_fds_get_backend() == FL_FDS_BACKEND_POLL) ? "poll" : "epoll",
+         nsockets, nrounds,
+         (unsigned long long) ndispatched / 3);
+  printf("dispatch: mean %.1f ns/socket (%.1f us per 10k sockets), "
+         "best %.1f ns/socket (%.1f us per 10k sockets)\n",
+         (double) total_ns / nrounds / nsockets,
+         (double) total_ns / nrounds / nsockets * 10000 / 1000,
+         (double) best_ns / nsockets,
+         (double) best_ns / nsockets * 10000 / 1000);
+  return 0;
+}
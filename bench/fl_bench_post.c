@@ -0,0 +1,211 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/*
+ * Cross-thread post microbenchmark.
+ *
+ * Starts an event loop on its own thread, and hands methods to it with
+ * fl_loop_post() from other threads.
+ *
+ * 1. Latency: the main thread posts one method at a time, and waits for it to
+ *    run. The time from fl_loop_post() to the invocation of the method on the
+ *    loop (eventfd wakeup, wait return, queue drain) is reported as
+ *    percentiles.
+ * 2. Throughput: a number of producer threads (1 by default) post methods as
+ *    fast as they can, retrying when the queue of the loop is full. The rate
+ *    at which the loop runs them, and the number of methods run per wakeup,
+ *    are reported.
+ *
+ * Usage: fl_bench_post [nposts [nproducers]]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "falco/fl_fds.h"
+#include "falco/fl_socket.h"
+#include "falco/fl_loop.h"
+#include "falco/fl_process.h"
+
+static atomic_ullong bench_nrun;
+static u_int64_t *bench_latencies;
+static int bench_nposts;
+
+static u_int64_t bench_now_ns(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+  u_int64_t x = *(const u_int64_t *) a, y = *(const u_int64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void bench_ping(const char *name, void *app_data)
+{
+  u_int64_t *slot = app_data;
+
+  *slot = bench_now_ns() - *slot;
+  atomic_fetch_add_explicit(&bench_nrun, 1, memory_order_release);
+}
+
+static void bench_count(const char *name, void *app_data)
+{
+  atomic_fetch_add_explicit(&bench_nrun, 1, memory_order_relaxed);
+}
+
+static int bench_loop(fl_loop_t *loop, void *app_data)
+{
+  while (!fl_loop_stopping()) {
+    fd_set *rfds, *wfds, *efds;
+    int nfds;
+
+    nfds = fl_socket_select(&rfds, &wfds, &efds);
+    if (nfds > 0) {
+      fl_loop_dispatch(&nfds, rfds);
+    }
+  }
+
+  return 0;
+}
+
+static void bench_post(fl_loop_t *loop, fl_job_method_t method, void *arg)
+{
+  while (fl_loop_post(loop, "bench", method, arg) < 0) {
+    if (errno != EAGAIN) {
+      perror("fl_loop_post");
+      exit(1);
+    }
+    (void) sched_yield();
+  }
+}
+
+static void *bench_producer(void *arg)
+{
+  fl_loop_t *loop = arg;
+  int i;
+
+  for (i = 0; i < bench_nposts; i++) {
+    bench_post(loop, bench_count, NULL);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int nposts = (argc > 1) ? atoi(argv[1]) : 100000;
+  int nproducers = (argc > 2) ? atoi(argv[2]) : 1;
+  unsigned long long nwakeups;
+  pthread_t *producers;
+  fl_loop_t *loop;
+  u_int64_t start, elapsed;
+  int i;
+
+  if ((nposts <= 0) || (nproducers <= 0)) {
+    fprintf(stderr, "Usage: %s [nposts [nproducers]]\n", argv[0]);
+    return 1;
+  }
+
+  if ((fl_fds_cfg_backend(FL_FDS_BACKEND_EPOLL) < 0) || (fl_init() < 0)) {
+    fprintf(stderr, "falco initialization failed\n");
+    return 1;
+  }
+
+  bench_latencies = calloc(nposts, sizeof(*bench_latencies));
+  producers = calloc(nproducers, sizeof(*producers));
+  loop = fl_loop_create("bench", -1, bench_loop, NULL);
+  if (!bench_latencies || !producers || !loop) {
+    fprintf(stderr, "setup failed\n");
+    return 1;
+  }
+
+  /* Latency, one method in flight */
+  for (i = 0; i < nposts; i++) {
+    bench_latencies[i] = bench_now_ns();
+    bench_post(loop, bench_ping, &bench_latencies[i]);
+    while (atomic_load_explicit(&bench_nrun, memory_order_acquire) <=
+           (unsigned long long) i) {
+      (void) sched_yield();
+    }
+  }
+  qsort(bench_latencies, nposts, sizeof(*bench_latencies), bench_cmp);
+  printf("latency (%d posts): min %.1f us, p50 %.1f us, p99 %.1f us, "
+         "max %.1f us\n", nposts,
+         bench_latencies[0] / 1000.0,
+         bench_latencies[nposts / 2] / 1000.0,
+         bench_latencies[(int) (nposts * 0.99)] / 1000.0,
+         bench_latencies[nposts - 1] / 1000.0);
+
+  /* Throughput, producers posting back to back */
+  atomic_store(&bench_nrun, 0);
+  nwakeups = loop->nwakeups;
+  bench_nposts = nposts;
+  start = bench_now_ns();
+  for (i = 0; i < nproducers; i++) {
+    if (pthread_create(&producers[i], NULL, bench_producer, loop)) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (i = 0; i < nproducers; i++) {
+    (void) pthread_join(producers[i], NULL);
+  }
+  while (atomic_load(&bench_nrun) < (unsigned long long) nposts * nproducers) {
+    (void) sched_yield();
+  }
+  elapsed = bench_now_ns() - start;
+  nwakeups = loop->nwakeups - nwakeups;
+
+  printf("throughput (%d producers x %d posts): %.2f M posts/s, "
+         "%.1f ns/post, %.1f posts per wakeup, queue full %llu\n",
+         nproducers, nposts,
+         (double) nposts * nproducers * 1000.0 / elapsed,
+         (double) elapsed / ((double) nposts * nproducers),
+         (nwakeups) ? (double) nposts * nproducers / nwakeups : 0.0,
+         (unsigned long long) atomic_load(&loop->nfull));
+
+  fl_loop_stop(loop);
+  return (fl_loop_join(loop) < 0);
+}
@@ -69,4 +69,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 #endif /* _PATH_PID */
 
+/* Storage class of the state that each event loop (thread) keeps for itself,
+ * see fl_loop.h
+ */
+#define FL_LOOP_LOCAL _Thread_local
+
 #endif /* _FL_DEFS_H_ */
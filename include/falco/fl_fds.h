@@ -40,52 +40,38 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <sys/types.h>
 #include <sys/select.h>
+#include <stdio.h>
 
 /**
  * @brief Set read/accept or write except bit for the supplied file descriptor.
  *
- * @detail Read and Accept operations both set the read bit.
+ * @detail Read and Accept operations both set the read bit. When the epoll
+ * or io_uring backend is in use, the file descriptor is added to (or modified
+ * in) the kernel interest list. With the poll backend, it is added to the
+ * pollfd array.
  *
  * @param[in] fd File descriptor
  * @param[in] op Enumerated value of read/write/accept/except operation
  *            (from @link #fl_fd_op_e)
  *
  */
-#define FL_FD_SET(_fd_, _op_)                           \
-  do {                                                  \
-    fl_fd_set_t *_fl_fds_ = fl_fds_get_set((_op_));     \
-    if (FD_ISSET((_fd_), &_fl_fds_->fd_bits)) {         \
-      FL_ASSERT(0);                                     \
-      FL_LOGR_NOTICE("FD (%d) is already set", (_fd_)); \
-    } else {                                            \
-      FD_SET((_fd_), &_fl_fds_->fd_bits);               \
-      _fl_fds_->nfds++;                                 \
-    }                                                   \
-  } while (0)
+#define FL_FD_SET(_fd_, _op_) fl_fds_set((_fd_), (_op_))
 
 /**
  * @brief Clear read/accept or write except bit for the supplied file
  * descriptor.
  *
- * @detail Read and Accept operations both clear the read bit.
+ * @detail Read and Accept operations both clear the read bit. When the epoll
+ * or io_uring backend is in use, the file descriptor is modified in (or
+ * removed from) the kernel interest list. With the poll backend, it is
+ * removed from the pollfd array once cleared for all operations.
  *
  * @param[in] fd File descriptor
  * @param[in] op Enumerated value of read/write/accept/except operation
  *            (from @link #fl_fd_op_e)
  *
  */
-#define FL_FD_CLR(_fd_, _op_)                           \
-  do {                                                  \
-    fl_fd_set_t *_fl_fds_ = fl_fds_get_set((_op_));     \
-    FL_ASSERT(_fl_fds_->nfds);                          \
-    if (!FD_ISSET((_fd_), &_fl_fds_->fd_bits)) {        \
-      FL_ASSERT(0);                                     \
-      FL_LOGR_NOTICE("FD (%d) is not set", (_fd_));     \
-    } else {                                            \
-      FD_CLR((_fd_), &_fl_fds_->fd_bits);               \
-      _fl_fds_->nfds--;                                 \
-    }                                                   \
-  } while (0)
+#define FL_FD_CLR(_fd_, _op_) fl_fds_clr((_fd_), (_op_))
 
 /**
  * @brief Clear bits of all file descriptors for an operation.
@@ -96,13 +82,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *            (from @link #fl_fd_op_e)
  *
  */
-#define FL_FD_ZERO(_op_)                                \
-  do {                                                  \
-    fl_fd_set_t *_fl_fds_ = fl_fds_get_set((_op_));     \
-    FL_ASSERT(_fl_fds_);                                \
-    FD_ZERO(&_fl_fds_->fd_bits);                        \
-    _fl_fds_->nfds = 0;                                 \
-  } while (0)
+#define FL_FD_ZERO(_op_) fl_fds_zero((_op_))
 
 /**
  * @brief Enumeration of all operations on a set of file descriptors (fd_set).
@@ -114,15 +94,107 @@ typedef enum fl_fd_op_e_ {
   FL_FD_OP_EXCEPT
 } fl_fd_op_e;
 
+/**
+ * @brief Enumeration of the I/O multiplexing backends supported by the module.
+ */
+typedef enum fl_fds_backend_e_ {
+  /**
+   * @brief @c select(2) based backend (default). File descriptors must be
+   * less than @c FD_SETSIZE.
+   */
+  FL_FDS_BACKEND_SELECT,
+  /**
+   * @brief @c epoll(7) based backend. The read, write and except bits are
+   * mapped to the kernel interest list, and only ready file descriptors are
+   * returned from the wait.
+   */
+  FL_FDS_BACKEND_EPOLL,
+  /**
+   * @brief @c io_uring(7) based backend. Interest changes are queued as
+   * one-shot poll requests and submitted in a batch, together with the wait
+   * for completions, by a single @c io_uring_enter(2). Falls back to
+   * #FL_FDS_BACKEND_EPOLL when the kernel lacks support.
+   */
+  FL_FDS_BACKEND_URING,
+  /**
+   * @brief @c poll(2) based backend, for builds where epoll is not wanted.
+   * The module keeps a compact array with one entry per file descriptor that
+   * is set, so that the cost of a wait is bounded by the number of watched
+   * file descriptors rather than the maximum fd. There is no @c FD_SETSIZE
+   * limit.
+   */
+  FL_FDS_BACKEND_POLL,
+} fl_fds_backend_e;
+
+/**
+ * @brief Enumeration of the falco objects that own (are registered against) a
+ * file descriptor.
+ */
+typedef enum fl_fd_owner_e_ {
+  FL_FD_OWNER_NONE,   ///< File descriptor is not owned by a falco object
+  FL_FD_OWNER_SOCKET, ///< File descriptor of a falco socket (fl_socket_t)
+  FL_FD_OWNER_TIMER,  ///< File descriptor of a falco timer (fl_timer_t)
+  FL_FD_OWNER_SIGNAL, ///< signalfd of the falco signal module
+  FL_FD_OWNER_LOOP,   ///< eventfd that wakes up a falco event loop
+} fl_fd_owner_e;
+
 /**
  * @brief An fd_set with capability to track the number of file descriptors
  * that are set.
+ *
+ * @detail @c fd_bits mirrors the file descriptors (less than @c FD_SETSIZE)
+ * that are set for an operation, irrespective of the backend in use.
+ * @c nfds counts all file descriptors that are set for the operation.
  */
 typedef struct fl_fd_set_t_ {
   fd_set fd_bits;
-  u_int16_t nfds;
+  u_int32_t nfds;
 } fl_fd_set_t;
 
+/**
+ * @brief Configure the I/O multiplexing backend.
+ *
+ * @detail The backend must be configured before fl_init() (or
+ * fl_fds_module_init()) is called. The default backend is
+ * #FL_FDS_BACKEND_SELECT.
+ *
+ * @param[in] backend Enumerated value from #fl_fds_backend_e
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_fds_cfg_backend(fl_fds_backend_e backend);
+
+/**
+ * @brief Get the I/O multiplexing backend in use.
+ *
+ * @detail Once the module is initialized, this is the backend in use by the
+ * calling thread's event loop, which is #FL_FDS_BACKEND_EPOLL when
+ * #FL_FDS_BACKEND_URING was configured but is not supported by the kernel.
+ *
+ * @return Enumerated value from #fl_fds_backend_e
+ */
+extern fl_fds_backend_e fl_fds_get_backend(void);
+
+/**
+ * @brief Initialize the file descriptors management module.
+ *
+ * @detail For the epoll and io_uring backends, the kernel instance is created
+ * here.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_fds_module_init(void);
+
+/**
+ * @brief Dump the status and state of the module.
+ *
+ * @param[in] fd Stream to which the status and state of the module needs to
+ *               be written.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_fds_module_dump(FILE *fd);
+
 /**
  * @brief Get fd set for an operation.
  *
@@ -143,7 +215,9 @@ extern fl_fd_set_t *fl_fds_get_set(fl_fd_op_e op);
  * situations, applications must call fl_fds_set_max_fd() to let falco know
  * about these file descriptors.
  *
- * @return The maximum file descriptor recorded by falco.
+ * @return The highest file descriptor that is set for an operation, or that
+ * was passed to fl_fds_set_max_fd(), whichever is higher. The value comes
+ * down as file descriptors are cleared.
  */
 extern int fl_fds_get_max_fd(void);
 
@@ -182,4 +256,122 @@ extern int fl_fds_anyfds_set(fl_fd_op_e op);
  */
 extern int fl_fd_isset(int fd, fl_fd_op_e op);
 
+/**
+ * @brief Set a file descriptor for an operation.
+ *
+ * @detail Applications typically use #FL_FD_SET instead.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] op Enumerated value of read/write/accept/except operation
+ *               (from #fl_fd_op_e)
+ */
+extern void fl_fds_set(int fd, fl_fd_op_e op);
+
+/**
+ * @brief Clear a file descriptor for an operation.
+ *
+ * @detail Applications typically use #FL_FD_CLR instead.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] op Enumerated value of read/write/accept/except operation
+ *               (from #fl_fd_op_e)
+ */
+extern void fl_fds_clr(int fd, fl_fd_op_e op);
+
+/**
+ * @brief Clear all file descriptors for an operation.
+ *
+ * @detail Applications typically use #FL_FD_ZERO instead.
+ *
+ * @param[in] op Enumerated value of read/write/accept/except operation
+ *               (from #fl_fd_op_e)
+ */
+extern void fl_fds_zero(fl_fd_op_e op);
+
+/**
+ * @brief Wait for file descriptors to become ready.
+ *
+ * @detail Waits, using the configured backend, until one or more of the file
+ * descriptors that are set become ready. Ready file descriptors (less than
+ * @c FD_SETSIZE) are reflected in @p rfds, @p wfds and @p efds, any of which
+ * may be NULL. With the epoll, io_uring and poll backends, the readiness of every file descriptor
+ * (including those not less than @c FD_SETSIZE) can be queried using
+ * fl_fd_isready().
+ *
+ * @param[out] rfds Set of file descriptors ready for read/accept
+ * @param[out] wfds Set of file descriptors ready for write
+ * @param[out] efds Set of file descriptors with exceptions
+ * @param[in] timeout Maximum time to wait. NULL blocks indefinitely.
+ *
+ * @return The number of ready (file descriptor, operation) pairs is returned.
+ * On error, -1 is returned and errno is set.
+ */
+extern int fl_fds_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                       struct timeval *timeout);
+
+/**
+ * @brief Check to see if a file descriptor is ready for an operation.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] op Enumerated value of read/write/accept/except operation
+ *               (from #fl_fd_op_e)
+ * @param[in] fds Set of file descriptors returned from fl_fds_wait() for the
+ *                operation. Used by the select backend only.
+ *
+ * @return Returns 1 if the file descriptor is ready for the operation.
+ * Otherwise, 0 is returned.
+ */
+extern int fl_fd_isready(int fd, fl_fd_op_e op, fd_set *fds);
+
+/**
+ * @brief Clear the readiness of a file descriptor for an operation.
+ *
+ * @detail This is used once the operation has been processed, so that the
+ * file descriptor is not processed again in the same loop iteration.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] op Enumerated value of read/write/accept/except operation
+ *               (from #fl_fd_op_e)
+ * @param[in,out] fds Set of file descriptors returned from fl_fds_wait() for
+ *                    the operation
+ */
+extern void fl_fd_clrready(int fd, fl_fd_op_e op, fd_set *fds);
+
+/**
+ * @brief Register the falco object that owns a file descriptor.
+ *
+ * @detail The module keeps an fd-indexed registry, so that the dispatchers can
+ * map a ready file descriptor to its falco socket or timer in constant time.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] type Enumerated value from #fl_fd_owner_e. #FL_FD_OWNER_NONE
+ *                 removes the registration.
+ * @param[in] owner Pointer to the falco object
+ */
+extern void fl_fds_set_owner(int fd, fl_fd_owner_e type, void *owner);
+
+/**
+ * @brief Get the falco object that owns a file descriptor.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] type Enumerated value from #fl_fd_owner_e
+ *
+ * @return If the file descriptor is owned by an object of type @p type, then,
+ * a pointer to the object is returned. Otherwise, NULL is returned.
+ */
+extern void *fl_fds_get_owner(int fd, fl_fd_owner_e type);
+
+/**
+ * @brief Get the file descriptors that were found ready in the last wait.
+ *
+ * @detail The list is rebuilt by every fl_fds_wait(). A file descriptor
+ * appears once, irrespective of the number of operations it is ready for.
+ * Use fl_fd_isready() to check for a specific operation.
+ *
+ * @param[out] fds Pointer to the array of ready file descriptors
+ *
+ * @return The number of file descriptors in @p fds.
+ */
+extern int fl_fds_get_ready(const int **fds);
+
 #endif /* _FL_FDS_H_ */
@@ -0,0 +1,224 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Latency Histograms
+ *
+ * Histograms of durations (in nanoseconds) with a log-linear bucket layout, as
+ * in HDR histograms. Every power of two is split into
+ * #FL_HIST_SUB_BUCKETS linear buckets, so that a recorded value is off by at
+ * most 1/#FL_HIST_SUB_BUCKETS of its magnitude. Values are kept in units of
+ * (1 << #FL_HIST_UNIT_SHIFT) nanoseconds, and values larger than
+ * #FL_HIST_MAX_NS are counted in the last bucket. Recording a value is a
+ * handful of instructions and does not allocate memory.
+ *
+ * The event loop records how long the methods of sockets (fl_socket.h) and
+ * timers (fl_timer.h) take, and how late timers are dispatched, in histograms
+ * of the socket, of the timer and of their task. This instrumentation is
+ * built when ENABLE_INSTRUMENTATION is defined (the ENABLE_INSTRUMENTATION
+ * CMake option, or --enable-instrumentation of configure), which is off by
+ * default. Otherwise the FL_HIST_* macros expand to nothing, and the
+ * dispatch paths do not read the clock.
+ */
+
+#ifndef _FL_HIST_H_
+#define _FL_HIST_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @brief Resolution of the histograms, values are kept in units of
+ * (1 << FL_HIST_UNIT_SHIFT) nanoseconds.
+ */
+#define FL_HIST_UNIT_SHIFT 6
+/**
+ * @brief Number of bits used to index the linear buckets of a power of two.
+ */
+#define FL_HIST_SUB_BITS 3
+/**
+ * @brief Number of linear buckets in every power of two.
+ */
+#define FL_HIST_SUB_BUCKETS (1 << FL_HIST_SUB_BITS)
+/**
+ * @brief Number of bits of the largest value (in units) of a histogram.
+ */
+#define FL_HIST_VALUE_BITS 30
+/**
+ * @brief Largest value (in nanoseconds) that is recorded in its own bucket,
+ * about 68 seconds.
+ */
+#define FL_HIST_MAX_NS                                                  \
+  (((((u_int64_t) 1) << FL_HIST_VALUE_BITS) << FL_HIST_UNIT_SHIFT) - 1)
+/**
+ * @brief Number of buckets of a histogram.
+ */
+#define FL_HIST_BUCKETS                                                 \
+  ((FL_HIST_VALUE_BITS - FL_HIST_SUB_BITS + 1) << FL_HIST_SUB_BITS)
+
+/**
+ * @brief Histogram of durations.
+ */
+typedef struct fl_hist_t_ {
+  u_int64_t count; ///< Number of values recorded
+  u_int64_t sum_ns; ///< Sum of the values recorded (in nanoseconds)
+  u_int64_t min_ns; ///< Smallest value recorded (in nanoseconds)
+  u_int64_t max_ns; ///< Largest value recorded (in nanoseconds)
+  u_int32_t buckets[FL_HIST_BUCKETS]; ///< Number of values in every bucket
+} fl_hist_t;
+
+/**
+ * @brief Summary of a histogram, see fl_hist_snapshot(). All values are in
+ * nanoseconds. Percentiles are reported as the upper bound of the bucket in
+ * which they fall.
+ */
+typedef struct fl_hist_snapshot_t_ {
+  u_int64_t count; ///< Number of values recorded
+  u_int64_t min_ns;
+  u_int64_t mean_ns;
+  u_int64_t p50_ns;
+  u_int64_t p90_ns;
+  u_int64_t p99_ns;
+  u_int64_t p999_ns;
+  u_int64_t max_ns;
+} fl_hist_snapshot_t;
+
+#if (defined(ENABLE_INSTRUMENTATION))
+/**
+ * @brief Declare @p \_var\_ and set it to the current time of the monotonic
+ * clock (in nanoseconds).
+ */
+#define FL_HIST_NOW(_var_) u_int64_t _var_ = fl_hist_now_ns()
+/**
+ * @brief Record the time elapsed since @p \_start\_ (see FL_HIST_NOW()) in the
+ * histogram pointed to by @p \_histp\_, which is allocated on first use.
+ */
+#define FL_HIST_RECORD_SINCE(_histp_, _start_)                          \
+  fl_hist_record_lazy((_histp_), fl_hist_now_ns() - (_start_))
+/**
+ * @brief Record a value (in nanoseconds) in the histogram pointed to by
+ * @p \_histp\_, which is allocated on first use.
+ */
+#define FL_HIST_RECORD(_histp_, _ns_) fl_hist_record_lazy((_histp_), (_ns_))
+#else /* !ENABLE_INSTRUMENTATION */
+#define FL_HIST_NOW(_var_)
+#define FL_HIST_RECORD_SINCE(_histp_, _start_)
+#define FL_HIST_RECORD(_histp_, _ns_)
+#endif /* !ENABLE_INSTRUMENTATION */
+
+/**
+ * @brief Current time of the monotonic clock.
+ *
+ * @return Time in nanoseconds.
+ */
+extern u_int64_t fl_hist_now_ns(void);
+
+/**
+ * @brief Create an empty histogram.
+ *
+ * @return On success, a pointer to the histogram is returned. On error, NULL
+ * is returned.
+ */
+extern fl_hist_t *fl_hist_create(void);
+
+/**
+ * @brief Delete a histogram created by fl_hist_create().
+ *
+ * @param[in] hist Histogram
+ */
+extern void fl_hist_delete(fl_hist_t *hist);
+
+/**
+ * @brief Empty a histogram.
+ *
+ * @param[in] hist Histogram
+ */
+extern void fl_hist_reset(fl_hist_t *hist);
+
+/**
+ * @brief Record a value in a histogram.
+ *
+ * @param[in] hist Histogram
+ * @param[in] ns Value (in nanoseconds)
+ */
+extern void fl_hist_record(fl_hist_t *hist, u_int64_t ns);
+
+/**
+ * @brief Record a value in a histogram that is created on first use.
+ *
+ * @detail If @p *hist is NULL, a histogram is created with fl_hist_create()
+ * and stored in @p *hist. The value is dropped if it cannot be created.
+ *
+ * @param[in,out] hist Pointer to the histogram
+ * @param[in] ns Value (in nanoseconds)
+ */
+extern void fl_hist_record_lazy(fl_hist_t **hist, u_int64_t ns);
+
+/**
+ * @brief Add the values of a histogram to another one.
+ *
+ * @param[in,out] dst Histogram to which the values are added
+ * @param[in] src Histogram whose values are added
+ */
+extern void fl_hist_merge(fl_hist_t *dst, const fl_hist_t *src);
+
+/**
+ * @brief Value at a percentile of a histogram.
+ *
+ * @param[in] hist Histogram
+ * @param[in] percentile Percentile, from 0 to 100
+ *
+ * @return Upper bound (in nanoseconds) of the bucket in which the percentile
+ * falls, or 0 if the histogram is empty.
+ */
+extern u_int64_t fl_hist_percentile(const fl_hist_t *hist, double percentile);
+
+/**
+ * @brief Summarize a histogram.
+ *
+ * @param[in] hist Histogram, a NULL histogram is summarized as an empty one.
+ * @param[out] snap Summary
+ */
+extern void fl_hist_snapshot(const fl_hist_t *hist, fl_hist_snapshot_t *snap);
+
+/**
+ * @brief Write the summary of a histogram on one line.
+ *
+ * @param[in] fd Stream to which the summary is written
+ * @param[in] label Label written at the start of the line, including any
+ *                  indentation
+ * @param[in] hist Histogram, nothing is written if it is NULL or empty.
+ */
+extern void fl_hist_dump(FILE *fd, const char *label, const fl_hist_t *hist);
+
+#endif /* _FL_HIST_H_ */
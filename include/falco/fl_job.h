@@ -0,0 +1,160 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Deferred Work (Jobs)
+ *
+ * Applications and library modules can post jobs, i.e. methods to be invoked
+ * after the current dispatch run of the main loop. While jobs are pending,
+ * fl_socket_select() polls for I/O instead of blocking. fl_jobs_dispatch()
+ * runs at most a configured number of jobs per turn, so that deferred work
+ * can not starve I/O. Heavy processing can be split into slices, each slice
+ * posting a job for the next one.
+ *
+ * Two sets of APIs are provided.
+ * 1. APIs that start with @c fl_job_ operate on a single job.
+ * 2. APIs that start with @c fl_jobs_ operate on all jobs.
+ */
+
+#ifndef _FL_JOB_H_
+#define _FL_JOB_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+/**
+ * @brief Default number of jobs run by fl_jobs_dispatch() per turn.
+ */
+#define FL_JOB_DEFAULT_BUDGET 64
+
+/**
+ * @brief Definition for methods that are invoked when a job is run.
+ */
+typedef void (*fl_job_method_t)(const char *, void *);
+
+/**
+ * @brief Representation of a falco job.
+ */
+typedef struct fl_job_t_ {
+  TAILQ_ENTRY(fl_job_t_) job_lc;
+  const char *name;          ///< Name (static string) of the job
+  fl_job_method_t method;
+  void *app_data;
+  u_int64_t seq;             ///< Number of jobs posted before this one
+} fl_job_t;
+
+/**
+ * @brief Configure the number of jobs run by fl_jobs_dispatch() per turn.
+ *
+ * @param[in] budget Number of jobs. If 0, #FL_JOB_DEFAULT_BUDGET.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_job_cfg_budget(u_int32_t budget);
+
+/**
+ * @brief Configure the number of jobs that are preallocated.
+ *
+ * @detail Jobs are allocated from a pool that is prewarmed with @p njobs jobs
+ * when the module is initialized, or right away if the module has already
+ * been initialized.
+ *
+ * @param[in] njobs Number of jobs
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_job_cfg_prewarm(u_int32_t njobs);
+
+/**
+ * @brief Initialize job management module
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_job_module_init(void);
+
+/**
+ * @brief Dump the status and state of the module.
+ *
+ * @param[in] fd Stream to which the status and state needs to be written
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_job_module_dump(FILE *fd);
+
+/**
+ * @brief Post a job.
+ *
+ * @detail The job is queued, and its method is invoked (with @p name and
+ * @p app_data) by a later fl_jobs_dispatch(). Jobs are run in the order in
+ * which they were posted. Jobs posted while jobs are being dispatched are run
+ * in the next turn.
+ *
+ * @param[in] name Name of the job. Must remain valid until the job is run.
+ * @param[in] method Method to be invoked
+ * @param[in] app_data Data passed to the method
+ *
+ * @return On success, the job is returned. It is valid until its method is
+ * invoked or it is cancelled. On error, NULL is returned.
+ */
+extern fl_job_t *fl_job_post(const char *name, fl_job_method_t method,
+                             void *app_data);
+
+/**
+ * @brief Cancel a job that has not been run yet.
+ *
+ * @param[in] job Job returned by fl_job_post()
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_job_cancel(fl_job_t *job);
+
+/**
+ * @brief Number of jobs that are pending.
+ *
+ * @return Number of jobs posted and not yet run
+ */
+extern u_int32_t fl_jobs_pending(void);
+
+/**
+ * @brief Run pending jobs.
+ *
+ * @detail Runs at most the configured budget (see fl_job_cfg_budget()) of
+ * jobs, in the order in which they were posted. Typically called once per
+ * turn of the main loop, after I/O and timers are dispatched.
+ *
+ * @return Number of jobs that were run
+ */
+extern u_int32_t fl_jobs_dispatch(void);
+
+#endif /* _FL_JOB_H_ */
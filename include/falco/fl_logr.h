@@ -41,37 +41,60 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdarg.h>
 #include <syslog.h>
+#include <sys/types.h>
 
 #define LOG_PRIORITY_CMP(_log_prio_) (_log_prio_ <= cfg_log_priority)
 
+/**
+ * @brief Flag ORed with the priority passed to fl_logr_syslog(), to also
+ * write the message to @c stderr.
+ */
+#define FL_LOGR_STDERR 0x10000
+
+/**
+ * @brief Maximum length (including the terminating null byte) of a message
+ * queued for the asynchronous logger. Longer messages are truncated.
+ */
+#define FL_LOGR_ASYNC_MSG_MAX_LEN 256
+
+/**
+ * @brief Default number of messages the asynchronous logger can queue.
+ */
+#define FL_LOGR_ASYNC_DEFAULT_NRECORDS 1024
+
+/**
+ * @brief Policy of the asynchronous logger when its queue is full.
+ */
+typedef enum fl_logr_overflow_e_ {
+  FL_LOGR_OVERFLOW_DROP,  ///< Drop the newest message and count the drop
+  FL_LOGR_OVERFLOW_BLOCK, ///< Wait for the logging thread to make room
+} fl_logr_overflow_e;
+
 /**
  * @brief Convenience macro to log a message with priority emergency.
  */
-#define FL_LOGR_EMERG(_fmt_...)                  \
-  do {                                           \
-    syslog(LOG_EMERG, _fmt_);                    \
-    (void) fprintf(stderr, _fmt_);               \
+#define FL_LOGR_EMERG(_fmt_...)                         \
+  do {                                                  \
+    fl_logr_syslog(LOG_EMERG | FL_LOGR_STDERR, _fmt_);  \
   } while(0)
 
 /**
  * @brief Convenience macro to log a message with priority alert.
  */
-#define FL_LOGR_ALERT(_fmt_...)                  \
-  do {                                           \
-    syslog(LOG_ALERT, _fmt_);                    \
-    (void) fprintf(stderr, _fmt_);               \
+#define FL_LOGR_ALERT(_fmt_...)                         \
+  do {                                                  \
+    fl_logr_syslog(LOG_ALERT | FL_LOGR_STDERR, _fmt_);  \
   } while(0)
 
 /**
  * @brief Convenience macro to log a message with priority critical.
  */
-#define FL_LOGR_CRIT(_fmt_...)                    \
-  do {                                            \
-    int _lp = LOG_CRIT;                           \
-    if (LOG_PRIORITY_CMP(_lp)) {                  \
-      syslog(_lp, _fmt_);                         \
-      (void) fprintf(stderr, _fmt_);              \
-    }                                             \
+#define FL_LOGR_CRIT(_fmt_...)                          \
+  do {                                                  \
+    int _lp = LOG_CRIT;                                 \
+    if (LOG_PRIORITY_CMP(_lp)) {                        \
+      fl_logr_syslog(_lp | FL_LOGR_STDERR, _fmt_);      \
+    }                                                   \
   } while(0)
 
 /**
@@ -81,7 +104,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   do {                                           \
     int _lp = LOG_ERR;                           \
     if (LOG_PRIORITY_CMP(_lp)) {                 \
-      syslog(_lp, _fmt_);                        \
+      fl_logr_syslog(_lp, _fmt_);                \
     }                                            \
   } while(0)
 
@@ -92,7 +115,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   do {                                           \
     int _lp = LOG_WARNING;                       \
     if (LOG_PRIORITY_CMP(_lp)) {                 \
-      syslog(_lp, _fmt_);                        \
+      fl_logr_syslog(_lp, _fmt_);                \
     }                                            \
   } while(0)
 
@@ -103,7 +126,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   do {                                           \
     int _lp = LOG_NOTICE;                        \
     if (LOG_PRIORITY_CMP(_lp)) {                 \
-      syslog(_lp, _fmt_);                        \
+      fl_logr_syslog(_lp, _fmt_);                \
     }                                            \
   } while(0)
 
@@ -114,7 +137,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   do {                                           \
     int _lp = LOG_INFO;                          \
     if (LOG_PRIORITY_CMP(_lp)) {                 \
-      syslog(_lp, _fmt_);                        \
+      fl_logr_syslog(_lp, _fmt_);                \
     }                                            \
   } while(0)
 
@@ -125,7 +148,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   do {                                           \
     int _lp = LOG_DEBUG;                         \
     if (LOG_PRIORITY_CMP(_lp)) {                 \
-      syslog(_lp, _fmt_);                        \
+      fl_logr_syslog(_lp, _fmt_);                \
     }                                            \
   } while(0)
 
@@ -159,6 +182,58 @@ extern void fl_logr_openlog(const char *ident);
  */
 extern void fl_logr_closelog(const char *ident);
 
+/**
+ * @brief Configure asynchronous logging.
+ *
+ * @detail In asynchronous mode, messages are formatted by the caller and
+ * queued in a lock-free ring buffer. A logging thread drains the queue to the
+ * system logger (or to @p fp), so that a slow logger does not stall the event
+ * loop. Messages with priority LOG_ALERT or higher are always written
+ * synchronously. Messages written to @p fp are stamped with the time, at
+ * clock tick resolution, at which they were queued. The logging thread is
+ * started by fl_logr_openlog(), and fl_logr_closelog() writes all queued
+ * messages before stopping it.
+ *
+ * Must be called before fl_logr_openlog().
+ *
+ * @param[in] nrecords Number of messages that can be queued, rounded up to a
+ *                     power of 2. If 0, #FL_LOGR_ASYNC_DEFAULT_NRECORDS.
+ * @param[in] overflow Policy when the queue is full
+ * @param[in] fp If not NULL, messages are written to this stream instead of
+ *               the system logger
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_logr_cfg_async(u_int32_t nrecords, fl_logr_overflow_e overflow,
+                             FILE *fp);
+
+/**
+ * @brief Enable or disable binary logging.
+ *
+ * @detail In binary mode, the FL_LOGR_* macros do not format messages. The
+ * address of the format string and the raw arguments are queued instead, and
+ * the message is formatted by the logging thread. Strings (%s) are copied.
+ * Format strings must be string literals, as they are in the FL_LOGR_* macros.
+ * Messages that can not be deferred (%m, %n, wide characters, positional
+ * arguments, or a precision for %s) are formatted by the caller.
+ * fl_logr_log() and fl_logr_vlog() always format the message, as their format
+ * strings need not outlive the call.
+ *
+ * Requires asynchronous logging (fl_logr_cfg_async()).
+ *
+ * @param[in] enable 1 to enable, 0 to disable
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_logr_cfg_binary(int enable);
+
+/**
+ * @brief Dump the state and counters of the logger.
+ *
+ * @param[in] fd File stream to dump to
+ */
+extern void fl_logr_dump(FILE *fd);
+
 /**
  * @brief Configure the priority for the logger.
  *
@@ -205,6 +280,22 @@ extern void fl_logr_log(int priority, const char *format, ...);
  */
 extern void fl_logr_vlog(int priority, const char *format, va_list args);
 
+/**
+ * @brief Send a message to the system logger, irrespective of the configured
+ * priority.
+ *
+ * Used by the FL_LOGR_* macros, after the priority check. The message is
+ * queued if asynchronous logging is enabled.
+ *
+ * @param[in] priority Priority or syslog log level, optionally ORed with
+ *                     #FL_LOGR_STDERR
+ * @param[in] format Format string of the message followed by a variable number
+ *                   of arguments
+ *
+ */
+extern void fl_logr_syslog(int priority, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
 extern int cfg_log_priority;
 
 #endif /* _FL_LOGR_H_ */
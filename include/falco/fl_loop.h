@@ -0,0 +1,229 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Event Loops
+ *
+ * An event loop is a thread that runs its own instance of the falco modules:
+ * its own fds registry (and epoll instance), timers (and timerfd), sockets,
+ * tasks, jobs, scheduler run queues and pools. Sockets, timers, tasks and
+ * jobs are owned by the loop that created them, and must only be used from
+ * that loop.
+ *
+ * fl_init() initializes the modules for the main loop, i.e. the thread that
+ * calls it. fl_loop_create() starts further loops, one per thread, each
+ * running an application method that creates its sockets and timers and runs
+ * the usual fl_socket_select() / dispatch loop. The falco APIs operate on the
+ * loop of the calling thread, so the same application code serves any loop.
+ *
+ * Module configuration (fl_*_cfg_*()) is common to all the loops, and must be
+ * done before the loops are created. Signals are handled by the main loop
+ * only. Loops are created with all signals blocked.
+ *
+ * A listener can be spread across loops by binding a socket to the same
+ * address in every loop with #FL_SOCKOPT_REUSEPORT set. The kernel then
+ * distributes the incoming connections (or datagrams) across the loops.
+ *
+ * Any thread can hand work to a loop with fl_loop_post(). Posted methods are
+ * queued in a lock-free queue of the loop, the loop is woken up through an
+ * eventfd, and fl_loop_dispatch() runs the queued methods on the loop's
+ * thread.
+ */
+
+#ifndef _FL_LOOP_H_
+#define _FL_LOOP_H_
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/select.h>
+
+#include "falco/fl_job.h"
+
+#define FL_LOOP_NAME_MAX_LEN 32
+
+/**
+ * @brief Default number of methods that can be queued by fl_loop_post().
+ */
+#define FL_LOOP_DEFAULT_POST_QUEUE 1024
+
+struct fl_loop_t_;
+struct fl_loop_post_t_;
+
+/**
+ * @brief Definition for the methods run by event loops.
+ *
+ * The method is invoked on the thread of the loop, once the falco modules
+ * have been initialized for it. The loop ends when the method returns. The
+ * method must close the sockets and delete the timers that it created.
+ */
+typedef int (*fl_loop_method_t)(struct fl_loop_t_ *, void *);
+
+/**
+ * @brief Representation of a falco event loop.
+ */
+typedef struct fl_loop_t_ {
+  LIST_ENTRY(fl_loop_t_) loop_lc;
+  char name[FL_LOOP_NAME_MAX_LEN];
+  u_int32_t id;              ///< 0 for the main loop
+  int cpu;                   ///< CPU the loop is bound to, -1 if not bound
+  pthread_t thread;
+  fl_loop_method_t method;
+  void *app_data;
+  atomic_int stop;           ///< Set by fl_loop_stop()
+  int rc;                    ///< Value returned by the method
+
+  /* Posted methods */
+  int wakeup_fd;             ///< eventfd that wakes up the loop
+  atomic_int wakeup_pending; ///< Set when the eventfd has been signalled
+  struct fl_loop_post_t_ *posts;
+  u_int32_t nposts;          ///< Size of the queue, a power of 2
+  atomic_uint posts_tail;    ///< Next position to be filled by producers
+  u_int32_t posts_head;      ///< Next position to be run by the loop
+  atomic_ullong nposted;
+  atomic_ullong nfull;       ///< Posts that failed, the queue was full
+  unsigned long long nrun;
+  unsigned long long nwakeups;
+} fl_loop_t;
+
+/**
+ * @brief Configure the size of the queue of methods posted to a loop.
+ *
+ * @detail Applies to the loops initialized after the call.
+ *
+ * @param[in] nposts Number of methods, rounded up to a power of 2. If 0,
+ *                   #FL_LOOP_DEFAULT_POST_QUEUE.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_loop_cfg_post_queue(u_int32_t nposts);
+
+/**
+ * @brief Initialize the modules of the calling thread's event loop.
+ *
+ * @detail Called by fl_init() for the main loop, and on the thread of every
+ * loop started by fl_loop_create().
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_loop_module_init(void);
+
+/**
+ * @brief Dump the status and state of the module.
+ *
+ * @param[in] fd Stream to which the status and state needs to be written
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_loop_module_dump(FILE *fd);
+
+/**
+ * @brief Start an event loop on a new thread.
+ *
+ * @param[in] name Name of the loop
+ * @param[in] cpu CPU to which the thread is bound, or -1
+ * @param[in] method Method run by the loop
+ * @param[in] app_data Data passed to the method
+ *
+ * @return On success, the loop is returned. On error, NULL is returned.
+ */
+extern fl_loop_t *fl_loop_create(const char *name, int cpu,
+                                 fl_loop_method_t method, void *app_data);
+
+/**
+ * @brief Wait for an event loop to end, and release it.
+ *
+ * @param[in] loop Loop returned by fl_loop_create()
+ *
+ * @return The value returned by the method of the loop, or -1 if the loop
+ * could not be waited for, or its modules could not be initialized.
+ */
+extern int fl_loop_join(fl_loop_t *loop);
+
+/**
+ * @brief Post a method to be run by an event loop.
+ *
+ * @detail May be called from any thread. The method is invoked (with @p name
+ * and @p app_data) on the thread of the loop, by fl_loop_dispatch(). Methods
+ * posted by a thread are run in the order in which they were posted.
+ *
+ * @param[in] loop Loop that runs the method
+ * @param[in] name Name of the method. Must remain valid until it is run.
+ * @param[in] method Method to be invoked
+ * @param[in] app_data Data passed to the method
+ *
+ * @return On success, 0 is returned. On error, -1 is returned, with errno set
+ * to EAGAIN if the queue of the loop is full.
+ */
+extern int fl_loop_post(fl_loop_t *loop, const char *name,
+                        fl_job_method_t method, void *app_data);
+
+/**
+ * @brief Run the methods posted to the calling thread's event loop.
+ *
+ * @detail To be called from the main loop of the application (the loop's
+ * eventfd is watched for read), after fl_socket_select().
+ *
+ * @param[in,out] nfds Number of file descriptors that are ready. Decremented
+ *                     if the eventfd of the loop is ready.
+ * @param[in,out] fds Set of file descriptors that are ready for read
+ */
+extern void fl_loop_dispatch(int *nfds, fd_set *fds);
+
+/**
+ * @brief Ask an event loop to end.
+ *
+ * @detail The loop is woken up. Its method is expected to check
+ * fl_loop_stopping() every turn, and return when it is set.
+ *
+ * @param[in] loop Loop to be stopped
+ */
+extern void fl_loop_stop(fl_loop_t *loop);
+
+/**
+ * @brief Check whether the loop of the calling thread has been asked to end.
+ *
+ * @return 1 if fl_loop_stop() was called for the loop, 0 otherwise.
+ */
+extern int fl_loop_stopping(void);
+
+/**
+ * @brief Get the event loop of the calling thread.
+ *
+ * @return The loop, or NULL if the thread does not run one.
+ */
+extern fl_loop_t *fl_loop_self(void);
+
+#endif /* _FL_LOOP_H_ */
@@ -0,0 +1,186 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Object Pools
+ *
+ * A pool hands out fixed size objects (of one type) from slabs, i.e. blocks
+ * of objects that are allocated together. Objects that are returned to the
+ * pool are kept in a free list, and handed out again. Slab memory is never
+ * returned to the system.
+ *
+ * Falco sockets, timers and tasks are allocated from pools. A pool can be
+ * prewarmed with a number of objects, so that creating and deleting objects
+ * in the steady state does not allocate memory.
+ */
+
+#ifndef _FL_POOL_H_
+#define _FL_POOL_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include "falco/fl_stdlib.h"
+
+/**
+ * @brief Maximum length of a pool name (including the trailing delimiter).
+ */
+#define FL_POOL_NAME_MAX_LEN 32
+
+/**
+ * @brief Default number of objects in a slab.
+ */
+#define FL_POOL_SLAB_NOBJS   64
+
+/**
+ * @brief Object pool.
+ */
+typedef struct fl_pool_t_ {
+  LIST_ENTRY(fl_pool_t_) pool_lc;
+  char name[FL_POOL_NAME_MAX_LEN]; ///< Name of the pool
+  size_t obj_size;     ///< Size of an object
+  size_t align;        ///< Alignment of an object
+  u_int32_t slab_nobjs; ///< Number of objects in a slab
+
+  void *free_list;     ///< Objects that are free, linked through their first word
+  void **slabs;        ///< Slabs allocated for the pool
+  u_int32_t nslabs;    ///< Number of slabs
+
+  /* Statistics */
+  u_int32_t nobjs;     ///< Number of objects in all the slabs
+  u_int32_t nfree;     ///< Number of objects in the free list
+  u_int32_t max_used;  ///< Largest number of objects in use at a time
+  u_int64_t ngets;     ///< Number of objects handed out
+  u_int64_t nputs;     ///< Number of objects returned
+  u_int64_t nfailures; ///< Number of requests that could not be met
+} fl_pool_t;
+
+/**
+ * @brief Allocate an object from a pool.
+ *
+ * Like #FL_ALLOC, the object is zeroed.
+ *
+ * @param[in] \_casttotype\_ Data-type of the object
+ * @param[in] \_pool\_ Pool from which the object is allocated
+ * @param[in] \_var\_ Variable to which the object is assigned to
+ * @param[in] \_msg\_ Message to be logged in case there is a failure in
+ *                    allocating the object
+ */
+#define FL_POOL_ALLOC(_casttotype_, _pool_, _var_, _msg_)           \
+  do {                                                              \
+    FL_ASSERT(sizeof(_casttotype_) <= (_pool_)->obj_size);          \
+    _var_ = (_casttotype_ *) fl_pool_get((_pool_));                 \
+    if (!_var_) {                                                   \
+      FL_ASSERT(0);                                                 \
+      FL_LOGR_CRIT("%s, %d: Unable to allocate memory from pool "   \
+                   "%s for %s", __func__, __LINE__,                 \
+                   (_pool_)->name, _msg_);                          \
+    }                                                               \
+  } while (0)
+
+/**
+ * @brief Return an object to its pool.
+ *
+ * @param[in] \_pool\_ Pool from which the object was allocated
+ * @param[in] \_var\_ Pointer to the object
+ * @param[in] \_msg\_ Message describing the object being freed
+ */
+#define FL_POOL_FREE(_pool_, _var_, _msg_)                          \
+  do {                                                              \
+    fl_pool_put((_pool_), (_var_));                                 \
+    FL_LOGR_DEBUG("%s, %d: Returned memory of type %s to pool %s",  \
+                  __func__, __LINE__, _msg_, (_pool_)->name);       \
+    (_var_) = NULL;                                                 \
+  } while (0)
+
+/**
+ * @brief Initialize the pool module.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_pool_module_init(void);
+
+/**
+ * @brief Dump the statistics of all the pools.
+ *
+ * @param[in] fd Stream to which the statistics need to be written.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_pool_module_dump(FILE *fd);
+
+/**
+ * @brief Create a pool.
+ *
+ * @param[in] name String of length not exceeding #FL_POOL_NAME_MAX_LEN
+ * @param[in] obj_size Size of an object
+ * @param[in] align Alignment (a power of 2) of an object, e.g. the size of a
+ *                  cache line. If 0, objects are aligned to a pointer.
+ * @param[in] slab_nobjs Number of objects that are allocated together, when
+ *                       the pool runs out of free objects. If 0,
+ *                       #FL_POOL_SLAB_NOBJS is used.
+ *
+ * @return On success, the pool is returned. On error, NULL is returned.
+ */
+extern fl_pool_t *fl_pool_create(const char *name, size_t obj_size,
+                                 size_t align, u_int32_t slab_nobjs);
+
+/**
+ * @brief Prewarm a pool, so that it has atleast @p nobjs free objects.
+ *
+ * @param[in] pool Pool
+ * @param[in] nobjs Number of free objects
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_pool_prewarm(fl_pool_t *pool, u_int32_t nobjs);
+
+/**
+ * @brief Get a (zeroed) object from a pool.
+ *
+ * @param[in] pool Pool
+ *
+ * @return On success, the object is returned. On error, NULL is returned.
+ */
+extern void *fl_pool_get(fl_pool_t *pool);
+
+/**
+ * @brief Return an object to the pool it was allocated from.
+ *
+ * @param[in] pool Pool
+ * @param[in] obj Object
+ */
+extern void fl_pool_put(fl_pool_t *pool, void *obj);
+
+#endif /* _FL_POOL_H_ */
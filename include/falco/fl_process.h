@@ -41,10 +41,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /**
  * @brief Initialize all falco modules.
  *
- * Initialize the timer, socket, task, and (network) interface modules in the
- * order listed. Post initialization, the function dumps all the network
+ * Initialize the file descriptors, timer, socket, task, and (network) interface
+ * modules in the order listed. Post initialization, the function dumps all the network
  * interfaces read from the kernel.
  *
+ * The calling thread becomes the main event loop (see fl_loop.h); other loops
+ * initialize their modules when they are created.
+ *
  * @return -1 on error, 0 on success.
  */
 extern int fl_init(void);
@@ -52,6 +55,8 @@ extern int fl_init(void);
 /**
  * @brief Dump status and state of all falco modules.
  *
+ * The state dumped is the one of the calling thread's event loop.
+ *
  * @param[in] fd Stream to which the status and state of all modules needs to
  *               be written. If this parameter is NULL, then the output is
  *               written to syslog.
@@ -0,0 +1,193 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Task Scheduler
+ *
+ * By default, socket and timer events are dispatched to their methods as soon
+ * as they are processed by the main loop. When the scheduler is enabled
+ * (fl_sched_cfg()), events are instead queued in the run queue of the
+ * priority of the task that owns the socket or timer, and are dispatched by
+ * fl_sched_run(), one event at a time:
+ *
+ * - #FL_SCHED_STRICT: after every event, the highest priority run queue that
+ *   is not empty is serviced next.
+ * - #FL_SCHED_WEIGHTED: run queues are serviced round robin, up to their
+ *   weight (fl_sched_cfg_weights()) of events at a time.
+ *
+ * At most a configured budget of events is dispatched per run. Remaining
+ * events stay queued and fl_socket_select() polls for I/O instead of
+ * blocking, so that events of higher priority tasks that became ready in the
+ * meantime are dispatched before them.
+ */
+
+#ifndef _FL_SCHED_H_
+#define _FL_SCHED_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+/**
+ * @brief Default number of events dispatched by fl_sched_run().
+ */
+#define FL_SCHED_DEFAULT_BUDGET 64
+
+/**
+ * @brief Task priorities.
+ */
+typedef enum fl_sched_priority_e_ {
+  FL_SCHED_PRIORITY_HIGH,    ///< For example, control plane tasks
+  FL_SCHED_PRIORITY_MEDIUM,  ///< Default priority of a task
+  FL_SCHED_PRIORITY_LOW,     ///< For example, bulk data transfer tasks
+  FL_SCHED_PRIORITY_MAX
+} fl_sched_priority_e;
+
+/**
+ * @brief Scheduling policies.
+ */
+typedef enum fl_sched_policy_e_ {
+  FL_SCHED_NONE,             ///< Events are dispatched right away (default)
+  FL_SCHED_STRICT,           ///< Strict priority
+  FL_SCHED_WEIGHTED,         ///< Weighted round robin among priorities
+} fl_sched_policy_e;
+
+struct fl_sched_event_t_;
+
+/**
+ * @brief Definition for methods that dispatch a scheduled event.
+ */
+typedef void (*fl_sched_event_method_t)(struct fl_sched_event_t_ *);
+
+/**
+ * @brief An event in a run queue.
+ *
+ * @detail Embedded in the objects (sockets and timers) whose events are
+ * scheduled. An event is queued at most once.
+ */
+typedef struct fl_sched_event_t_ {
+  TAILQ_ENTRY(fl_sched_event_t_) event_lc;
+  fl_sched_event_method_t method; ///< Invoked when the event is dispatched
+  void *owner;                    ///< Object that owns the event
+  int8_t priority;                ///< Run queue, -1 if the event is not queued
+} fl_sched_event_t;
+
+/**
+ * @brief Configure the scheduler.
+ *
+ * @param[in] policy Enumerated value from #fl_sched_policy_e
+ * @param[in] budget Maximum number of events dispatched by fl_sched_run().
+ *                   If 0, #FL_SCHED_DEFAULT_BUDGET.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_sched_cfg(fl_sched_policy_e policy, u_int32_t budget);
+
+/**
+ * @brief Configure the weights of the priorities for #FL_SCHED_WEIGHTED.
+ *
+ * @param[in] weights Number of events of each priority (indexed by
+ *                    #fl_sched_priority_e) that are dispatched in a round.
+ *                    Weights must not be 0. The default weights are 8, 4
+ *                    and 1.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_sched_cfg_weights(const u_int32_t weights[FL_SCHED_PRIORITY_MAX]);
+
+/**
+ * @brief Initialize the scheduler of the calling event loop.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_sched_module_init(void);
+
+/**
+ * @brief Dump the status and state of the scheduler.
+ *
+ * @param[in] fd Stream to which the status and state needs to be written
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_sched_module_dump(FILE *fd);
+
+/**
+ * @brief Whether events are scheduled, rather than dispatched right away.
+ */
+extern int fl_sched_enabled(void);
+
+/**
+ * @brief Initialize an event.
+ *
+ * @param[in] event Event
+ * @param[in] method Method invoked when the event is dispatched
+ * @param[in] owner Object that owns the event
+ */
+extern void fl_sched_event_init(fl_sched_event_t *event,
+                                fl_sched_event_method_t method, void *owner);
+
+/**
+ * @brief Queue an event in the run queue of a priority.
+ *
+ * @detail An event that is already queued is left in its run queue.
+ *
+ * @param[in] event Event
+ * @param[in] priority Enumerated value from #fl_sched_priority_e
+ */
+extern void fl_sched_event_queue(fl_sched_event_t *event,
+                                 fl_sched_priority_e priority);
+
+/**
+ * @brief Remove an event from its run queue, if it is queued.
+ *
+ * @param[in] event Event
+ */
+extern void fl_sched_event_cancel(fl_sched_event_t *event);
+
+/**
+ * @brief Number of events that are queued.
+ */
+extern u_int32_t fl_sched_runnable(void);
+
+/**
+ * @brief Dispatch queued events.
+ *
+ * @detail Dispatches up to the configured budget of events, as per the
+ * scheduling policy. Typically called once per turn of the main loop, after
+ * I/O and timers are processed.
+ *
+ * @return Number of events that were dispatched
+ */
+extern u_int32_t fl_sched_run(void);
+
+#endif /* _FL_SCHED_H_ */
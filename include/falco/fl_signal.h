@@ -38,7 +38,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _FL_SIGNAL_H_
 #define _FL_SIGNAL_H_
 
+#include <stdio.h>
 #include <signal.h>
+#include <sys/select.h>
 
 #include "falco/fl_tracevalue.h"
 
@@ -66,6 +68,58 @@ typedef struct fl_signal_handler_regn_t_ {
   fl_signal_handler_t signal_handler;
 } fl_signal_handler_regn_t;
 
+/**
+ * @brief How signals are delivered to their handlers.
+ */
+typedef enum fl_signal_delivery_e_ {
+  /**
+   * @brief Handlers are installed with @c sigaction(2) and run
+   * asynchronously (default).
+   */
+  FL_SIGNAL_DELIVERY_ASYNC,
+  /**
+   * @brief Signals are blocked once and read from a @c signalfd(2), which is
+   * an ordinary event loop file descriptor. Handlers run in loop context from
+   * fl_signals_dispatch(), so they can use sockets and timers. The third
+   * argument of a handler is NULL.
+   */
+  FL_SIGNAL_DELIVERY_LOOP,
+} fl_signal_delivery_e;
+
+/**
+ * @brief Configure how signals are delivered to their handlers.
+ *
+ * @detail Must be configured before any handler is added. With
+ * #FL_SIGNAL_DELIVERY_LOOP, the main loop need not block and unblock signals
+ * (fl_signals_block() and fl_signals_unblock()) around dispatching. Signals
+ * are blocked for the calling thread (and threads it creates later), so this
+ * should be configured before other threads are created.
+ *
+ * @param[in] delivery Enumerated value from #fl_signal_delivery_e
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_signal_cfg_delivery(fl_signal_delivery_e delivery);
+
+/**
+ * @brief Initialize the signal module.
+ *
+ * @detail Adds the signalfd (if handlers were added with
+ * #FL_SIGNAL_DELIVERY_LOOP) to the event loop file descriptors.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_signal_module_init(void);
+
+/**
+ * @brief Dump the status and state of the module.
+ *
+ * @param[in] fd Stream to which the status and state needs to be written
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_signal_module_dump(FILE *fd);
+
 /**
  * @brief Register a set of signal handlers.
  *
@@ -123,6 +177,20 @@ extern int fl_signals_block(int signals[], sigset_t *set);
  */
 extern int fl_signals_unblock(sigset_t *set);
 
+/**
+ * @brief Dispatch signals delivered through the signalfd.
+ *
+ * @detail Reads all pending signals from the signalfd and invokes their
+ * handlers, with the @c siginfo_t of each signal. Only used with
+ * #FL_SIGNAL_DELIVERY_LOOP.
+ *
+ * @param[in,out] nfds Number of file descriptors that need to be read. It is
+ *                     decremented by one if the signalfd was processed in this
+ *                     dispatch run.
+ * @param[in,out] rfds Set of file descriptors ready for read.
+ */
+extern void fl_signals_dispatch(int *nfds, fd_set *rfds);
+
 extern const values_t fl_signals[];
 
 #endif /* _FL_SIGNAL_H_ */
@@ -88,6 +88,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "falco/fl_stdlib.h"
 #include "falco/fl_bits.h"
 #include "falco/fl_tracevalue.h"
+#include "falco/fl_sched.h"
+#include "falco/fl_work.h"
+#include "falco/fl_hist.h"
 
 /**
  * @brief Maximum length of a socket name (including the trailing delimiter).
@@ -126,6 +129,83 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * @brief Flag to indicate that recevie wait option has been set on the socket.
  */
 #define FL_SOCKF_RCVWAIT            BITVAL(0x00000040)
+/**
+ * @brief Flag to indicate the state that a non-blocking connection attempt is
+ * in progress on the socket.
+ */
+#define FL_SOCKF_CONNECTING         BITVAL(0x00000080)
+/**
+ * @brief Flag to indicate the state that the transmit queue of the socket has
+ * reached its high watermark, and has not yet drained to its low watermark.
+ */
+#define FL_SOCKF_TXQ_HIGH           BITVAL(0x00000100)
+/**
+ * @brief Flag to indicate the state that an operation on the socket has been
+ * deferred, and is retried after a back-off delay.
+ */
+#define FL_SOCKF_DEFERRED           BITVAL(0x00000200)
+/**
+ * @brief Flag to indicate that the local address (@c meta->sa_local) of the
+ * socket is known. Otherwise, it is fetched with @c getsockname(2) when
+ * needed.
+ */
+#define FL_SOCKF_LOCAL_ADDR         BITVAL(0x00000400)
+/**
+ * @brief Flag to indicate that the local address of the socket has been
+ * formatted into @c meta->local_addr.
+ */
+#define FL_SOCKF_LOCAL_ADDR_STR     BITVAL(0x00000800)
+/**
+ * @brief Flag to indicate that the remote address of the socket has been
+ * formatted into @c meta->remote_addr.
+ */
+#define FL_SOCKF_REMOTE_ADDR_STR    BITVAL(0x00001000)
+/**
+ * @brief Flag to indicate that the persistent read option has been set on the
+ * socket (#FL_SOCKOPT_PERSISTENT_READ).
+ */
+#define FL_SOCKF_PERSISTENT_READ    BITVAL(0x00002000)
+/**
+ * @brief Flag to indicate the state that receiving on the socket has been
+ * paused by the application (see fl_socket_pause_read()).
+ */
+#define FL_SOCKF_READ_PAUSED        BITVAL(0x00004000)
+
+/**
+ * @brief Initial back-off delay (in milliseconds) of a deferred operation.
+ */
+#define FL_SOCKET_BACKOFF_MIN_MS 100
+/**
+ * @brief Maximum back-off delay (in milliseconds) of a deferred operation. The
+ * delay doubles with every failed retry, up to this value.
+ */
+#define FL_SOCKET_BACKOFF_MAX_MS 3000
+
+/**
+ * @brief Maximum number of queued buffers that are handed to the kernel in
+ * one transmit call.
+ */
+#define FL_SOCKET_TXQ_IOV_MAX    64
+
+/**
+ * @brief Maximum number of datagrams that are handed to the kernel in one
+ * batched transmit call.
+ */
+#define FL_SOCKET_DGRAM_BATCH_MAX 64
+
+/**
+ * @brief Maximum number of messages (or batches of datagrams) received from a
+ * socket in persistent read mode every time it is ready. Whatever is left is
+ * received after the other ready sockets have been served.
+ */
+#define FL_SOCKET_DRAIN_MAX      64
+
+/**
+ * @brief Spin budget (in microseconds) that the adaptive busy-poll mode
+ * starts from, and below which it stops spinning (see
+ * fl_socket_cfg_busy_poll()).
+ */
+#define FL_SOCKET_BUSY_POLL_BASE_US 10
 
 struct fl_socket_t_;
 
@@ -190,66 +270,236 @@ typedef void (*fl_socket_send_complete_method_t)(struct fl_socket_t_ *);
  * transmit/send operation.
  */
 typedef void (*fl_socket_send_error_method_t)(struct fl_socket_t_ *);
+/**
+ * @brief Type definition for methods to handle the deferral of an operation
+ * on a socket due to a transient error.
+ */
+typedef void (*fl_socket_deferred_method_t)(struct fl_socket_t_ *, int error, u_int32_t delay_ms);
+/**
+ * @brief Type definition for methods to handle the completion of the
+ * transmission of a buffer from the transmit queue.
+ */
+typedef void (*fl_socket_txq_buf_complete_method_t)(struct fl_socket_t_ *, void *buf, size_t len);
+/**
+ * @brief Type definition for methods to handle the transmit queue of a socket
+ * crossing its high or low watermark.
+ */
+typedef void (*fl_socket_txq_watermark_method_t)(struct fl_socket_t_ *, size_t queued_bytes);
 
 /**
- * @brief Falco Socket.
+ * @brief Buffer in the transmit queue of a falco socket.
  */
-typedef struct fl_socket_t_ {
+typedef struct fl_socket_txbuf_t_ {
+  void *buf;  ///< Buffer supplied by the application
+  size_t len; ///< Length of the buffer
+} fl_socket_txbuf_t;
+
+/**
+ * @brief Accept counters of a listening falco socket.
+ */
+typedef struct fl_socket_accept_stats_t_ {
+  u_int64_t nwakeups;   ///< Number of times the socket was ready to accept
+  u_int64_t naccepted;  ///< Number of connections accepted
   /**
-   * @brief List connector for all sockets.
+   * @brief Number of connections that were accepted and closed right away,
+   * because the process ran out of file descriptors.
    */
-  LIST_ENTRY(fl_socket_t_) socket_lc;
+  u_int64_t nrejected;
+  u_int64_t nexhausted; ///< Number of wakeups that used up the accept budget
+  u_int64_t nerrors;    ///< Number of accept errors
+  u_int32_t max_burst;  ///< Largest number of connections accepted in a wakeup
+} fl_socket_accept_stats_t;
+
+/**
+ * @brief Datagram in a batch of datagrams received or transmitted on a
+ * SOCK_DGRAM socket.
+ */
+typedef struct fl_socket_dgram_t_ {
+  void *buf;   ///< Buffer of the datagram
+  size_t len;  ///< Length of the datagram
   /**
-   * @brief List connector for all sockets associated with a task.
+   * @brief Source address (received datagrams) or destination address
+   * (transmitted datagrams) of the datagram.
    */
-  LIST_ENTRY(fl_socket_t_) task_socket_lc;
+  struct sockaddr_storage addr;
+  socklen_t addrlen; ///< Length of @c addr
+  int error;   ///< 0, or the error number with which the datagram failed
+} fl_socket_dgram_t;
 
-  char name[FL_SOCKET_NAME_MAX_LEN]; ///< Socket name specified by the application during #fl_socket_socket().
-  int domain; ///< Socket domain. One of AF_INET or AF_INET6 or AF_UNIX
-  int type; ///< Socket type. One of SOCK_DGRAM or SOCK_RAW or SOCK_STREAM
-  int protocol; ///< Protocol to use, refer to the man page for socket
+/**
+ * @brief Type definition for methods that handle a batch of received or
+ * transmitted datagrams.
+ */
+typedef void (*fl_socket_dgram_batch_method_t)(struct fl_socket_t_ *, fl_socket_dgram_t *dgrams, u_int32_t ndgrams);
 
-  fl_socket_accept_method_t accept_method;
-  fl_socket_connect_method_t connect_method;
-  fl_socket_connect_complete_method_t connect_complete_method;
-  fl_socket_recv_method_t recv_method;
-  fl_socket_nb_recv_method_t nb_recv_method;
-  fl_socket_recv_is_msg_complete_method_t recv_is_msg_complete_method;
-  fl_socket_recv_complete_method_t recv_complete_method;
-  fl_socket_recv_error_method_t recv_error_method;
-  fl_socket_send_method_t send_method;
-  fl_socket_nb_send_method_t nb_send_method;
-  fl_socket_send_complete_method_t send_complete_method;
-  fl_socket_send_error_method_t send_error_method;
+/**
+ * @brief Batch of datagrams of a SOCK_DGRAM socket, and the message headers
+ * that are handed to @c recvmmsg(2) or @c sendmmsg(2).
+ */
+typedef struct fl_socket_dgram_batch_t_ {
+  fl_socket_dgram_t *dgrams; ///< Datagrams of the batch
+  struct mmsghdr *msgs;      ///< Message headers, one for every datagram
+  struct iovec *iovs;        ///< I/O vectors, one for every datagram
+  u_int32_t size;            ///< Number of datagrams allocated
+  u_int32_t head;            ///< Index of the first queued datagram (transmit)
+  u_int32_t count;           ///< Number of datagrams (queued for transmit)
+  u_int64_t ncalls;          ///< Number of @c recvmmsg(2) / @c sendmmsg(2) calls
+  u_int64_t ndgrams;         ///< Number of datagrams received or transmitted
+  u_int64_t nerrors;         ///< Number of datagrams that failed
+} fl_socket_dgram_batch_t;
 
-  int sockfd; ///< Socket file descriptor
-  flag_t flags; ///< Socket state flags. See flags starting from #FL_SOCKF_BOUND_IN
+/**
+ * @brief Maximum length of the string (including the trailing delimiter)
+ * that represents a socket address in a printable (presentation) format.
+ */
+/* From sys/un.h sun_path length is 108. This value should be more than
+ * sufficient across platforms.
+ */
+#define FL_SOCKADDR_STR_MAX_LEN 130
+
+/**
+ * @brief Size of a CPU cache line. Falco sockets are aligned to it.
+ */
+#define FL_SOCKET_CACHELINE_SIZE 64
+
+/**
+ * @brief Histograms of a socket, see fl_socket_get_hist().
+ */
+typedef enum fl_socket_hist_e_ {
+  FL_SOCKET_HIST_ACCEPT, ///< Time taken by the accept method
+  FL_SOCKET_HIST_RECV,   ///< Time taken by the non-blocking receive method
+  FL_SOCKET_HIST_SEND,   ///< Time taken by the non-blocking send method (or by the completion of a connection)
+  FL_SOCKET_HIST_MAX
+} fl_socket_hist_e;
+
+/**
+ * @brief Metadata of a falco socket.
+ *
+ * Names and addresses of a socket are not needed to dispatch its events. They
+ * are kept out of line (see @c fl_socket_t.meta), so that they do not take up
+ * cache lines of the socket.
+ */
+typedef struct fl_socket_meta_t_ {
+  char name[FL_SOCKET_NAME_MAX_LEN]; ///< Socket name specified by the application during #fl_socket_socket().
   struct sockaddr_storage sa_local; ///< Local address of the socket
   /**
-   * @brief Maximum length of the string (including the trailing delimiter)
-   * that represents a socket address in a printable (presentation) format.
-   */
-  /* From sys/un.h sun_path length is 108. This value should be more than
-   * sufficient across platforms.
+   * @brief Local address of the socket in presentation format. Formatted on
+   * first access, use fl_socket_local_addr_str().
    */
-#define FL_SOCKADDR_STR_MAX_LEN 130
-  char local_addr[FL_SOCKADDR_STR_MAX_LEN]; ///< Local address of the socket in presentation format
+  char local_addr[FL_SOCKADDR_STR_MAX_LEN];
 
   struct sockaddr_storage sa_remote; ///< Remote address of the socket
-  char remote_addr[FL_SOCKADDR_STR_MAX_LEN]; ///< Remote address of the socket in presentation format
+  /**
+   * @brief Remote address of the socket in presentation format. Formatted on
+   * first access, use fl_socket_remote_addr_str().
+   */
+  char remote_addr[FL_SOCKADDR_STR_MAX_LEN];
+
+  struct sockaddr_storage rbuf_src_addr; ///< Source address of the read buffer (i.e. address of the sender)
+  struct sockaddr_storage wbuf_dest_addr; ///< Destination address (to where the write buffer needs to be sent/transmitted)
+
+  fl_work_strand_t *strand; ///< Orders the work offloaded by fl_socket_offload()
+  /**
+   * @brief Histograms of the socket, indexed by #fl_socket_hist_e. Allocated
+   * on first use when built with ENABLE_INSTRUMENTATION, see fl_hist.h.
+   */
+  fl_hist_t *hist[FL_SOCKET_HIST_MAX];
+} fl_socket_meta_t;
+
+/**
+ * @brief Falco Socket.
+ *
+ * Fields are laid out in the order in which they are accessed when the
+ * events of the socket are dispatched. The fd, flags, the dispatch methods
+ * and the buffer cursors share the first cache line. Sockets are allocated
+ * aligned to #FL_SOCKET_CACHELINE_SIZE.
+ */
+typedef struct fl_socket_t_ {
+  /* Dispatch */
+  int sockfd; ///< Socket file descriptor
+  flag_t flags; ///< Socket state flags. See flags starting from #FL_SOCKF_BOUND_IN
+  fl_socket_nb_recv_method_t nb_recv_method;
+  fl_socket_nb_send_method_t nb_send_method;
+  fl_socket_accept_method_t accept_method;
 
   /* Data Buffers */
   void *rbuf;        ///< Read data buffer supplied by the application
   size_t trbuf_len;  ///< Total read data buffer length supplied by the application
   size_t crdata_len; ///< Current read data buffer updated by the recv method
-  struct sockaddr_storage rbuf_src_addr; ///< Source address of the buffer (i.e. address of the sender)
 
   void *wbuf;        ///< Write data buffer supplied by the application
   size_t twbuf_len;  ///< Total write data buffer length supplied by the application
   size_t cwdata_len; ///< Current write data buffer updated by the write method
-  struct sockaddr_storage wbuf_dest_addr; ///< Destination address (to where this buffer needs to be sent/transmitted)
+
+  /* Transmit Queue */
+  fl_socket_txbuf_t *txq; ///< Ring of buffers queued for transmission
+  u_int32_t txq_size;     ///< Number of entries allocated for the ring
+  u_int32_t txq_head;     ///< Index of the first (oldest) buffer in the ring
+  u_int32_t txq_count;    ///< Number of buffers in the ring
+  size_t txq_off;         ///< Length of the first buffer already transmitted
+  size_t txq_bytes;       ///< Length of the queued data not yet transmitted
+  size_t txq_low_wm;      ///< Low watermark (in bytes) of the transmit queue
+  size_t txq_high_wm;     ///< High watermark (in bytes) of the transmit queue
+
+  /* Batched Datagram I/O */
+  fl_socket_dgram_batch_t *rx_batch; ///< Receive batch, see fl_socket_recv_batch()
+  fl_socket_dgram_batch_t *tx_batch; ///< Transmit batch, see fl_socket_send_batch()
+
+  /* Completion and error methods */
+  fl_socket_recv_is_msg_complete_method_t recv_is_msg_complete_method;
+  fl_socket_recv_complete_method_t recv_complete_method;
+  fl_socket_recv_error_method_t recv_error_method;
+  fl_socket_send_complete_method_t send_complete_method;
+  fl_socket_send_error_method_t send_error_method;
+  fl_socket_connect_complete_method_t connect_complete_method;
+  fl_socket_connect_error_method_t connect_error_method;
+  fl_socket_txq_buf_complete_method_t txq_buf_complete_method;
+  fl_socket_txq_watermark_method_t txq_high_method;
+  fl_socket_txq_watermark_method_t txq_low_method;
+  fl_socket_dgram_batch_method_t recv_batch_method;
+  fl_socket_dgram_batch_method_t send_batch_complete_method;
+  fl_socket_deferred_method_t deferred_method;
+
+  /* Blocking methods */
+  fl_socket_connect_method_t connect_method;
+  fl_socket_recv_method_t recv_method;
+  fl_socket_send_method_t send_method;
+
+  int domain; ///< Socket domain. One of AF_INET or AF_INET6 or AF_UNIX
+  int type; ///< Socket type. One of SOCK_DGRAM or SOCK_RAW or SOCK_STREAM
+  int protocol; ///< Protocol to use, refer to the man page for socket
+
+  /**
+   * @brief Deadline timer of a non-blocking connection attempt. Present only
+   * while the attempt is in progress.
+   */
+  struct fl_timer_t_ *connect_timer;
+
+  /* Accept */
+  u_int32_t accept_budget; ///< Maximum connections accepted per wakeup, see #FL_SOCKOPT_ACCEPT_BUDGET
+  fl_socket_accept_stats_t accept_stats; ///< Accept counters of a listening socket
+
+  /* Back-off of deferred operations */
+  struct fl_timer_t_ *backoff_timer; ///< Retry timer, present only while an operation is deferred
+  int backoff_op;         ///< FD operation that is retried when the timer fires
+  u_int32_t backoff_ms;   ///< Current back-off delay, 0 if the last attempt succeeded
+  u_int64_t ndeferrals;   ///< Number of times an operation has been deferred
 
   struct fl_task_t_ *task; ///< The falco task to which this socket is associated
+  fl_socket_meta_t *meta; ///< Names and addresses of the socket
+
+  /* Scheduling, see fl_sched.h */
+  fl_sched_event_t sched_event; ///< Event in the run queue of the task priority
+  u_int8_t sched_ops;     ///< Operations pending dispatch by the scheduler
+
+  /**
+   * @brief List connector for all sockets.
+   */
+  LIST_ENTRY(fl_socket_t_) socket_lc;
+  /**
+   * @brief List connector for all sockets associated with a task.
+   */
+  LIST_ENTRY(fl_socket_t_) task_socket_lc;
 } fl_socket_t;
 
 /**
@@ -273,9 +523,123 @@ typedef enum fl_sockoption_e_ {
    * @brief Maps to SO_SNDTIMEO (Send TimeOut) for the socket.
    */
   FL_SOCKOPT_SNDTIMEO,
-  FL_SOCKOPT_MAX = FL_SOCKOPT_SNDTIMEO,
+  /**
+   * @brief High-rate accept mode for a listening socket. The third argument is
+   * the maximum number of connections (an integer) accepted every time the
+   * socket is ready. If 0, then, one connection is accepted at a time.
+   *
+   * In this mode, fl_socket_generic_accept() uses @c accept4(2) to create
+   * non-blocking (#FL_SOCKF_NONBLOCKING) and close-on-exec sockets, and the
+   * listening socket is set to non-blocking mode. When the process runs out
+   * of file descriptors, a reserved file descriptor is used to accept and
+   * close the pending connections, instead of leaving them in the backlog.
+   * Setting the budget to 0 does not change the blocking mode of the
+   * listening socket.
+   */
+  FL_SOCKOPT_ACCEPT_BUDGET,
+  /**
+   * @brief Maps to SO_REUSEPORT for the socket. The third argument (an
+   * integer) enables (1) or disables (0) the option. Must be set before the
+   * socket is bound.
+   *
+   * Sockets of the event loops (see fl_loop.h) bound to the same address with
+   * this option share the incoming connections, or datagrams.
+   */
+  FL_SOCKOPT_REUSEPORT,
+  /**
+   * @brief Persistent read mode for a non-blocking socket. The third argument
+   * (an integer) enables (1) or disables (0) the mode.
+   *
+   * In this mode, the sockfd stays set for read while a receive is
+   * outstanding, instead of being cleared before, and set again after, every
+   * receive. fl_socket_generic_nb_recv() drains the socket until @c EAGAIN
+   * (up to #FL_SOCKET_DRAIN_MAX messages), and the buffer supplied in
+   * fl_socket_generic_recv() stays posted: after the @c recv_complete_method
+   * returns, the next message is received into the same buffer. With a kernel
+   * interest list (epoll or io_uring), the interest only changes when the
+   * application calls fl_socket_pause_read() or fl_socket_resume_read().
+   */
+  FL_SOCKOPT_PERSISTENT_READ,
+  FL_SOCKOPT_MAX = FL_SOCKOPT_PERSISTENT_READ,
 } fl_sockoption_e;
 
+/**
+ * @brief Counters of the adaptive busy-poll mode of an event loop.
+ *
+ * @detail The spin time is the CPU that is spent to avoid blocking, and the
+ * hit time is the latency at which spins found events, to be compared with
+ * the time spent blocked.
+ */
+typedef struct fl_socket_busy_poll_stats_t_ {
+  u_int32_t budget_us; ///< Current spin budget (microseconds)
+  u_int64_t nspins; ///< Waits that spun before blocking
+  u_int64_t nhits; ///< Spins that found a ready file descriptor
+  u_int64_t nmisses; ///< Spins that ran out of budget
+  u_int64_t nblocks; ///< Waits that blocked
+  u_int64_t spin_ns; ///< Time spent spinning
+  u_int64_t hit_ns; ///< Time from the start of a spin to the event, over hits
+  u_int64_t block_ns; ///< Time spent blocked
+} fl_socket_busy_poll_stats_t;
+
+/**
+ * @brief Configure the adaptive busy-poll mode of the event loops.
+ *
+ * @detail When there is no pending work, fl_socket_select() blocks for the
+ * file descriptors to become ready. In busy-poll mode, it first spins with
+ * zero-timeout readiness checks for up to a spin budget, which avoids the
+ * wakeup latency of blocking when events arrive shortly. The budget adapts to
+ * the event arrival rate: after a spin that found no event, the loop blocks
+ * and measures the time until the next event. If that is within @p max_us, the
+ * budget doubles (starting from #FL_SOCKET_BUSY_POLL_BASE_US). Otherwise, it
+ * halves, down to no spinning.
+ *
+ * @param[in] max_us Maximum spin budget in microseconds. 0 disables the mode
+ *                   (default).
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_cfg_busy_poll(u_int32_t max_us);
+
+/**
+ * @brief Configure socket level busy polling for the sockets created from now.
+ *
+ * @detail Sets @c SO_BUSY_POLL (and @c SO_PREFER_BUSY_POLL, when
+ * @p prefer is set) on every socket created by fl_socket_socket() or
+ * accepted by the socket module, so that the kernel polls the device queue of
+ * the socket for up to @p busy_poll_us microseconds on receive. A value above
+ * the @c net.core.busy_read sysctl requires @c CAP_NET_ADMIN; failures are
+ * logged and do not fail the socket creation.
+ *
+ * @param[in] busy_poll_us Busy poll time in microseconds. 0 disables the
+ *                         option (default).
+ * @param[in] prefer Set @c SO_PREFER_BUSY_POLL as well
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_cfg_sock_busy_poll(u_int32_t busy_poll_us, int prefer);
+
+/**
+ * @brief Get the counters of the adaptive busy-poll mode of the calling
+ * thread's event loop.
+ *
+ * @param[out] stats Counters
+ */
+extern void fl_socket_get_busy_poll_stats(fl_socket_busy_poll_stats_t *stats);
+
+/**
+ * @brief Configure the number of sockets that are preallocated.
+ *
+ * @detail Sockets are allocated from a pool (see fl_pool.h). The pool is
+ * prewarmed with @p nsockets sockets when the module is initialized by fl_init(),
+ * or right away if the module has already been initialized. Creating and
+ * deleting upto @p nsockets sockets then does not allocate memory.
+ *
+ * @param[in] nsockets Number of sockets
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_cfg_prewarm(u_int32_t nsockets);
+
 /**
  * @brief Initialize socket and communications module.
  *
@@ -364,6 +728,71 @@ extern const char *fl_sockaddr_ntop(const struct sockaddr_storage *ss,
  */
 extern u_int16_t fl_sockaddr_port_hbo(const struct sockaddr_storage *ss);
 
+/**
+ * @brief Get the local address of a falco socket in presentation format.
+ *
+ * The address is formatted (and, for an accepted socket, fetched with
+ * @c getsockname(2)) on the first call, and cached in
+ * @c flsk->meta->local_addr until the local address changes.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @return The address string, e.g. "192.0.2.1:80" for AF_INET and AF_INET6
+ * sockets, or the path of an AF_UNIX socket. An empty string is returned if
+ * the socket has no local address yet.
+ */
+extern const char *fl_socket_local_addr_str(fl_socket_t *flsk);
+
+/**
+ * @brief Get the remote address of a falco socket in presentation format.
+ *
+ * The address is formatted on the first call, and cached in
+ * @c flsk->meta->remote_addr until the remote address changes.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @return The address string. An empty string is returned if the socket has
+ * no remote address.
+ */
+extern const char *fl_socket_remote_addr_str(fl_socket_t *flsk);
+
+/**
+ * @brief Get a summary of a histogram of a falco socket.
+ *
+ * @detail Every dispatch of the accept, non-blocking receive or non-blocking
+ * send method of the socket, by fl_socket_process_connections(),
+ * fl_socket_process_reads() or fl_socket_process_writes() (or by the
+ * scheduler, see fl_sched.h), is timed. Histograms are empty unless the
+ * library is built with ENABLE_INSTRUMENTATION.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] which Enumerated value from #fl_socket_hist_e
+ * @param[out] snap Summary of the histogram (see fl_hist_snapshot())
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_get_hist(const fl_socket_t *flsk, fl_socket_hist_e which,
+                              fl_hist_snapshot_t *snap);
+
+/**
+ * @brief Close a falco socket.
+ *
+ * The socket file descriptor is closed, and is no longer watched (also, if it
+ * was found ready in the current loop, it is not processed). Timers,
+ * transmit queues and datagram batches of the socket are released, and the
+ * falco socket is returned to the socket pool. Buffers supplied by the
+ * application are not freed.
+ *
+ * A falco socket can be closed from any of its methods. It must not be
+ * accessed after it has been closed.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @return On success, 0 is returned. If @c close(2) fails, -1 is returned and
+ * @c errno is set, the falco socket is released all the same.
+ */
+extern int fl_socket_close(fl_socket_t *flsk);
+
 /**
  * @brief Create an endpoint for communication
  *
@@ -376,9 +805,12 @@ extern u_int16_t fl_sockaddr_port_hbo(const struct sockaddr_storage *ss);
  * as in @c socket(2).
  *
  * @return On success, a pointer to a structure that represents a falco socket
- * is returned. Otherwise, NULL is returned.
+ * is returned. Otherwise, NULL is returned, and @c errno is set. If the
+ * system is out of resources (@c EMFILE, @c ENFILE, @c ENOBUFS, @c ENOMEM),
+ * the function does not wait for resources to be freed; the application can
+ * retry later, for example from a timer.
  *
- * The pointer to the falco socket structure needs to be freed by the
+ * The falco socket needs to be closed with fl_socket_close() by the
  * application when it is no longer required.
  *
  * @see socket(2)
@@ -453,13 +885,21 @@ extern int fl_socket_listen(fl_socket_t *flsk, int backlog);
  * tell the FDs management module to track an FD for a certain operation.
  * @p rfds, @p wfds and @p efds are independent sets of FDs and are watched.
  *
+ * The wait is performed by the backend configured in the FDs management module
+ * (see fl_fds_cfg_backend()). With the epoll backend, only ready FDs are
+ * returned by the kernel, and FDs not less than @c FD_SETSIZE can be watched.
+ * Such FDs are not reflected in @p rfds, @p wfds and @p efds, but are
+ * processed by fl_socket_process_reads(), fl_socket_process_writes(),
+ * fl_socket_process_connections() and fl_timers_dispatch() all the same.
+ *
  * @param[in,out] rfds Set of file descriptors to be watched for write
  * @param[in,out] wfds Set of file descriptors to be watched for read
  * @param[in,out] efds Set of file descriptors to be watched for exceptions
  *
- * @return On success, 0 is returned. On error, -1 is returned.
+ * @return On success, the number of ready FDs is returned. On error, -1 is
+ * returned.
  *
- * @see @c select(2), #FL_FD_SET, #FL_FD_CLR, #FL_FD_ZERO, fl_fd_isset()
+ * @see @c select(2), @c epoll(7), #FL_FD_SET, #FL_FD_CLR, #FL_FD_ZERO, fl_fd_isset()
  */
 extern int fl_socket_select(fd_set **rfds, fd_set **wfds, fd_set **efds);
 
@@ -470,7 +910,9 @@ extern int fl_socket_select(fd_set **rfds, fd_set **wfds, fd_set **efds);
  * uses the @c accept(2) system call to process pending connections.
  *
  * On successful connection to a client, a new falco socket is created. Its
- * fd is set to the fd returned from @c accept(2). The local address is set.
+ * fd is set to the fd returned from @c accept(2). In the high-rate accept
+ * mode (#FL_SOCKOPT_ACCEPT_BUDGET), up to the configured number of pending
+ * connections are accepted in one call. The local address is set.
  * For AF_INET and AF_INET6 families, the remote address is set from the remote
  * address returned from @c accept(2). The application is then notified of the
  * new connection by invoking the @c connect_complete_method() which implements
@@ -505,6 +947,41 @@ extern int fl_socket_generic_connect(fl_socket_t *flsk,
                                      const struct sockaddr_storage *addr,
                                      socklen_t addrlen);
 
+/**
+ * @brief Initiate a non-blocking connection on a socket
+ *
+ * A non-blocking counterpart of fl_socket_generic_connect(). The sockfd
+ * (contained within the falco socket) must have been set to non-blocking mode
+ * (#FL_SOCKOPT_NONBLOCKING). The function starts the connection and returns
+ * without waiting for it to complete, so that the application can initiate
+ * many connections at once.
+ *
+ * While the connection is in progress, the socket is flagged with
+ * #FL_SOCKF_CONNECTING and the sockfd is watched for write.
+ * fl_socket_process_writes() checks the outcome of the attempt (@c SO_ERROR)
+ * when the sockfd becomes writable, and invokes the @c connect_complete_method
+ * of the socket on success, or the @c connect_error_method with the error
+ * number on failure. If the attempt does not complete within @p timeout_ms,
+ * it is aborted and the @c connect_error_method is invoked with
+ * @c ETIMEDOUT.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] addr Remote address
+ * @param[in] addrlen Specifies the size of @p addr
+ * @param[in] timeout_ms Deadline of the attempt (in milliseconds). If 0, then,
+ *                       the attempt is bound only by the kernel timeouts.
+ *
+ * @return On success (the connection is complete or in progress), 0 is
+ * returned. On error, -1 is returned and no method is invoked.
+ *
+ * @see @c connect(2), fl_socket_set_connect_complete_method(),
+ * fl_socket_set_connect_error_method()
+ */
+extern int fl_socket_generic_nb_connect(fl_socket_t *flsk,
+                                        const struct sockaddr_storage *addr,
+                                        socklen_t addrlen,
+                                        u_int32_t timeout_ms);
+
 /**
  * @brief Receive a message from a socket
  *
@@ -532,6 +1009,19 @@ extern ssize_t fl_socket_generic_recv(fl_socket_t *flsk, void *buf, size_t len,
                                       struct sockaddr_storage *src_addr,
                                       socklen_t *addrlen);
 
+/**
+ * @brief Perform a non-blocking receive on a socket
+ *
+ * A generic implementation of the non-blocking receive method
+ * (#fl_socket_nb_recv_method_t) that applications can use readily. It
+ * receives into the buffer supplied in fl_socket_generic_recv(). In persistent
+ * read mode (#FL_SOCKOPT_PERSISTENT_READ), it keeps receiving until the
+ * socket is drained or the application pauses it.
+ *
+ * @param[in] flsk Falco socket
+ */
+extern void fl_socket_generic_nb_recv(fl_socket_t *flsk);
+
 /**
  * @brief Send a message on a socket
  *
@@ -554,6 +1044,200 @@ extern ssize_t fl_socket_generic_send(fl_socket_t *flsk, void *buf, size_t len,
                                       const struct sockaddr_storage *dest_addr,
                                       socklen_t addrlen);
 
+/**
+ * @brief Perform a non-blocking transmit on a socket
+ *
+ * A generic implementation of the non-blocking send method
+ * (#fl_socket_nb_send_method_t) that applications can use readily. It
+ * transmits the buffer supplied in fl_socket_generic_send(), or the buffers
+ * in the transmit queue of the socket.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @see fl_socket_txq_append()
+ */
+extern void fl_socket_generic_nb_send(fl_socket_t *flsk);
+
+/**
+ * @brief Queue a buffer for transmission on a stream socket
+ *
+ * Unlike fl_socket_generic_send(), any number of buffers can be outstanding on
+ * a socket. Buffers are appended to the transmit queue of the socket, and
+ * fl_socket_generic_nb_send() transmits as many of the queued buffers as the
+ * kernel accepts with one @c sendmsg(2) call (up to #FL_SOCKET_TXQ_IOV_MAX
+ * buffers per call), carrying partially transmitted buffers over to the next
+ * call.
+ *
+ * The buffer is owned by falco until the @c txq_buf_complete_method of the
+ * socket is invoked for it. The @c send_complete_method is invoked each time
+ * the queue is drained, and the @c send_error_method on an irrecoverable
+ * error, in which case the queued buffers are left in the queue.
+ *
+ * The socket must be of type SOCK_STREAM and set to non-blocking mode, and no
+ * buffer must be outstanding from fl_socket_generic_send().
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] buf Send data buffer
+ * @param[in] len Length of the buffer @p buf
+ *
+ * @return On success, the number of bytes in the transmit queue is returned.
+ * On error, -1 is returned.
+ *
+ * @see fl_socket_set_txq_watermarks(), fl_socket_set_txq_buf_complete_method()
+ */
+extern ssize_t fl_socket_txq_append(fl_socket_t *flsk, void *buf, size_t len);
+
+/**
+ * @brief Receive batches of datagrams on a socket
+ *
+ * Registers @p nbufs buffers of @p buf_len bytes each for the socket, and sets
+ * the sockfd for read. Every time the sockfd is ready for read,
+ * fl_socket_generic_nb_recv() receives up to @p nbufs datagrams with one
+ * @c recvmmsg(2) call, and invokes @p recv_batch_method with the datagrams,
+ * their lengths and their source addresses. The buffers are reused for the
+ * next batch once the method returns. The sockfd stays set for read.
+ *
+ * The socket must be of type SOCK_DGRAM and set to non-blocking mode, with
+ * fl_socket_generic_nb_recv() as its non-blocking receive method. Errors are
+ * reported to the @c recv_error_method of the socket.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] bufs Array of @p nbufs buffers
+ * @param[in] buf_len Length of each buffer
+ * @param[in] nbufs Number of buffers, the maximum number of datagrams in a
+ *                  batch
+ * @param[in] recv_batch_method Method invoked with every batch of datagrams
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ *
+ * @see @c recvmmsg(2)
+ */
+extern int fl_socket_recv_batch(fl_socket_t *flsk, void **bufs, size_t buf_len,
+                                u_int32_t nbufs,
+                                fl_socket_dgram_batch_method_t recv_batch_method);
+
+/**
+ * @brief Pause receiving on a socket
+ *
+ * Flow control for the receive side. The sockfd is no longer watched for
+ * read, and the data that arrives stays in the kernel until
+ * fl_socket_resume_read() is called. The outstanding receive buffer (or
+ * batch) is kept. A receive that was found ready, but not yet dispatched, is
+ * not dispatched. The function can be called from the @c recv_complete_method
+ * (or the batch method) of the socket, which then stops draining.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_pause_read(fl_socket_t *flsk);
+
+/**
+ * @brief Resume receiving on a socket
+ *
+ * Undoes fl_socket_pause_read(). If a receive is outstanding, then, the sockfd
+ * is watched for read again.
+ *
+ * @param[in] flsk Falco socket
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_socket_resume_read(fl_socket_t *flsk);
+
+/**
+ * @brief Queue a datagram for batched transmission on a socket
+ *
+ * Datagrams are queued on the socket, and fl_socket_generic_nb_send()
+ * transmits up to #FL_SOCKET_DGRAM_BATCH_MAX queued datagrams with one
+ * @c sendmmsg(2) call when the sockfd becomes writable. The transmitted
+ * datagrams are handed back to the @c send_batch_complete_method of the
+ * socket, so that their buffers can be reused. A datagram that could not be
+ * transmitted is handed back with its error number set.
+ *
+ * The socket must be of type SOCK_DGRAM and set to non-blocking mode, with
+ * fl_socket_generic_nb_send() as its non-blocking send method.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] buf Datagram
+ * @param[in] len Length of the datagram
+ * @param[in] dest_addr Destination address of the datagram
+ * @param[in] addrlen Specifies the size of @p dest_addr
+ *
+ * @return On success, the number of queued datagrams is returned. On error,
+ * -1 is returned.
+ *
+ * @see @c sendmmsg(2), fl_socket_set_send_batch_complete_method()
+ */
+extern ssize_t fl_socket_send_batch(fl_socket_t *flsk, void *buf, size_t len,
+                                    const struct sockaddr_storage *dest_addr,
+                                    socklen_t addrlen);
+
+/**
+ * @brief Set method to notify the application that a batch of queued
+ * datagrams has been sent
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] send_batch_complete_method Pointer to a function
+ *
+ * @see fl_socket_send_batch()
+ */
+extern void fl_socket_set_send_batch_complete_method(fl_socket_t *flsk, fl_socket_dgram_batch_method_t send_batch_complete_method);
+
+/**
+ * @brief Offload the processing of data of the socket to a worker thread.
+ *
+ * Typically called from the recv complete method, with a copy of the data
+ * that was received. The work of a socket is run in the order in which it
+ * was offloaded, one at a time, and the done methods are invoked in the same
+ * order, on the loop of the socket. The done method finds the socket in the
+ * @c owner of the work, which is NULL if the socket was closed meanwhile.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] method Method run on a worker thread
+ * @param[in] done_method Method run on the loop once the work is done
+ * @param[in] app_data Data of the work
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ *
+ * @see fl_work_submit(), fl_work_cfg_workers()
+ */
+extern int fl_socket_offload(fl_socket_t *flsk, fl_work_method_t method,
+                             fl_work_done_method_t done_method,
+                             void *app_data);
+
+/**
+ * @brief Set the watermarks of the transmit queue of a socket
+ *
+ * @p high_method is invoked when the number of bytes in the transmit queue
+ * reaches @p high_wm, so that the application can stop producing data.
+ * @p low_method is invoked when the queue subsequently drains to @p low_wm or
+ * below.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] low_wm Low watermark (in bytes), must be less than @p high_wm
+ * @param[in] high_wm High watermark (in bytes). If 0, then, watermarks are
+ *                    disabled.
+ * @param[in] high_method Method invoked when the high watermark is reached
+ * @param[in] low_method Method invoked when the low watermark is reached
+ *
+ * @see fl_socket_txq_append()
+ */
+extern void fl_socket_set_txq_watermarks(fl_socket_t *flsk,
+                                         size_t low_wm, size_t high_wm,
+                                         fl_socket_txq_watermark_method_t high_method,
+                                         fl_socket_txq_watermark_method_t low_method);
+
+/**
+ * @brief Set method to notify the application that a queued buffer has been
+ * sent
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] txq_buf_complete_method Pointer to a function
+ *
+ * @see fl_socket_txq_append()
+ */
+extern void fl_socket_set_txq_buf_complete_method(fl_socket_t *flsk, fl_socket_txq_buf_complete_method_t txq_buf_complete_method);
+
 /**
  * @brief Set socket connection complete handler method
  *
@@ -565,6 +1249,37 @@ extern ssize_t fl_socket_generic_send(fl_socket_t *flsk, void *buf, size_t len,
  */
 extern void fl_socket_set_connect_complete_method(fl_socket_t *flsk, fl_socket_connect_complete_method_t connect_complete_method);
 
+/**
+ * @brief Set method to notify the application that an operation has been
+ * deferred
+ *
+ * Accepting connections and non-blocking transmission are not retried in a
+ * blocking fashion when they fail with a transient error (@c EMFILE,
+ * @c ENFILE, @c ENOBUFS, @c ENOMEM for accept, and @c ENETUNREACH,
+ * @c EHOSTUNREACH, @c ENOBUFS for transmit). Instead the socket is flagged
+ * with #FL_SOCKF_DEFERRED and the operation is parked. It is retried from a
+ * timer after a back-off delay, which starts at #FL_SOCKET_BACKOFF_MIN_MS and
+ * doubles with every failed retry up to #FL_SOCKET_BACKOFF_MAX_MS. The usual
+ * method (for example @c connect_complete_method or @c send_complete_method)
+ * is invoked once a retry succeeds.
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] deferred_method Method that is invoked with the error number
+ *            and the back-off delay every time an operation is deferred
+ */
+extern void fl_socket_set_deferred_method(fl_socket_t *flsk, fl_socket_deferred_method_t deferred_method);
+
+/**
+ * @brief Set socket connection error handler method
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] connect_error_method Method that is invoked by falco when a
+ *            non-blocking connection attempt on a socket fails or times out
+ *
+ * @see fl_socket_generic_nb_connect()
+ */
+extern void fl_socket_set_connect_error_method(fl_socket_t *flsk, fl_socket_connect_error_method_t connect_error_method);
+
 /**
  * @brief Set receive handler method
  *
@@ -616,6 +1331,57 @@ extern void fl_socket_set_recv_is_msg_complete_method(fl_socket_t *flsk, fl_sock
  */
 extern void fl_socket_set_recv_complete_method(fl_socket_t *flsk, fl_socket_recv_complete_method_t recv_complete_method);
 
+/**
+ * @brief Set connection accept handler method
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] accept_method Method that is invoked by falco when a connection
+ *                          is pending on a listening socket
+ *
+ * @see fl_socket_listen(), fl_socket_generic_accept()
+ */
+extern void fl_socket_set_accept_method(fl_socket_t *flsk,
+                                        fl_socket_accept_method_t accept_method);
+
+/**
+ * @brief Set method to notify the application of a receive error
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] recv_error_method Pointer to a function
+ *
+ * @see fl_socket_generic_nb_recv()
+ */
+extern void fl_socket_set_recv_error_method(fl_socket_t *flsk, fl_socket_recv_error_method_t recv_error_method);
+
+/**
+ * @brief Set send handler method
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] send_method Pointer to a function
+ */
+extern void fl_socket_set_send_method(fl_socket_t *flsk, fl_socket_send_method_t send_method);
+
+/**
+ * @brief Set non-blocking send handler method
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] nb_send_method Method that is invoked by falco when the socket
+ *                           becomes writable
+ *
+ * @see fl_socket_generic_nb_send()
+ */
+extern void fl_socket_set_nb_send_method(fl_socket_t *flsk, fl_socket_nb_send_method_t nb_send_method);
+
+/**
+ * @brief Set method to notify the application of a transmit error
+ *
+ * @param[in] flsk Falco socket
+ * @param[in] send_error_method Pointer to a function
+ *
+ * @see fl_socket_generic_nb_send()
+ */
+extern void fl_socket_set_send_error_method(fl_socket_t *flsk, fl_socket_send_error_method_t send_error_method);
+
 /**
  * @brief Set method to notify the application that a message has been sent
  *
@@ -651,7 +1417,9 @@ extern void fl_socket_process_reads(int *nfds, fd_set *fds);
  *
  * This function performs write operations on socket file descriptors which have
  * become ready for write. It calls the non-blocking send method that has
- * been previously registered for the socket.
+ * been previously registered for the socket. For sockets with a non-blocking
+ * connection in progress (#FL_SOCKF_CONNECTING), the connection is completed
+ * instead.
  *
  * @param[in,out] Number of FDs that are ready for I/O operations.
  *                It is decremented by the number of FDs on which write
@@ -45,12 +45,21 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/queue.h>
 
 #include "falco/fl_socket.h"
+#include "falco/fl_sched.h"
+#include "falco/fl_hist.h"
 
 /**
  * @brief Maximum length of a task name (including the trailing delimiter).
  */
 #define FL_TASK_NAME_MAX_LEN 32
 
+/**
+ * @brief Scheduling priority of the events of a task (or of sockets and
+ * timers without a task).
+ */
+#define FL_TASK_PRIORITY(_task_)                                        \
+  ((_task_) ? (_task_)->priority : FL_SCHED_PRIORITY_MEDIUM)
+
 /**
  * @brief Definition for methods that reinitialize a task.
  */
@@ -73,6 +82,7 @@ typedef struct fl_task_t_ {
   LIST_ENTRY(fl_task_t_) task_lc;
 
   char name[FL_TASK_NAME_MAX_LEN];
+  fl_sched_priority_e priority; ///< Scheduling priority, see fl_sched.h
 
   LIST_HEAD(, fl_timer_t_) task_timers;
   LIST_HEAD(, fl_socket_t_) task_sockets;
@@ -81,8 +91,28 @@ typedef struct fl_task_t_ {
   fl_task_terminate_method_t terminate_method;
   fl_task_dump_method_t dump_method;
 
+  /**
+   * @brief Time taken by the methods of the sockets and timers of the task.
+   * Allocated on first use when built with ENABLE_INSTRUMENTATION, see
+   * fl_hist.h.
+   */
+  fl_hist_t *hist;
 } fl_task_t;
 
+/**
+ * @brief Configure the number of tasks that are preallocated.
+ *
+ * @detail Tasks are allocated from a pool (see fl_pool.h). The pool is
+ * prewarmed with @p ntasks tasks when the module is initialized by fl_init(),
+ * or right away if the module has already been initialized. Creating and
+ * deleting upto @p ntasks tasks then does not allocate memory.
+ *
+ * @param[in] ntasks Number of tasks
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_task_cfg_prewarm(u_int32_t ntasks);
+
 /**
  * @brief Initialize task module.
  *
@@ -124,6 +154,36 @@ extern fl_task_t *fl_task_create(const char *name);
  */
 extern int fl_task_delete(fl_task_t *task);
 
+/**
+ * @brief Set the scheduling priority of a task.
+ *
+ * @detail Socket and timer events of the task are queued in the run queue of
+ * @p priority when the scheduler is enabled (see fl_sched.h). The default
+ * priority is #FL_SCHED_PRIORITY_MEDIUM. Events that are already queued keep
+ * their priority.
+ *
+ * @param[in] task Task
+ * @param[in] priority Enumerated value from #fl_sched_priority_e
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_task_set_priority(fl_task_t *task, fl_sched_priority_e priority);
+
+/**
+ * @brief Get a summary of the time taken by the methods of a task.
+ *
+ * @detail Covers the accept, receive and send methods of the sockets (see
+ * fl_socket_get_hist()) and the methods of the timers (see
+ * fl_timer_get_hist()) of the task. The histogram is empty unless the library
+ * is built with ENABLE_INSTRUMENTATION.
+ *
+ * @param[in] task Task
+ * @param[out] snap Summary of the histogram (see fl_hist_snapshot())
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_task_get_hist(const fl_task_t *task, fl_hist_snapshot_t *snap);
+
 /**
  * @brief Validate pointer to a task.
  *
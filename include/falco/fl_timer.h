@@ -38,10 +38,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * delete timers. Methods (or callback routines) can be associated with a timer.
  * They are invoked when the timer fires (i.e. upon timeout).
  *
- * This module uses the timerfd infrastructure in linux. Underneath the APIs,
- * @c timerfd_create() is to used to create a timer. @c timerfd_settime() is
- * used to arm or disarm the timer. When a timer is deleted, the file
- * descriptor associated with the timer is closed.
+ * Timers are kept in a hierarchical timing wheel (#FL_TIMER_WHEEL_LEVELS
+ * levels of #FL_TIMER_WHEEL_SLOTS slots each, with a resolution of
+ * #FL_TIMER_WHEEL_TICK_MS milliseconds). Creating, starting, stopping and
+ * deleting a timer are constant time operations. The whole wheel is driven by
+ * a single timerfd, created with @c timerfd_create(), that is armed for the
+ * next expiry with @c timerfd_settime(). When it fires, all timers that have
+ * expired are dispatched in one batch by fl_timers_dispatch().
  */
 
 #ifndef _FL_TIMER_H_
@@ -51,12 +54,49 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/timerfd.h>
 
 #include "falco/fl_task.h"
+#include "falco/fl_hist.h"
 
 /**
  * @brief Maximum length of a timer name (including the trailing delimiter).
  */
 #define FL_TIMER_NAME_MAX_LEN 32
 
+/**
+ * @brief Resolution of the timing wheel (in milliseconds).
+ */
+#define FL_TIMER_WHEEL_TICK_MS 1
+/**
+ * @brief Number of levels in the timing wheel.
+ */
+#define FL_TIMER_WHEEL_LEVELS 4
+/**
+ * @brief Number of bits used to index the slots of a level.
+ */
+#define FL_TIMER_WHEEL_SLOT_BITS 8
+/**
+ * @brief Number of slots in each level of the timing wheel.
+ */
+#define FL_TIMER_WHEEL_SLOTS (1 << FL_TIMER_WHEEL_SLOT_BITS)
+
+/* Flags for timer state */
+/**
+ * @brief Flag to indicate that the timer is started (armed).
+ */
+#define FL_TIMERF_ARMED    BITVAL(0x00000001)
+/**
+ * @brief Flag to indicate that the timer has expired and is pending dispatch.
+ */
+#define FL_TIMERF_EXPIRED  BITVAL(0x00000002)
+
+/**
+ * @brief Histograms of a timer, see fl_timer_get_hist().
+ */
+typedef enum fl_timer_hist_e_ {
+  FL_TIMER_HIST_DURATION, ///< Time taken by the timer method
+  FL_TIMER_HIST_LATENESS, ///< Time from the expiration to the dispatch of the timer
+  FL_TIMER_HIST_MAX
+} fl_timer_hist_e;
+
 /**
  * @brief Type definition of callback routines or methods which are called when
  * a timer fires.
@@ -75,10 +115,15 @@ typedef struct fl_timer_t_ {
    * @brief List connector for all timers associated with a task.
    */
   LIST_ENTRY(fl_timer_t_) task_timer_lc;
+  /**
+   * @brief List connector for the timing wheel slot (or the expired list) in
+   * which the timer is present.
+   */
+  TAILQ_ENTRY(fl_timer_t_) wheel_lc;
 
   /* Data provided by the application */
-  int fire_when; ///< Initial expiration of the timer (in seconds)
-  int fire_interval; ///< Interval for periodic timer (in seconds)
+  int fire_when; ///< Initial expiration of the timer (in whole seconds)
+  int fire_interval; ///< Interval for periodic timer (in whole seconds)
   /**
    * @brief Timer name specified by the application in #fl_timer_create().
    */
@@ -92,9 +137,18 @@ typedef struct fl_timer_t_ {
   void *app_data;
 
   /* Falco Timer module internal data */
-  int timerfd; ///< (Timer) File descriptor returned by @c timerfd_create()
-  struct itimerspec its; ///< Period interval
+  flag_t flags; ///< Timer state flags. See flags starting from #FL_TIMERF_ARMED
+  u_int64_t expires; ///< Expiration (in timing wheel ticks)
+  u_int8_t wheel_level; ///< Timing wheel level in which the timer is present
+  u_int8_t wheel_slot; ///< Timing wheel slot in which the timer is present
+  /**
+   * @brief Initial expiration (@c it_value) and period interval
+   * (@c it_interval) of the timer. A zero @c it_interval makes the timer a
+   * one-shot timer.
+   */
+  struct itimerspec its;
   fl_task_t *task; ///< Task with which this timer is associated
+  fl_sched_event_t sched_event; ///< Event in the run queue of the task priority, see fl_sched.h
 
   /* Stats */
   /**
@@ -102,8 +156,32 @@ typedef struct fl_timer_t_ {
    * timeout/expiration
    */
   u_int32_t ndispatches;
+  /**
+   * @brief Monotonic time (in nanoseconds) of the expiration being
+   * dispatched. Kept only when built with ENABLE_INSTRUMENTATION.
+   */
+  u_int64_t due_ns;
+  /**
+   * @brief Histograms of the timer, indexed by #fl_timer_hist_e. Allocated
+   * on first use when built with ENABLE_INSTRUMENTATION, see fl_hist.h.
+   */
+  fl_hist_t *hist[FL_TIMER_HIST_MAX];
 } fl_timer_t;
 
+/**
+ * @brief Configure the number of timers that are preallocated.
+ *
+ * @detail Timers are allocated from a pool (see fl_pool.h). The pool is
+ * prewarmed with @p ntimers timers when the module is initialized by fl_init(),
+ * or right away if the module has already been initialized. Creating and
+ * deleting upto @p ntimers timers then does not allocate memory.
+ *
+ * @param[in] ntimers Number of timers
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_timer_cfg_prewarm(u_int32_t ntimers);
+
 /**
  * @brief Initialize timer management module
  *
@@ -124,12 +202,14 @@ extern int fl_timer_module_dump(FILE *fd);
 /**
  * @brief Create a new falco timer
  *
- * This function creates a new falco timer object. @c timerfd_create() is used
- * to create the timer, and the returned file descriptor is stored in timerfd.
+ * This function creates a new falco timer object. The timer is not started
+ * (armed) until fl_timer_start() is called.
  *
  * @param[in] task (Optional) Task to which this timer needs to be associated
- * @param[in] fire_when One shot timer expiration value
- * @param[in] fire_interval Periodic interval value
+ * @param[in] fire_when Initial expiration value (in seconds), must be greater
+ *                      than 0
+ * @param[in] fire_interval Periodic interval value (in seconds). If 0, then,
+ *                          the timer is a one-shot timer.
  * @param[in] timer_method Method (or callback routine) invoked when the timer
  *                         fires (reaches expiration)
  * @param[in] timer_name String of length not exceeding #FL_TIMER_NAME_MAX_LEN
@@ -138,18 +218,66 @@ extern int fl_timer_module_dump(FILE *fd);
  *
  * @return On success, a pointer to a falco timer object is returned.
  * Otherwise, NULL is returned.
- *
- * @see @c timerfd_create(2)
  */
 extern void *fl_timer_create(fl_task_t *task, int fire_when, int fire_interval,
                              fl_app_timer_method_t timer_method,
                              const char *timer_name, void *app_data);
 
+/**
+ * @brief Create a new falco timer with millisecond resolution
+ *
+ * Same as fl_timer_create(), except that the initial expiration and the
+ * periodic interval are specified in milliseconds.
+ *
+ * @param[in] task (Optional) Task to which this timer needs to be associated
+ * @param[in] fire_when_ms Initial expiration value (in milliseconds), must be
+ *                         greater than 0
+ * @param[in] fire_interval_ms Periodic interval value (in milliseconds). If 0,
+ *                             then, the timer is a one-shot timer.
+ * @param[in] timer_method Method invoked when the timer fires
+ * @param[in] timer_name String of length not exceeding #FL_TIMER_NAME_MAX_LEN
+ * @param[in] app_data Application data (or context)
+ *
+ * @return On success, a pointer to a falco timer object is returned.
+ * Otherwise, NULL is returned.
+ */
+extern void *fl_timer_create_ms(fl_task_t *task, u_int32_t fire_when_ms,
+                                u_int32_t fire_interval_ms,
+                                fl_app_timer_method_t timer_method,
+                                const char *timer_name, void *app_data);
+
+/**
+ * @brief Create a new falco timer with nanosecond resolution
+ *
+ * Same as fl_timer_create(), except that the initial expiration
+ * (@c it_value) and the periodic interval (@c it_interval) are specified as
+ * in @c timerfd_settime(). A zero @c it_interval makes the timer a one-shot
+ * timer. Expirations are rounded up to the resolution of the timing wheel
+ * (#FL_TIMER_WHEEL_TICK_MS).
+ *
+ * @param[in] task (Optional) Task to which this timer needs to be associated
+ * @param[in] its Initial expiration (must not be zero) and periodic interval
+ * @param[in] timer_method Method invoked when the timer fires
+ * @param[in] timer_name String of length not exceeding #FL_TIMER_NAME_MAX_LEN
+ * @param[in] app_data Application data (or context)
+ *
+ * @return On success, a pointer to a falco timer object is returned.
+ * Otherwise, NULL is returned.
+ *
+ * @see @c timerfd_settime(2)
+ */
+extern void *fl_timer_create_its(fl_task_t *task, const struct itimerspec *its,
+                                 fl_app_timer_method_t timer_method,
+                                 const char *timer_name, void *app_data);
+
 /**
  * @brief Start or arm a timer
  *
- * This function starts (or arms) the timer with the periodic interval value
- * that was supplied by the application in #fl_timer_create().
+ * This function starts (or arms) the timer with the initial expiration and
+ * periodic interval values that were supplied by the application when the
+ * timer was created. The timer is inserted in the timing wheel. Starting a
+ * timer that is already started restarts it. A one-shot timer is disarmed
+ * once it has fired, and can be started again.
  *
  * @param[in] timer Pointer to the #fl_timer_t object
  * @param[in] app_data Application data (or context) that needs to be presented
@@ -159,26 +287,25 @@ extern void *fl_timer_create(fl_task_t *task, int fire_when, int fire_interval,
  *                     provided during #fl_timer_create()).
  *
  * @return On success, 0 is returned. On error, -1 is returned.
- *
- * @see @c timerfd_settime(2)
  */
 extern int fl_timer_start(fl_timer_t *timer, void *app_data);
 
 /**
  * @brief Stop or disarm a timer
  *
+ * Stopping a timer that is not armed, e.g. a one-shot timer that has
+ * already fired, does nothing.
+ *
  * @param[in] timer Pointer to the #fl_timer_t object
  *
  * @return On success, 0 is returned. On error, -1 is returned.
- *
- * @see @c timerfd_settime(2)
  */
 extern int fl_timer_stop(fl_timer_t *timer);
 
 /**
  * @brief Delete a timer
  *
- * The file descriptor (@c timerfd) associated with the timer is closed.
+ * The timer is stopped (if it was started) and freed.
  *
  * @param[in] timer Pointer to the #fl_timer_t object
  *
@@ -186,17 +313,36 @@ extern int fl_timer_stop(fl_timer_t *timer);
  */
 extern int fl_timer_delete(fl_timer_t *timer);
 
+/**
+ * @brief Get a summary of a histogram of a timer
+ *
+ * @detail The lateness of a timer is measured from the timing wheel tick at
+ * which it expired, so it covers the delays of the event loop (and of the
+ * scheduler, see fl_sched.h) but not the rounding of the expiration to the
+ * resolution of the wheel. Histograms are empty unless the library is built
+ * with ENABLE_INSTRUMENTATION.
+ *
+ * @param[in] timer Pointer to the #fl_timer_t object
+ * @param[in] which Enumerated value from #fl_timer_hist_e
+ * @param[out] snap Summary of the histogram (see fl_hist_snapshot())
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_timer_get_hist(const fl_timer_t *timer, fl_timer_hist_e which,
+                             fl_hist_snapshot_t *snap);
+
 /**
  * @brief Dispatch all timers which have expirations
  *
- * This function iterates through all the timers, checks if the timer has
- * expirations and invokes the corresponding application methods (with the
- * data or context presented by the application earlier).
+ * If the timing wheel timerfd is ready, this function advances the timing
+ * wheel to the current time, collects all timers that have expired, and
+ * invokes the corresponding application methods (with the data or context
+ * presented by the application earlier) in one batch.
  *
  * @param[in,out] nfds Number of file descriptors that need to be read. It is
- *                     decremented by the number of timers that were dispatched
- *                     in this dispatch run.
- * @param[in,out] rfds Set of file descriptors (associated with the timers).
+ *                     decremented by one if the timing wheel timerfd was
+ *                     processed in this dispatch run.
+ * @param[in,out] rfds Set of file descriptors ready for read.
  */
 extern void fl_timers_dispatch(int *nfds, fd_set *rfds);
 
@@ -0,0 +1,174 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/**
+ * @file
+ * @brief Work Offload
+ *
+ * CPU heavy processing, for example parsing or compressing a large message,
+ * can be offloaded from an event loop to a pool of worker threads, so that it
+ * does not hold up the other sockets of the loop. The work method runs on a
+ * worker thread, then its done method (the continuation) is posted back to
+ * the loop that submitted the work (see fl_loop_post()).
+ *
+ * Every worker has its own queue. Submitted work is spread across the queues,
+ * and a worker whose queue is empty steals work from the others.
+ *
+ * Work submitted on a strand is run one at a time, in the order in which it
+ * was submitted, and so are the done methods. Every socket has a strand, used
+ * by fl_socket_offload(), so that the work of a socket stays in order.
+ *
+ * Work methods run concurrently with the loops and with each other. They
+ * must only use the data handed to them, and not falco sockets, timers or
+ * tasks.
+ */
+
+#ifndef _FL_WORK_H_
+#define _FL_WORK_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include "falco/fl_loop.h"
+
+struct fl_work_t_;
+
+/**
+ * @brief Definition for the methods run on a worker thread.
+ */
+typedef void (*fl_work_method_t)(struct fl_work_t_ *);
+
+/**
+ * @brief Definition for the methods run on the loop once the work is done.
+ */
+typedef void (*fl_work_done_method_t)(struct fl_work_t_ *);
+
+/**
+ * @brief Representation of an offloaded piece of work.
+ */
+typedef struct fl_work_t_ {
+  TAILQ_ENTRY(fl_work_t_) work_lc;
+  fl_work_method_t method;
+  fl_work_done_method_t done_method;
+  void *app_data;
+  /**
+   * @brief Object on whose behalf the work was submitted, for example the
+   * socket of fl_socket_offload(). Set to NULL if the object is closed
+   * before the done method is invoked.
+   */
+  void *owner;
+  int cancelled;             ///< The work was not run, its owner was closed
+  struct fl_work_strand_t_ *strand;
+  fl_loop_t *loop;           ///< Loop that submitted the work
+} fl_work_t;
+
+/**
+ * @brief Sequence of work that is run in order, one at a time.
+ *
+ * Strands belong to the loop that created them.
+ */
+typedef struct fl_work_strand_t_ {
+  TAILQ_HEAD(fl_work_strand_queue_, fl_work_t_) queue; ///< Waiting work
+  fl_work_t *running;        ///< Work in the worker pool
+  int closed;
+} fl_work_strand_t;
+
+/**
+ * @brief Configure the number of worker threads.
+ *
+ * @detail Must be configured before fl_init(). No worker is started by
+ * default, in which case work can not be offloaded.
+ *
+ * @param[in] nworkers Number of worker threads
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_work_cfg_workers(u_int32_t nworkers);
+
+/**
+ * @brief Initialize the work module for the calling thread's event loop.
+ *
+ * @detail The worker threads are started by the first call.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_work_module_init(void);
+
+/**
+ * @brief Dump the status and state of the module.
+ *
+ * @param[in] fd Stream to which the status and state needs to be written
+ *
+ * @return On success, 0 is returned. On error, -1 is returned.
+ */
+extern int fl_work_module_dump(FILE *fd);
+
+/**
+ * @brief Create a strand.
+ *
+ * @return On success, the strand is returned. On error, NULL is returned.
+ */
+extern fl_work_strand_t *fl_work_strand_create(void);
+
+/**
+ * @brief Close a strand.
+ *
+ * @detail Waiting work is cancelled: its done method is invoked right away,
+ * with @c cancelled set. The done method of the work that is being run is
+ * invoked when it is done, with @c owner set to NULL. The strand is released
+ * after that.
+ *
+ * @param[in] strand Strand to be closed
+ */
+extern void fl_work_strand_close(fl_work_strand_t *strand);
+
+/**
+ * @brief Offload a piece of work to the worker threads.
+ *
+ * @param[in] strand Strand on which the work is run, or NULL if the work need
+ *                   not be ordered with respect to other work
+ * @param[in] owner Object on whose behalf the work is submitted
+ * @param[in] method Method run on a worker thread
+ * @param[in] done_method Method run on the calling thread's loop, once the
+ *                        work is done (or cancelled)
+ * @param[in] app_data Data of the work
+ *
+ * @return On success, the work is returned. It is valid until its done method
+ * returns. On error, NULL is returned.
+ */
+extern fl_work_t *fl_work_submit(fl_work_strand_t *strand, void *owner,
+                                 fl_work_method_t method,
+                                 fl_work_done_method_t done_method,
+                                 void *app_data);
+
+#endif /* _FL_WORK_H_ */
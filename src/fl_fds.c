@@ -30,13 +30,98 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *******************************************************************************/
 
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FL_FDS_HAVE_URING 1
+#endif
+#endif
+
+#include "falco/fl_defs.h"
 #include "falco/fl_stdlib.h"
 #include "falco/fl_tracevalue.h"
 #include "falco/fl_fds.h"
 
-fl_fd_set_t select_rbits;
-fl_fd_set_t select_wbits;
-fl_fd_set_t select_ebits;
+/* Per file descriptor operation bits */
+#define FL_FDF_READ      0x01
+#define FL_FDF_WRITE     0x02
+#define FL_FDF_EXCEPT    0x04
+#define FL_FDF_OPS       (FL_FDF_READ | FL_FDF_WRITE | FL_FDF_EXCEPT)
+/* The fd has an entry in the pollfd array */
+#define FL_FDF_POLL      0x20
+/* A poll request for the fd is armed in the io_uring */
+#define FL_FDF_URING     0x40
+/* The fd has been added to the epoll interest list */
+#define FL_FDF_EPOLL     0x80
+
+#define FL_FDS_EPOLL_MIN_EVENTS 64
+#define FL_FDS_POLL_MIN_FDS     64
+
+/* Submission queue entries of the io_uring. The completion queue is sized
+ * larger, as every armed poll request may complete in the same wait.
+ */
+#define FL_FDS_URING_SQ_ENTRIES 256
+#define FL_FDS_URING_CQ_ENTRIES 4096
+/* user_data of requests whose completions are not of interest */
+#define FL_FDS_URING_IGNORE     (~0ULL)
+
+/**
+ * @brief State that the module keeps for every file descriptor.
+ */
+typedef struct fl_fd_state_t_ {
+  u_int8_t flags; ///< Operations the fd is set for, see FL_FDF_READ
+  u_int8_t ready; ///< Operations the fd is ready for (epoll backend)
+  u_int8_t owner_type; ///< Type of the owner, from fl_fd_owner_e
+  u_int8_t armed; ///< Operations of the armed poll request (io_uring backend)
+  union {
+    u_int32_t gen; ///< Generation of the poll request (io_uring backend)
+    u_int32_t pindex; ///< Index of the entry in the pollfd array (poll backend)
+  };
+  void *owner; ///< Falco socket or timer that owns the fd
+} fl_fd_state_t;
+
+/**
+ * @brief io_uring instance of an event loop, set up with raw system calls.
+ */
+typedef struct fl_fds_uring_t_ {
+  int fd; ///< io_uring file descriptor
+  u_int32_t sq_entries; ///< Number of submission queue entries
+  u_int32_t cq_entries; ///< Number of completion queue entries
+  u_int32_t *sq_head;
+  u_int32_t *sq_tail;
+  u_int32_t *sq_mask;
+  u_int32_t *sq_flags;
+  u_int32_t *sq_array;
+  u_int32_t *cq_head;
+  u_int32_t *cq_tail;
+  u_int32_t *cq_mask;
+  void *sqes; ///< Submission queue entries (struct io_uring_sqe)
+  void *cqes; ///< Completion queue entries (struct io_uring_cqe)
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  u_int32_t nqueued; ///< Entries queued, but not yet submitted
+  u_int32_t narmed; ///< Poll requests armed
+  u_int64_t nenters; ///< io_uring_enter() calls
+  u_int64_t nsqes; ///< Entries submitted
+  u_int64_t ncqes; ///< Completions reaped
+} fl_fds_uring_t;
+
+static FL_LOOP_LOCAL fl_fd_set_t select_rbits;
+static FL_LOOP_LOCAL fl_fd_set_t select_wbits;
+static FL_LOOP_LOCAL fl_fd_set_t select_ebits;
 
 const values_t fl_fd_ops[] = {
   { FL_FD_OP_READ,   "Read"   },
@@ -46,7 +131,144 @@ const values_t fl_fd_ops[] = {
   { 0, NULL }
 };
 
-static int max_fd_number;
+static const values_t fl_fds_backends[] = {
+  { FL_FDS_BACKEND_SELECT, "select" },
+  { FL_FDS_BACKEND_EPOLL,  "epoll"  },
+  { FL_FDS_BACKEND_URING,  "io_uring" },
+  { FL_FDS_BACKEND_POLL,   "poll"   },
+  { 0, NULL }
+};
+
+static fl_fds_backend_e fds_backend = FL_FDS_BACKEND_SELECT;
+/* Backend in use by the event loop, which differs from the configured one
+ * when the kernel does not support io_uring.
+ */
+static FL_LOOP_LOCAL fl_fds_backend_e fds_loop_backend = FL_FDS_BACKEND_SELECT;
+
+/* The fds registry is per event loop. The maximum fd is the highest fd that
+ * is set for an operation, or that the application has declared with
+ * fl_fds_set_max_fd(), whichever is higher. It comes down as fds are cleared.
+ */
+static FL_LOOP_LOCAL int max_fd_number;
+static FL_LOOP_LOCAL int app_max_fd;
+static FL_LOOP_LOCAL int fds_initialized;
+
+static FL_LOOP_LOCAL fl_fd_state_t *fd_states;
+static FL_LOOP_LOCAL int fd_states_size;
+
+static FL_LOOP_LOCAL int *ready_fds;
+static FL_LOOP_LOCAL int ready_fds_size;
+static FL_LOOP_LOCAL int nready_fds;
+
+static FL_LOOP_LOCAL int epoll_fd = -1;
+static FL_LOOP_LOCAL struct epoll_event *epoll_events;
+static FL_LOOP_LOCAL int epoll_events_size;
+static FL_LOOP_LOCAL u_int32_t epoll_nregistered;
+
+static FL_LOOP_LOCAL fl_fds_uring_t uring = { .fd = -1 };
+
+/* Compact array of the fds that are set, for the poll backend */
+static FL_LOOP_LOCAL struct pollfd *pollfds;
+static FL_LOOP_LOCAL u_int32_t pollfds_size;
+static FL_LOOP_LOCAL u_int32_t npollfds;
+
+static u_int8_t fl_fd_op_flag(fl_fd_op_e op);
+static fl_fd_state_t *fl_fd_get_state(int fd);
+static void fl_fds_update(int fd, fl_fd_state_t *state);
+static int fl_fds_epoll_init(void);
+static void fl_fds_epoll_update(int fd, fl_fd_state_t *state);
+static int fl_fds_epoll_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                             struct timeval *timeout);
+static void fl_fds_poll_update(int fd, fl_fd_state_t *state);
+static int fl_fds_poll_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                            struct timeval *timeout);
+static int fl_fds_uring_init(void);
+static void fl_fds_uring_update(int fd, fl_fd_state_t *state);
+static int fl_fds_uring_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                             struct timeval *timeout);
+static int fl_fds_mark_ready(int fd, fl_fd_state_t *state, u_int32_t events,
+                             fd_set *rfds, fd_set *wfds, fd_set *efds);
+static void fl_fds_ready_reset(void);
+static void fl_fds_max_fd_compact(void);
+static int fl_fds_timeout_ms(const struct timeval *timeout);
+static int fl_fds_ready_reserve(int n);
+static void fl_fds_select_collect(fd_set *rfds, fd_set *wfds, fd_set *efds);
+
+int fl_fds_cfg_backend(fl_fds_backend_e backend)
+{
+  if ((backend != FL_FDS_BACKEND_SELECT) && (backend != FL_FDS_BACKEND_EPOLL) &&
+      (backend != FL_FDS_BACKEND_URING) && (backend != FL_FDS_BACKEND_POLL)) {
+    FL_LOGR_ERR("Invalid FDs backend (%d) configuration", backend);
+    return -1;
+  }
+
+  if (fds_initialized) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("FDs backend cannot be changed after initialization");
+    return -1;
+  }
+
+  fds_backend = backend;
+  return 0;
+}
+
+fl_fds_backend_e fl_fds_get_backend(void)
+{
+  return (fds_initialized) ? fds_loop_backend : fds_backend;
+}
+
+int fl_fds_module_init(void)
+{
+  if (fds_initialized) {
+    return 0;
+  }
+
+  fds_loop_backend = fds_backend;
+  if (fds_loop_backend == FL_FDS_BACKEND_URING) {
+    if (fl_fds_uring_init() < 0) {
+      FL_LOGR_WARNING("io_uring is not supported, falling back to epoll");
+      fds_loop_backend = FL_FDS_BACKEND_EPOLL;
+    }
+  }
+
+  if ((fds_loop_backend == FL_FDS_BACKEND_EPOLL) && (fl_fds_epoll_init() < 0)) {
+    return -1;
+  }
+
+  fds_initialized = 1;
+  FL_LOGR_INFO("Falco FDs module initialized (%s backend)",
+               fl_trace_value(fl_fds_backends, fds_loop_backend));
+  return 0;
+}
+
+int fl_fds_module_dump(FILE *fd)
+{
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "File Descriptors\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "    Backend: %s\n",
+          fl_trace_value(fl_fds_backends, fl_fds_get_backend()));
+  fprintf(fd, "    Read: %u, Write: %u, Except: %u fds set, max fd %d\n",
+          select_rbits.nfds, select_wbits.nfds, select_ebits.nfds,
+          max_fd_number);
+  if (fds_loop_backend == FL_FDS_BACKEND_EPOLL) {
+    fprintf(fd, "    epoll fd %d, %u fds registered, %d events per wait\n",
+            epoll_fd, epoll_nregistered, epoll_events_size);
+  } else if (fds_loop_backend == FL_FDS_BACKEND_POLL) {
+    fprintf(fd, "    %u fds polled, %u pollfd entries\n", npollfds,
+            pollfds_size);
+  } else if (fds_loop_backend == FL_FDS_BACKEND_URING) {
+    fprintf(fd, "    io_uring fd %d, %u SQ / %u CQ entries, %u polls armed\n",
+            uring.fd, uring.sq_entries, uring.cq_entries, uring.narmed);
+    fprintf(fd, "    %llu enters, %llu SQEs submitted, %llu CQEs reaped\n",
+            (unsigned long long) uring.nenters,
+            (unsigned long long) uring.nsqes,
+            (unsigned long long) uring.ncqes);
+  }
+
+  return 0;
+}
 
 fl_fd_set_t *fl_fds_get_set(fl_fd_op_e op)
 {
@@ -69,6 +291,9 @@ int fl_fds_get_max_fd(void)
 
 void fl_fds_set_max_fd(int fd)
 {
+  if (fd > app_max_fd) {
+    app_max_fd = fd;
+  }
   if (fd > max_fd_number) {
     max_fd_number = fd;
   }
@@ -82,6 +307,964 @@ int fl_fds_anyfds_set(fl_fd_op_e op)
 
 int fl_fd_isset(int fd, fl_fd_op_e op)
 {
-  register fl_fd_set_t *fdset = fl_fds_get_set(op);
-  return FD_ISSET(fd, &fdset->fd_bits);
+  if ((fd < 0) || (fd >= fd_states_size)) {
+    return 0;
+  }
+
+  return ((fd_states[fd].flags & fl_fd_op_flag(op)) != 0);
+}
+
+void fl_fds_set(int fd, fl_fd_op_e op)
+{
+  fl_fd_set_t *fdset = fl_fds_get_set(op);
+  fl_fd_state_t *state;
+  u_int8_t opf = fl_fd_op_flag(op);
+
+  if ((fds_loop_backend == FL_FDS_BACKEND_SELECT) && (fd >= FD_SETSIZE)) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("FD (%d) exceeds FD_SETSIZE (%d) for the select backend",
+                fd, FD_SETSIZE);
+    return;
+  }
+
+  state = fl_fd_get_state(fd);
+  if (!state) {
+    return;
+  }
+
+  if (state->flags & opf) {
+    FL_ASSERT(0);
+    FL_LOGR_NOTICE("FD (%d) is already set", fd);
+    return;
+  }
+
+  state->flags |= opf;
+  if (fd < FD_SETSIZE) {
+    FD_SET(fd, &fdset->fd_bits);
+  }
+  fdset->nfds++;
+  if (fd > max_fd_number) {
+    max_fd_number = fd;
+  }
+  fl_fds_update(fd, state);
+}
+
+void fl_fds_clr(int fd, fl_fd_op_e op)
+{
+  fl_fd_set_t *fdset = fl_fds_get_set(op);
+  fl_fd_state_t *state;
+  u_int8_t opf = fl_fd_op_flag(op);
+
+  FL_ASSERT(fdset->nfds);
+  if ((fd < 0) || (fd >= fd_states_size) ||
+      !(fd_states[fd].flags & opf)) {
+    FL_ASSERT(0);
+    FL_LOGR_NOTICE("FD (%d) is not set", fd);
+    return;
+  }
+
+  state = &fd_states[fd];
+  state->flags &= ~opf;
+  state->ready &= ~opf;
+  if (fd < FD_SETSIZE) {
+    FD_CLR(fd, &fdset->fd_bits);
+  }
+  fdset->nfds--;
+  fl_fds_update(fd, state);
+  if ((fd == max_fd_number) && !(state->flags & FL_FDF_OPS)) {
+    fl_fds_max_fd_compact();
+  }
+}
+
+void fl_fds_zero(fl_fd_op_e op)
+{
+  fl_fd_set_t *fdset = fl_fds_get_set(op);
+  u_int8_t opf = fl_fd_op_flag(op);
+  register int fd;
+
+  FL_ASSERT(fdset);
+  for (fd = 0; fd < fd_states_size; fd++) {
+    register fl_fd_state_t *state = &fd_states[fd];
+
+    if (!(state->flags & opf)) {
+      continue;
+    }
+
+    state->flags &= ~opf;
+    state->ready &= ~opf;
+    fl_fds_update(fd, state);
+  }
+
+  FD_ZERO(&fdset->fd_bits);
+  fdset->nfds = 0;
+  fl_fds_max_fd_compact();
+}
+
+int fl_fds_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                struct timeval *timeout)
+{
+  int nfds;
+
+  switch (fds_loop_backend) {
+  case FL_FDS_BACKEND_EPOLL:
+    return fl_fds_epoll_wait(rfds, wfds, efds, timeout);
+  case FL_FDS_BACKEND_URING:
+    return fl_fds_uring_wait(rfds, wfds, efds, timeout);
+  case FL_FDS_BACKEND_POLL:
+    return fl_fds_poll_wait(rfds, wfds, efds, timeout);
+  default:
+    break;
+  }
+
+  if (rfds) {
+    memcpy(rfds, &select_rbits.fd_bits, sizeof(fd_set));
+  }
+  if (wfds) {
+    memcpy(wfds, &select_wbits.fd_bits, sizeof(fd_set));
+  }
+  if (efds) {
+    memcpy(efds, &select_ebits.fd_bits, sizeof(fd_set));
+  }
+
+  nready_fds = 0;
+  nfds = select(max_fd_number + 1, rfds, wfds, efds, timeout);
+  if (nfds > 0) {
+    fl_fds_select_collect(rfds, wfds, efds);
+  }
+  return nfds;
+}
+
+int fl_fd_isready(int fd, fl_fd_op_e op, fd_set *fds)
+{
+  if (fds_loop_backend == FL_FDS_BACKEND_SELECT) {
+    return (fds && (fd >= 0) && (fd < FD_SETSIZE) && FD_ISSET(fd, fds));
+  }
+
+  if ((fd < 0) || (fd >= fd_states_size)) {
+    return 0;
+  }
+
+  return ((fd_states[fd].ready & fl_fd_op_flag(op)) != 0);
+}
+
+void fl_fd_clrready(int fd, fl_fd_op_e op, fd_set *fds)
+{
+  if (fds && (fd >= 0) && (fd < FD_SETSIZE)) {
+    FD_CLR(fd, fds);
+  }
+
+  if ((fd >= 0) && (fd < fd_states_size)) {
+    fd_states[fd].ready &= ~fl_fd_op_flag(op);
+  }
+}
+
+void fl_fds_set_owner(int fd, fl_fd_owner_e type, void *owner)
+{
+  fl_fd_state_t *state;
+
+  if ((type == FL_FD_OWNER_NONE) && (fd >= fd_states_size)) {
+    return;
+  }
+
+  state = fl_fd_get_state(fd);
+  if (!state) {
+    return;
+  }
+
+  if ((type != FL_FD_OWNER_NONE) && (state->owner_type != FL_FD_OWNER_NONE)) {
+    FL_LOGR_NOTICE("FD (%d) owner (type %d) replaced by owner (type %d)",
+                   fd, state->owner_type, type);
+  }
+
+  state->owner_type = type;
+  state->owner = (type == FL_FD_OWNER_NONE) ? NULL : owner;
+}
+
+void *fl_fds_get_owner(int fd, fl_fd_owner_e type)
+{
+  register fl_fd_state_t *state;
+
+  if ((fd < 0) || (fd >= fd_states_size)) {
+    return NULL;
+  }
+
+  state = &fd_states[fd];
+  return (state->owner_type == type) ? state->owner : NULL;
+}
+
+int fl_fds_get_ready(const int **fds)
+{
+  FL_ASSERT(fds);
+  *fds = ready_fds;
+  return nready_fds;
+}
+
+static u_int8_t fl_fd_op_flag(fl_fd_op_e op)
+{
+  switch (op) {
+  case FL_FD_OP_READ:   return FL_FDF_READ;
+  case FL_FD_OP_WRITE:  return FL_FDF_WRITE;
+  case FL_FD_OP_ACCEPT: return FL_FDF_READ;
+  default:
+  case FL_FD_OP_EXCEPT: return FL_FDF_EXCEPT;
+  }
+}
+
+static fl_fd_state_t *fl_fd_get_state(int fd)
+{
+  FL_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (fd >= fd_states_size) {
+    int nsize = (fd_states_size) ? fd_states_size : FD_SETSIZE;
+
+    while (nsize <= fd) {
+      nsize *= 2;
+    }
+    FL_REALLOC(fl_fd_state_t, nsize, fd_states, "FD states");
+    if (!fd_states) {
+      fd_states_size = 0;
+      return NULL;
+    }
+    memset(&fd_states[fd_states_size], 0,
+           (nsize - fd_states_size) * sizeof(fl_fd_state_t));
+    fd_states_size = nsize;
+  }
+
+  return &fd_states[fd];
+}
+
+static int fl_fds_ready_reserve(int n)
+{
+  if (n > ready_fds_size) {
+    int nsize = (ready_fds_size) ? ready_fds_size : FL_FDS_EPOLL_MIN_EVENTS;
+
+    while (nsize < n) {
+      nsize *= 2;
+    }
+    FL_REALLOC(int, nsize, ready_fds, "FDs ready list");
+    if (!ready_fds) {
+      ready_fds_size = nready_fds = 0;
+      return -1;
+    }
+    ready_fds_size = nsize;
+  }
+
+  return 0;
+}
+
+/* Build the ready list from the fd sets returned by select(). The sets are
+ * scanned a word at a time, so that the cost is bounded by the number of
+ * words up to the maximum fd, plus the number of ready fds.
+ */
+static void fl_fds_select_collect(fd_set *rfds, fd_set *wfds, fd_set *efds)
+{
+  register int w, nwords = (max_fd_number / NFDBITS) + 1;
+
+  if (fl_fds_ready_reserve(max_fd_number + 1) < 0) {
+    return;
+  }
+
+  for (w = 0; w < nwords; w++) {
+    register unsigned long bits = 0;
+
+    if (rfds) {
+      bits |= (unsigned long) ((const fd_mask *) (const void *) rfds)[w];
+    }
+    if (wfds) {
+      bits |= (unsigned long) ((const fd_mask *) (const void *) wfds)[w];
+    }
+    if (efds) {
+      bits |= (unsigned long) ((const fd_mask *) (const void *) efds)[w];
+    }
+
+    while (bits) {
+      register int b = __builtin_ctzl(bits);
+
+      ready_fds[nready_fds++] = (w * NFDBITS) + b;
+      bits &= bits - 1;
+    }
+  }
+}
+
+static void fl_fds_update(int fd, fl_fd_state_t *state)
+{
+  if (fds_loop_backend == FL_FDS_BACKEND_EPOLL) {
+    fl_fds_epoll_update(fd, state);
+  } else if (fds_loop_backend == FL_FDS_BACKEND_URING) {
+    fl_fds_uring_update(fd, state);
+  } else if (fds_loop_backend == FL_FDS_BACKEND_POLL) {
+    fl_fds_poll_update(fd, state);
+  }
+}
+
+/* Record the readiness of an fd from the events returned by the kernel. The
+ * poll(2) event bits, used by the poll and io_uring backends, have the same
+ * values as the epoll ones.
+ */
+static int fl_fds_mark_ready(int fd, fl_fd_state_t *state, u_int32_t events,
+                             fd_set *rfds, fd_set *wfds, fd_set *efds)
+{
+  int nfds = 0;
+
+  ready_fds[nready_fds++] = fd;
+
+  if ((state->flags & FL_FDF_READ) &&
+      (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+    state->ready |= FL_FDF_READ;
+    nfds++;
+    if (rfds && (fd < FD_SETSIZE)) {
+      FD_SET(fd, rfds);
+    }
+  }
+  if ((state->flags & FL_FDF_WRITE) &&
+      (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+    state->ready |= FL_FDF_WRITE;
+    nfds++;
+    if (wfds && (fd < FD_SETSIZE)) {
+      FD_SET(fd, wfds);
+    }
+  }
+  if ((state->flags & FL_FDF_EXCEPT) && (events & EPOLLPRI)) {
+    state->ready |= FL_FDF_EXCEPT;
+    nfds++;
+    if (efds && (fd < FD_SETSIZE)) {
+      FD_SET(fd, efds);
+    }
+  }
+
+  return nfds;
+}
+
+/* Readiness recorded in the previous wait is no longer valid. Poll requests
+ * of the io_uring backend are one-shot, so those that completed in the
+ * previous wait are armed again if the fd is still set for an operation.
+ */
+static void fl_fds_ready_reset(void)
+{
+  register int i;
+
+  for (i = 0; i < nready_fds; i++) {
+    register int fd = ready_fds[i];
+    register fl_fd_state_t *state;
+
+    if (fd >= fd_states_size) {
+      continue;
+    }
+    state = &fd_states[fd];
+    state->ready = 0;
+    if ((fds_loop_backend == FL_FDS_BACKEND_URING) &&
+        !(state->flags & FL_FDF_URING)) {
+      fl_fds_uring_update(fd, state);
+    }
+  }
+  nready_fds = 0;
+}
+
+/* Bring the maximum fd down to the highest fd that is still set. The cost is
+ * amortized over the fds that were set above the new maximum.
+ */
+static void fl_fds_max_fd_compact(void)
+{
+  register int fd = max_fd_number;
+
+  if (fd >= fd_states_size) {
+    fd = fd_states_size - 1;
+  }
+  while ((fd > app_max_fd) && (fd > 0) &&
+         !(fd_states[fd].flags & FL_FDF_OPS)) {
+    fd--;
+  }
+  max_fd_number = (fd > app_max_fd) ? fd : app_max_fd;
+}
+
+static int fl_fds_timeout_ms(const struct timeval *timeout)
+{
+  if (!timeout) {
+    return -1;
+  }
+
+  return (int) ((timeout->tv_sec * 1000) + ((timeout->tv_usec + 999) / 1000));
+}
+
+/* The pollfd array holds one entry per fd that is set, in no particular
+ * order. A cleared fd is removed by moving the last entry into its slot, so
+ * that the wait scans only the fds that are set.
+ */
+static void fl_fds_poll_update(int fd, fl_fd_state_t *state)
+{
+  u_int8_t ops = state->flags & FL_FDF_OPS;
+  struct pollfd *pfd;
+
+  if (!ops) {
+    u_int32_t last;
+
+    if (!(state->flags & FL_FDF_POLL)) {
+      return;
+    }
+
+    FL_ASSERT((state->pindex < npollfds) && (pollfds[state->pindex].fd == fd));
+    last = --npollfds;
+    if (state->pindex != last) {
+      pollfds[state->pindex] = pollfds[last];
+      fd_states[pollfds[last].fd].pindex = state->pindex;
+    }
+    state->flags &= ~FL_FDF_POLL;
+    return;
+  }
+
+  if (!(state->flags & FL_FDF_POLL)) {
+    if (npollfds == pollfds_size) {
+      u_int32_t nsize = (pollfds_size) ? (pollfds_size * 2) : FL_FDS_POLL_MIN_FDS;
+
+      FL_REALLOC(struct pollfd, nsize, pollfds, "FDs pollfd array");
+      if (!pollfds) {
+        pollfds_size = npollfds = 0;
+        return;
+      }
+      pollfds_size = nsize;
+    }
+
+    state->pindex = npollfds++;
+    state->flags |= FL_FDF_POLL;
+    pollfds[state->pindex].fd = fd;
+  }
+
+  pfd = &pollfds[state->pindex];
+  pfd->events = 0;
+  pfd->revents = 0;
+  if (ops & FL_FDF_READ) {
+    pfd->events |= POLLIN;
+  }
+  if (ops & FL_FDF_WRITE) {
+    pfd->events |= POLLOUT;
+  }
+  if (ops & FL_FDF_EXCEPT) {
+    pfd->events |= POLLPRI;
+  }
+}
+
+static int fl_fds_poll_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                            struct timeval *timeout)
+{
+  register u_int32_t i;
+  int nevents, nfds;
+
+  FL_ASSERT(fds_initialized);
+
+  fl_fds_ready_reset();
+
+  if (rfds) {
+    FD_ZERO(rfds);
+  }
+  if (wfds) {
+    FD_ZERO(wfds);
+  }
+  if (efds) {
+    FD_ZERO(efds);
+  }
+
+  if (fl_fds_ready_reserve(npollfds) < 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  nevents = poll(pollfds, npollfds, fl_fds_timeout_ms(timeout));
+  if (nevents <= 0) {
+    return nevents;
+  }
+
+  nfds = 0;
+  for (i = 0; (i < npollfds) && nevents; i++) {
+    register struct pollfd *pfd = &pollfds[i];
+    register u_int32_t events = (u_int32_t) pfd->revents;
+
+    if (!events) {
+      continue;
+    }
+    nevents--;
+
+    /* A closed fd is reported as an error, so that its owner handles it. */
+    if (events & POLLNVAL) {
+      events |= POLLERR;
+    }
+    nfds += fl_fds_mark_ready(pfd->fd, &fd_states[pfd->fd], events,
+                              rfds, wfds, efds);
+  }
+
+  return nfds;
+}
+
+static int fl_fds_epoll_init(void)
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    int save_errno = errno;
+    FL_LOGR_ERR("epoll instance creation failed, error %d <%s>",
+                save_errno, strerror(save_errno));
+    return -1;
+  }
+
+  FL_ALLOC(struct epoll_event, FL_FDS_EPOLL_MIN_EVENTS, epoll_events,
+           "FDs epoll events");
+  if (!epoll_events) {
+    (void) close(epoll_fd);
+    epoll_fd = -1;
+    return -1;
+  }
+  epoll_events_size = FL_FDS_EPOLL_MIN_EVENTS;
+  return 0;
+}
+
+static int fl_fds_epoll_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                             struct timeval *timeout)
+{
+  register int i, nfds;
+  int nevents, timeout_ms;
+
+  FL_ASSERT(fds_initialized && (epoll_fd >= 0));
+
+  fl_fds_ready_reset();
+
+  if (rfds) {
+    FD_ZERO(rfds);
+  }
+  if (wfds) {
+    FD_ZERO(wfds);
+  }
+  if (efds) {
+    FD_ZERO(efds);
+  }
+
+  if (epoll_nregistered > (u_int32_t) epoll_events_size) {
+    int nsize = epoll_events_size;
+
+    while ((u_int32_t) nsize < epoll_nregistered) {
+      nsize *= 2;
+    }
+    FL_REALLOC(struct epoll_event, nsize, epoll_events, "FDs epoll events");
+    if (!epoll_events) {
+      epoll_events_size = 0;
+      errno = ENOMEM;
+      return -1;
+    }
+    epoll_events_size = nsize;
+  }
+  if (fl_fds_ready_reserve(epoll_events_size) < 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  timeout_ms = fl_fds_timeout_ms(timeout);
+  nevents = epoll_wait(epoll_fd, epoll_events, epoll_events_size, timeout_ms);
+  if (nevents < 0) {
+    return -1;
+  }
+
+  nfds = 0;
+  for (i = 0; i < nevents; i++) {
+    register int fd = epoll_events[i].data.fd;
+
+    if (fd >= fd_states_size) {
+      continue;
+    }
+    nfds += fl_fds_mark_ready(fd, &fd_states[fd], epoll_events[i].events,
+                              rfds, wfds, efds);
+  }
+
+  return nfds;
+}
+
+static void fl_fds_epoll_update(int fd, fl_fd_state_t *state)
+{
+  struct epoll_event ev;
+  int op, rc;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = fd;
+  if (state->flags & FL_FDF_READ) {
+    ev.events |= EPOLLIN;
+  }
+  if (state->flags & FL_FDF_WRITE) {
+    ev.events |= EPOLLOUT;
+  }
+  if (state->flags & FL_FDF_EXCEPT) {
+    ev.events |= EPOLLPRI;
+  }
+
+  FL_ASSERT(fds_initialized && (epoll_fd >= 0));
+
+  if (!(state->flags & FL_FDF_OPS)) {
+    if (!(state->flags & FL_FDF_EPOLL)) {
+      return;
+    }
+    op = EPOLL_CTL_DEL;
+  } else {
+    op = (state->flags & FL_FDF_EPOLL) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  }
+
+  rc = epoll_ctl(epoll_fd, op, fd, &ev);
+  if ((rc < 0) && (op == EPOLL_CTL_MOD) && (errno == ENOENT)) {
+    /* The fd was closed (and possibly reused) while it was registered. */
+    op = EPOLL_CTL_ADD;
+    rc = epoll_ctl(epoll_fd, op, fd, &ev);
+  } else if ((rc < 0) && (op == EPOLL_CTL_ADD) && (errno == EEXIST)) {
+    op = EPOLL_CTL_MOD;
+    rc = epoll_ctl(epoll_fd, op, fd, &ev);
+  }
+
+  if (op == EPOLL_CTL_DEL) {
+    state->flags &= ~FL_FDF_EPOLL;
+    epoll_nregistered--;
+    /* A closed fd is removed from the interest list by the kernel. */
+    if ((rc < 0) && ((errno == ENOENT) || (errno == EBADF))) {
+      rc = 0;
+    }
+  } else if (!(state->flags & FL_FDF_EPOLL) && !rc) {
+    state->flags |= FL_FDF_EPOLL;
+    epoll_nregistered++;
+  }
+
+  if (rc < 0) {
+    int save_errno = errno;
+    FL_LOGR_ERR("epoll_ctl(%d) on FD (%d) failed, error %d <%s>",
+                op, fd, save_errno, strerror(save_errno));
+  }
+}
+
+#ifdef FL_FDS_HAVE_URING
+
+static int fl_fds_uring_enter(u_int32_t to_submit, u_int32_t min_complete,
+                              u_int32_t flags, struct timespec *ts)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec kts;
+  int rc;
+
+  memset(&arg, 0, sizeof(arg));
+  if (ts) {
+    kts.tv_sec = ts->tv_sec;
+    kts.tv_nsec = ts->tv_nsec;
+    arg.ts = (u_int64_t) (uintptr_t) &kts;
+  }
+
+  rc = (int) syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete,
+                     flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  uring.nenters++;
+  if (rc > 0) {
+    uring.nqueued -= ((u_int32_t) rc < uring.nqueued) ?
+      (u_int32_t) rc : uring.nqueued;
+    uring.nsqes += rc;
+  }
+
+  return rc;
+}
+
+/* Queue a request in the submission queue. Requests are submitted together,
+ * by the io_uring_enter() of the next wait, unless the queue is full.
+ */
+static int fl_fds_uring_queue(u_int8_t opcode, int fd, u_int32_t events,
+                              u_int64_t addr, u_int64_t user_data)
+{
+  struct io_uring_sqe *sqe;
+  u_int32_t head, tail, index;
+
+  tail = *uring.sq_tail;
+  head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+  if ((tail - head) >= uring.sq_entries) {
+    if (fl_fds_uring_enter(uring.nqueued, 0, 0, NULL) < 0) {
+      int save_errno = errno;
+      FL_LOGR_ERR("io_uring submission failed, error %d <%s>",
+                  save_errno, strerror(save_errno));
+      return -1;
+    }
+    head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+    if ((tail - head) >= uring.sq_entries) {
+      FL_LOGR_ERR("io_uring submission queue is full");
+      return -1;
+    }
+  }
+
+  index = tail & *uring.sq_mask;
+  sqe = &((struct io_uring_sqe *) uring.sqes)[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->addr = addr;
+  sqe->user_data = user_data;
+  uring.sq_array[index] = index;
+
+  __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  uring.nqueued++;
+  return 0;
 }
+
+static int fl_fds_uring_init(void)
+{
+  struct io_uring_params params;
+  int save_errno;
+
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = FL_FDS_URING_CQ_ENTRIES;
+  uring.fd = (int) syscall(__NR_io_uring_setup, FL_FDS_URING_SQ_ENTRIES,
+                           &params);
+  if (uring.fd < 0) {
+    save_errno = errno;
+    FL_LOGR_NOTICE("io_uring setup failed, error %d <%s>",
+                   save_errno, strerror(save_errno));
+    return -1;
+  }
+
+  /* Waits with a timeout, and completions that are not dropped when the
+   * completion queue overflows, are required.
+   */
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    FL_LOGR_NOTICE("io_uring features 0x%x are not sufficient",
+                   params.features);
+    (void) close(uring.fd);
+    uring.fd = -1;
+    return -1;
+  }
+
+  uring.sq_ring_size = params.sq_off.array +
+    (params.sq_entries * sizeof(u_int32_t));
+  uring.cq_ring_size = params.cq_off.cqes +
+    (params.cq_entries * sizeof(struct io_uring_cqe));
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (uring.cq_ring_size > uring.sq_ring_size) {
+      uring.sq_ring_size = uring.cq_ring_size;
+    }
+    uring.cq_ring_size = 0;
+  }
+
+  uring.sq_ring = mmap(NULL, uring.sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+  if (uring.sq_ring == MAP_FAILED) {
+    goto map_failed;
+  }
+
+  if (uring.cq_ring_size) {
+    uring.cq_ring = mmap(NULL, uring.cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring.fd,
+                         IORING_OFF_CQ_RING);
+    if (uring.cq_ring == MAP_FAILED) {
+      (void) munmap(uring.sq_ring, uring.sq_ring_size);
+      goto map_failed;
+    }
+  } else {
+    uring.cq_ring = uring.sq_ring;
+  }
+
+  uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+  if (uring.sqes == MAP_FAILED) {
+    if (uring.cq_ring_size) {
+      (void) munmap(uring.cq_ring, uring.cq_ring_size);
+    }
+    (void) munmap(uring.sq_ring, uring.sq_ring_size);
+    goto map_failed;
+  }
+
+  uring.sq_head = (u_int32_t *) ((char *) uring.sq_ring + params.sq_off.head);
+  uring.sq_tail = (u_int32_t *) ((char *) uring.sq_ring + params.sq_off.tail);
+  uring.sq_mask = (u_int32_t *) ((char *) uring.sq_ring +
+                                 params.sq_off.ring_mask);
+  uring.sq_flags = (u_int32_t *) ((char *) uring.sq_ring + params.sq_off.flags);
+  uring.sq_array = (u_int32_t *) ((char *) uring.sq_ring + params.sq_off.array);
+  uring.cq_head = (u_int32_t *) ((char *) uring.cq_ring + params.cq_off.head);
+  uring.cq_tail = (u_int32_t *) ((char *) uring.cq_ring + params.cq_off.tail);
+  uring.cq_mask = (u_int32_t *) ((char *) uring.cq_ring +
+                                 params.cq_off.ring_mask);
+  uring.cqes = (char *) uring.cq_ring + params.cq_off.cqes;
+  uring.sq_entries = params.sq_entries;
+  uring.cq_entries = params.cq_entries;
+  return 0;
+
+ map_failed:
+  save_errno = errno;
+  FL_LOGR_ERR("io_uring ring mapping failed, error %d <%s>",
+              save_errno, strerror(save_errno));
+  (void) close(uring.fd);
+  uring.fd = -1;
+  return -1;
+}
+
+/* Poll requests are one-shot, which keeps the level-triggered semantics of
+ * the other backends. A request is armed when the fd is set for an
+ * operation that it does not cover, and removed only when the fd is no longer
+ * set for any operation. Removal is required then, as an armed request holds
+ * a reference to the file, which would otherwise not be released on close.
+ */
+static void fl_fds_uring_update(int fd, fl_fd_state_t *state)
+{
+  u_int8_t ops = state->flags & FL_FDF_OPS;
+  u_int32_t events = 0;
+
+  FL_ASSERT(fds_initialized && (uring.fd >= 0));
+
+  if (state->flags & FL_FDF_URING) {
+    if (ops && !(ops & ~state->armed)) {
+      return;
+    }
+
+    (void) fl_fds_uring_queue(IORING_OP_POLL_REMOVE, -1, 0,
+                              ((u_int64_t) state->gen << 32) | (u_int32_t) fd,
+                              FL_FDS_URING_IGNORE);
+    state->flags &= ~FL_FDF_URING;
+    state->gen++;
+    uring.narmed--;
+  }
+
+  if (!ops) {
+    return;
+  }
+
+  if (ops & FL_FDF_READ) {
+    events |= POLLIN;
+  }
+  if (ops & FL_FDF_WRITE) {
+    events |= POLLOUT;
+  }
+  if (ops & FL_FDF_EXCEPT) {
+    events |= POLLPRI;
+  }
+
+  if (fl_fds_uring_queue(IORING_OP_POLL_ADD, fd, events, 0,
+                         ((u_int64_t) state->gen << 32) | (u_int32_t) fd) < 0) {
+    return;
+  }
+  state->flags |= FL_FDF_URING;
+  state->armed = ops;
+  uring.narmed++;
+}
+
+static int fl_fds_uring_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                             struct timeval *timeout)
+{
+  struct timespec ts;
+  u_int32_t head, tail, min_complete, flags;
+  int rc, nfds;
+
+  FL_ASSERT(fds_initialized && (uring.fd >= 0));
+
+  fl_fds_ready_reset();
+
+  if (rfds) {
+    FD_ZERO(rfds);
+  }
+  if (wfds) {
+    FD_ZERO(wfds);
+  }
+  if (efds) {
+    FD_ZERO(efds);
+  }
+
+  /* Every armed request completes at most once, so that an fd is recorded
+   * once in the ready list.
+   */
+  if (fl_fds_ready_reserve(uring.narmed) < 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* The queued interest changes are submitted, and completions are waited
+   * for, with a single system call. A zero timeout still enters the kernel,
+   * so that pending completions are posted.
+   */
+  flags = IORING_ENTER_GETEVENTS;
+  min_complete = 1;
+  if (timeout) {
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_usec * 1000;
+    if (!timeout->tv_sec && !timeout->tv_usec) {
+      min_complete = 0;
+    }
+  }
+
+ enter:
+  rc = fl_fds_uring_enter(uring.nqueued, min_complete, flags,
+                          (timeout) ? &ts : NULL);
+  if ((rc < 0) && (errno != ETIME) && (errno != EBUSY)) {
+    return -1;
+  }
+
+  nfds = 0;
+  head = *uring.cq_head;
+  tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe =
+      &((struct io_uring_cqe *) uring.cqes)[head & *uring.cq_mask];
+    register fl_fd_state_t *state;
+    u_int32_t events;
+    int fd;
+
+    uring.ncqes++;
+    if (cqe->user_data == FL_FDS_URING_IGNORE) {
+      continue;
+    }
+
+    fd = (int) (cqe->user_data & 0xffffffffU);
+    if (fd >= fd_states_size) {
+      continue;
+    }
+    state = &fd_states[fd];
+    if (!(state->flags & FL_FDF_URING) ||
+        (state->gen != (u_int32_t) (cqe->user_data >> 32))) {
+      /* Completion of a request that was removed */
+      continue;
+    }
+
+    state->flags &= ~FL_FDF_URING;
+    uring.narmed--;
+    /* A failed request is reported as an error on the fd, which the
+     * operation then surfaces to the application.
+     */
+    events = (cqe->res < 0) ? POLLERR : (u_int32_t) cqe->res;
+    nfds += fl_fds_mark_ready(fd, state, events, rfds, wfds, efds);
+  }
+  __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+
+  /* Completions of removed requests are not events, an unbounded wait
+   * only returns once an fd is ready.
+   */
+  if (!nfds && !timeout) {
+    goto enter;
+  }
+
+  return nfds;
+}
+
+#else /* !FL_FDS_HAVE_URING */
+
+static int fl_fds_uring_init(void)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+static void fl_fds_uring_update(int fd, fl_fd_state_t *state)
+{
+  (void) fd;
+  (void) state;
+  FL_ASSERT(0);
+}
+
+static int fl_fds_uring_wait(fd_set *rfds, fd_set *wfds, fd_set *efds,
+                             struct timeval *timeout)
+{
+  (void) rfds;
+  (void) wfds;
+  (void) efds;
+  (void) timeout;
+  FL_ASSERT(0);
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif /* FL_FDS_HAVE_URING */
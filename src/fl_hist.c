@@ -0,0 +1,228 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_hist.h"
+
+#define FL_HIST_SUB_MASK    (FL_HIST_SUB_BUCKETS - 1)
+#define FL_HIST_MAX_UNITS   ((((u_int64_t) 1) << FL_HIST_VALUE_BITS) - 1)
+
+/* Values below FL_HIST_SUB_BUCKETS units have a bucket each. Above, the most
+ * significant bit selects the power of two, and the next FL_HIST_SUB_BITS bits
+ * the linear bucket in it.
+ */
+static u_int32_t fl_hist_index(u_int64_t ns)
+{
+  register u_int64_t units = ns >> FL_HIST_UNIT_SHIFT;
+  register int msb;
+
+  if (units < FL_HIST_SUB_BUCKETS) {
+    return units;
+  }
+  if (units > FL_HIST_MAX_UNITS) {
+    units = FL_HIST_MAX_UNITS;
+  }
+
+  msb = 63 - __builtin_clzll(units);
+  return ((msb - FL_HIST_SUB_BITS + 1) << FL_HIST_SUB_BITS) +
+    ((units >> (msb - FL_HIST_SUB_BITS)) & FL_HIST_SUB_MASK);
+}
+
+/* Smallest value (in units) of a bucket */
+static u_int64_t fl_hist_bucket_low(u_int32_t index)
+{
+  register u_int32_t shift;
+
+  if (index < FL_HIST_SUB_BUCKETS) {
+    return index;
+  }
+
+  shift = (index >> FL_HIST_SUB_BITS) - 1;
+  return ((u_int64_t) (FL_HIST_SUB_BUCKETS + (index & FL_HIST_SUB_MASK))) <<
+    shift;
+}
+
+/* Largest value (in nanoseconds) of a bucket */
+static u_int64_t fl_hist_bucket_high_ns(u_int32_t index)
+{
+  return (fl_hist_bucket_low(index + 1) << FL_HIST_UNIT_SHIFT) - 1;
+}
+
+u_int64_t fl_hist_now_ns(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+fl_hist_t *fl_hist_create(void)
+{
+  fl_hist_t *hist;
+
+  FL_ALLOC(fl_hist_t, 1, hist, "Histogram");
+  if (!hist) {
+    return NULL;
+  }
+  hist->min_ns = UINT64_MAX;
+
+  return hist;
+}
+
+void fl_hist_delete(fl_hist_t *hist)
+{
+  FL_ASSERT(hist);
+  FL_FREE(hist, "Histogram");
+}
+
+void fl_hist_reset(fl_hist_t *hist)
+{
+  FL_ASSERT(hist);
+  memset(hist, 0, sizeof(*hist));
+  hist->min_ns = UINT64_MAX;
+}
+
+void fl_hist_record(fl_hist_t *hist, u_int64_t ns)
+{
+  hist->buckets[fl_hist_index(ns)]++;
+  hist->count++;
+  hist->sum_ns += ns;
+  if (ns < hist->min_ns) {
+    hist->min_ns = ns;
+  }
+  if (ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+}
+
+void fl_hist_record_lazy(fl_hist_t **hist, u_int64_t ns)
+{
+  if (!(*hist) && !((*hist) = fl_hist_create())) {
+    return;
+  }
+
+  fl_hist_record(*hist, ns);
+}
+
+void fl_hist_merge(fl_hist_t *dst, const fl_hist_t *src)
+{
+  register u_int32_t i;
+
+  FL_ASSERT(dst && src);
+  if (!src->count) {
+    return;
+  }
+
+  for (i = 0; i < FL_HIST_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+  dst->count += src->count;
+  dst->sum_ns += src->sum_ns;
+  if (src->min_ns < dst->min_ns) {
+    dst->min_ns = src->min_ns;
+  }
+  if (src->max_ns > dst->max_ns) {
+    dst->max_ns = src->max_ns;
+  }
+}
+
+u_int64_t fl_hist_percentile(const fl_hist_t *hist, double percentile)
+{
+  register u_int64_t rank, high, seen = 0;
+  register u_int32_t i;
+
+  FL_ASSERT(hist && (percentile >= 0) && (percentile <= 100));
+  if (!hist->count) {
+    return 0;
+  }
+
+  rank = (u_int64_t) ((percentile / 100) * hist->count + 0.5);
+  if (!rank) {
+    rank = 1;
+  } else if (rank > hist->count) {
+    rank = hist->count;
+  }
+
+  for (i = 0; i < FL_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  if (i >= (FL_HIST_BUCKETS - 1)) {
+    /* Values beyond FL_HIST_MAX_NS are only known by the largest one. */
+    return hist->max_ns;
+  }
+
+  /* The bucket bound overstates values of the last bucket in use. */
+  high = fl_hist_bucket_high_ns(i);
+  return (high < hist->max_ns) ? high : hist->max_ns;
+}
+
+void fl_hist_snapshot(const fl_hist_t *hist, fl_hist_snapshot_t *snap)
+{
+  FL_ASSERT(snap);
+  memset(snap, 0, sizeof(*snap));
+  if (!hist || !hist->count) {
+    return;
+  }
+
+  snap->count = hist->count;
+  snap->min_ns = hist->min_ns;
+  snap->mean_ns = hist->sum_ns / hist->count;
+  snap->p50_ns = fl_hist_percentile(hist, 50);
+  snap->p90_ns = fl_hist_percentile(hist, 90);
+  snap->p99_ns = fl_hist_percentile(hist, 99);
+  snap->p999_ns = fl_hist_percentile(hist, 99.9);
+  snap->max_ns = hist->max_ns;
+}
+
+void fl_hist_dump(FILE *fd, const char *label, const fl_hist_t *hist)
+{
+  fl_hist_snapshot_t snap;
+
+  if (!hist || !hist->count) {
+    return;
+  }
+
+  fl_hist_snapshot(hist, &snap);
+  fprintf(fd, "%s%llu samples, min %.2f us, mean %.2f us, p50 %.2f us, "
+          "p90 %.2f us, p99 %.2f us, p99.9 %.2f us, max %.2f us\n", label,
+          (unsigned long long) snap.count, snap.min_ns / 1000.0,
+          snap.mean_ns / 1000.0, snap.p50_ns / 1000.0, snap.p90_ns / 1000.0,
+          snap.p99_ns / 1000.0, snap.p999_ns / 1000.0, snap.max_ns / 1000.0);
+}
@@ -0,0 +1,208 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_pool.h"
+#include "falco/fl_job.h"
+
+/**
+ * @brief Queue of pending jobs and its counters.
+ */
+typedef struct fl_jobs_t_ {
+  TAILQ_HEAD(fl_jobs_queue_, fl_job_t_) queue;
+  u_int32_t npending;
+  u_int32_t max_pending;
+  u_int64_t nposted;
+  u_int64_t nrun;
+  u_int64_t ncancelled;
+  u_int64_t nturns;          ///< Dispatch runs that ran at least one job
+  u_int64_t nexhausted;      ///< Dispatch runs that ran out of budget
+} fl_jobs_t;
+
+static FL_LOOP_LOCAL fl_jobs_t fl_jobs;
+static FL_LOOP_LOCAL fl_pool_t *fl_job_pool;
+static u_int32_t fl_job_pool_nprewarm;
+static u_int32_t fl_job_budget = FL_JOB_DEFAULT_BUDGET;
+
+int fl_job_cfg_budget(u_int32_t budget)
+{
+  fl_job_budget = (budget) ? budget : FL_JOB_DEFAULT_BUDGET;
+  return 0;
+}
+
+int fl_job_cfg_prewarm(u_int32_t njobs)
+{
+  fl_job_pool_nprewarm = njobs;
+  if (fl_job_pool) {
+    return fl_pool_prewarm(fl_job_pool, njobs);
+  }
+
+  return 0;
+}
+
+int fl_job_module_init(void)
+{
+  if (!fl_job_pool) {
+    TAILQ_INIT(&fl_jobs.queue);
+
+    fl_job_pool = fl_pool_create("Job", sizeof(fl_job_t), 0, 0);
+    if (!fl_job_pool ||
+        (fl_pool_prewarm(fl_job_pool, fl_job_pool_nprewarm) < 0)) {
+      FL_LOGR_ERR("Job pool creation failed");
+      return -1;
+    }
+  }
+
+  FL_LOGR_INFO("Falco Job module initialized");
+  return 0;
+}
+
+int fl_job_module_dump(FILE *fd)
+{
+  fl_jobs_t *jobs = &fl_jobs;
+  register fl_job_t *li;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Jobs\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "Budget: %u jobs per turn\n", fl_job_budget);
+  fprintf(fd, "Pending: %u, max pending %u\n", jobs->npending,
+          jobs->max_pending);
+  fprintf(fd, "Posted %llu, run %llu, cancelled %llu\n",
+          (unsigned long long) jobs->nposted,
+          (unsigned long long) jobs->nrun,
+          (unsigned long long) jobs->ncancelled);
+  fprintf(fd, "Turns %llu, out of budget %llu\n",
+          (unsigned long long) jobs->nturns,
+          (unsigned long long) jobs->nexhausted);
+
+  TAILQ_FOREACH(li, &jobs->queue, job_lc) {
+    fprintf(fd, "    %s\n", li->name);
+  }
+
+  return 0;
+}
+
+fl_job_t *fl_job_post(const char *name, fl_job_method_t method,
+                      void *app_data)
+{
+  fl_jobs_t *jobs = &fl_jobs;
+  fl_job_t *job;
+
+  FL_ASSERT(name && method);
+
+  if (!fl_job_pool) {
+    FL_LOGR_ERR("Job %s posted before the Job module is initialized", name);
+    return NULL;
+  }
+
+  FL_POOL_ALLOC(fl_job_t, fl_job_pool, job, "Job");
+  if (!job) {
+    return NULL;
+  }
+
+  job->name = name;
+  job->method = method;
+  job->app_data = app_data;
+  job->seq = jobs->nposted++;
+  TAILQ_INSERT_TAIL(&jobs->queue, job, job_lc);
+
+  if (++jobs->npending > jobs->max_pending) {
+    jobs->max_pending = jobs->npending;
+  }
+
+  return job;
+}
+
+int fl_job_cancel(fl_job_t *job)
+{
+  fl_jobs_t *jobs = &fl_jobs;
+
+  if (!job) {
+    FL_ASSERT(0);
+    return -1;
+  }
+
+  TAILQ_REMOVE(&jobs->queue, job, job_lc);
+  jobs->npending--;
+  jobs->ncancelled++;
+  FL_POOL_FREE(fl_job_pool, job, "Job");
+
+  return 0;
+}
+
+u_int32_t fl_jobs_pending(void)
+{
+  return fl_jobs.npending;
+}
+
+u_int32_t fl_jobs_dispatch(void)
+{
+  fl_jobs_t *jobs = &fl_jobs;
+  fl_job_method_t method;
+  const char *name;
+  void *app_data;
+  fl_job_t *job;
+  u_int64_t nposted = jobs->nposted;
+  u_int32_t nrun = 0;
+
+  /* Jobs posted by the jobs of this run wait for the next turn. The turn is
+   * bounded by the number of jobs posted so far, not by a job, which may be
+   * cancelled (and its memory reused) by the jobs of this run.
+   */
+  while ((nrun < fl_job_budget) && (job = TAILQ_FIRST(&jobs->queue)) &&
+         (job->seq < nposted)) {
+    TAILQ_REMOVE(&jobs->queue, job, job_lc);
+    jobs->npending--;
+
+    /* The job is released first, so that its method can post jobs */
+    name = job->name;
+    method = job->method;
+    app_data = job->app_data;
+    FL_POOL_FREE(fl_job_pool, job, "Job");
+
+    method(name, app_data);
+    nrun++;
+  }
+
+  if (nrun) {
+    jobs->nrun += nrun;
+    jobs->nturns++;
+    if (jobs->npending && (nrun == fl_job_budget)) {
+      jobs->nexhausted++;
+    }
+  }
+
+  return nrun;
+}
@@ -30,11 +30,110 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *******************************************************************************/
 
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "falco/fl_stdlib.h"
 #include "falco/fl_logr.h"
 #include "falco/fl_tracevalue.h"
 
+/**
+ * @brief A message queued for the logging thread.
+ *
+ * @detail @c seq implements a bounded multi-producer queue: a record at
+ * position p may be filled when @c seq is p, and may be drained when @c seq
+ * is p + 1. Draining a record sets @c seq to p + nrecords.
+ */
+typedef struct fl_logr_rec_t_ {
+  atomic_uint seq;
+  int priority;
+  struct timespec ts;
+  const char *format;        ///< Format, if @c msg holds its raw arguments
+  char msg[FL_LOGR_ASYNC_MSG_MAX_LEN];
+} fl_logr_rec_t;
+
+#define FL_LOGR_FMT_MAX_ARGS 16
+#define FL_LOGR_FMT_CACHE_SIZE 1024
+#define FL_LOGR_FMT_CACHE_PROBES 8
+
+/**
+ * @brief Types in which the arguments of a deferred message are recorded.
+ */
+typedef enum fl_logr_arg_e_ {
+  FL_LOGR_ARG_NONE,          ///< Conversion without an argument (%%)
+  FL_LOGR_ARG_INT,
+  FL_LOGR_ARG_LONG,
+  FL_LOGR_ARG_LLONG,
+  FL_LOGR_ARG_INTMAX,
+  FL_LOGR_ARG_SIZE,
+  FL_LOGR_ARG_PTRDIFF,
+  FL_LOGR_ARG_DOUBLE,
+  FL_LOGR_ARG_LDOUBLE,
+  FL_LOGR_ARG_PTR,
+  FL_LOGR_ARG_STR,           ///< Copied into the record, null terminated
+  FL_LOGR_ARG_INVALID,       ///< Conversion that can not be deferred
+} fl_logr_arg_e;
+
+/**
+ * @brief Argument types of a format string, cached by the address of the
+ * format string.
+ */
+typedef struct fl_logr_fmt_t_ {
+  _Atomic(const char *) format;
+  atomic_int ready;
+  int nargs;                 ///< -1, if the format can not be deferred
+  u_int16_t size;            ///< Size of the arguments, excluding strings
+  u_int8_t args[FL_LOGR_FMT_MAX_ARGS];
+} fl_logr_fmt_t;
+
+typedef struct fl_logr_async_t_ {
+  /* Configuration */
+  u_int32_t nrecords;
+  fl_logr_overflow_e overflow;
+  FILE *fp;
+
+  /* Queue */
+  fl_logr_rec_t *recs;
+  atomic_uint tail;          ///< Next position to be filled by producers
+  atomic_uint head;          ///< Next position to be drained (logging thread)
+
+  /* Logging thread */
+  pthread_t thread;
+  sem_t wakeup;
+  atomic_int sleeping;
+  atomic_int stop;
+  int running;
+
+  /* Deferred formatting */
+  int binary;
+  fl_logr_fmt_t *fmts;
+  atomic_uint nfmts;
+
+  /* Counters */
+  atomic_ullong ndropped;
+  atomic_ullong nblocked;
+  unsigned long long nwritten;
+} fl_logr_async_t;
+
 int cfg_log_priority = LOG_INFO;
 
+static int fl_logr_async_enabled;
+static fl_logr_async_t fl_logr_async;
+
+static const values_t fl_logr_overflows[] = {
+  { FL_LOGR_OVERFLOW_DROP,  "Drop newest" },
+  { FL_LOGR_OVERFLOW_BLOCK, "Block"       },
+  { 0, NULL }
+};
+
 static const values_t syslog_priorities[] = {
   { LOG_EMERG,   "Emergency" },
   { LOG_ALERT,   "Alert"     },
@@ -47,16 +146,686 @@ static const values_t syslog_priorities[] = {
   { 0, NULL }
 };
 
+static void fl_logr_write(int priority, const struct timespec *ts,
+                          const char *msg)
+{
+  FILE *fp = fl_logr_async.fp;
+  struct tm tm;
+  char tbuf[32];
+
+  if (!fp) {
+    syslog(priority & ~FL_LOGR_STDERR, "%s", msg);
+  } else {
+    (void) localtime_r(&ts->tv_sec, &tm);
+    (void) strftime(tbuf, sizeof(tbuf), "%b %e %H:%M:%S", &tm);
+    (void) fprintf(fp, "%s.%03ld <%s> %s\n", tbuf, ts->tv_nsec / 1000000,
+                   fl_trace_value(syslog_priorities,
+                                  priority & LOG_PRIMASK), msg);
+  }
+
+  if (priority & FL_LOGR_STDERR) {
+    (void) fputs(msg, stderr);
+  }
+}
+
+/**
+ * @brief Parse a conversion specification.
+ *
+ * @param[in] p Conversion specification, following the '%'
+ * @param[out] nstars Number of '*' (width/precision) int arguments
+ * @param[out] type Type of the converted argument
+ *
+ * @return Pointer to the character following the conversion specifier
+ */
+static const char *fl_logr_fmt_spec(const char *p, int *nstars,
+                                    fl_logr_arg_e *type)
+{
+  int lmod = 0, prec = 0;
+
+  *nstars = 0;
+  *type = FL_LOGR_ARG_INVALID;
+
+  while (*p && strchr("-+ #0'I", *p)) {
+    p++;
+  }
+  if (*p == '*') {
+    (*nstars)++;
+    p++;
+  } else {
+    while ((*p >= '0') && (*p <= '9')) {
+      p++;
+    }
+    if (*p == '$') {
+      /* Positional arguments */
+      return p;
+    }
+  }
+  if (*p == '.') {
+    prec = 1;
+    if (*++p == '*') {
+      (*nstars)++;
+      p++;
+    } else {
+      while ((*p >= '0') && (*p <= '9')) {
+        p++;
+      }
+    }
+  }
+
+  switch (*p) {
+  case 'h':
+    p += (p[1] == 'h') ? 2 : 1;
+    break;
+  case 'l':
+    lmod = (p[1] == 'l') ? 'q' : 'l';
+    p += (p[1] == 'l') ? 2 : 1;
+    break;
+  case 'q':
+  case 'L':
+  case 'j':
+  case 'z':
+  case 'Z':
+  case 't':
+    lmod = *p++;
+    break;
+  }
+
+  switch (*p) {
+  case '%':
+    *type = FL_LOGR_ARG_NONE;
+    break;
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    switch (lmod) {
+    case 'l':
+      *type = FL_LOGR_ARG_LONG;
+      break;
+    case 'q':
+    case 'L':
+      *type = FL_LOGR_ARG_LLONG;
+      break;
+    case 'j':
+      *type = FL_LOGR_ARG_INTMAX;
+      break;
+    case 'z':
+    case 'Z':
+      *type = FL_LOGR_ARG_SIZE;
+      break;
+    case 't':
+      *type = FL_LOGR_ARG_PTRDIFF;
+      break;
+    default:
+      *type = FL_LOGR_ARG_INT;
+      break;
+    }
+    break;
+  case 'c':
+    *type = (lmod == 'l') ? FL_LOGR_ARG_INVALID : FL_LOGR_ARG_INT;
+    break;
+  case 'e':
+  case 'E':
+  case 'f':
+  case 'F':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    *type = (lmod == 'L') ? FL_LOGR_ARG_LDOUBLE : FL_LOGR_ARG_DOUBLE;
+    break;
+  case 'p':
+    *type = FL_LOGR_ARG_PTR;
+    break;
+  case 's':
+    /* With a precision, the string need not be null terminated */
+    *type = (lmod || prec) ? FL_LOGR_ARG_INVALID : FL_LOGR_ARG_STR;
+    break;
+  default:
+    /* %m depends on errno, %n writes to its argument, and wide characters */
+    return p;
+  }
+
+  return p + 1;
+}
+
+static const u_int8_t fl_logr_arg_sizes[] = {
+  [FL_LOGR_ARG_NONE]    = 0,
+  [FL_LOGR_ARG_INT]     = sizeof(int),
+  [FL_LOGR_ARG_LONG]    = sizeof(long),
+  [FL_LOGR_ARG_LLONG]   = sizeof(long long),
+  [FL_LOGR_ARG_INTMAX]  = sizeof(intmax_t),
+  [FL_LOGR_ARG_SIZE]    = sizeof(size_t),
+  [FL_LOGR_ARG_PTRDIFF] = sizeof(ptrdiff_t),
+  [FL_LOGR_ARG_DOUBLE]  = sizeof(double),
+  [FL_LOGR_ARG_LDOUBLE] = sizeof(long double),
+  [FL_LOGR_ARG_PTR]     = sizeof(void *),
+  [FL_LOGR_ARG_STR]     = 1,
+};
+
+static void fl_logr_fmt_parse(const char *format, fl_logr_fmt_t *fmt)
+{
+  const char *p = format;
+  fl_logr_arg_e type;
+  size_t size = 0;
+  int nstars;
+
+  fmt->nargs = 0;
+  while ((p = strchr(p, '%'))) {
+    p = fl_logr_fmt_spec(p + 1, &nstars, &type);
+    if ((type == FL_LOGR_ARG_INVALID) ||
+        ((fmt->nargs + nstars + 1) > FL_LOGR_FMT_MAX_ARGS)) {
+      fmt->nargs = -1;
+      return;
+    }
+    while (nstars--) {
+      fmt->args[fmt->nargs++] = FL_LOGR_ARG_INT;
+      size += sizeof(int);
+    }
+    if (type != FL_LOGR_ARG_NONE) {
+      fmt->args[fmt->nargs++] = type;
+      size += fl_logr_arg_sizes[type];
+    }
+  }
+
+  if (size > FL_LOGR_ASYNC_MSG_MAX_LEN) {
+    fmt->nargs = -1;
+  }
+  fmt->size = size;
+}
+
+/**
+ * @brief Look up the argument types of a format string.
+ *
+ * @detail Format strings are cached by their address, so a format string is
+ * parsed once. If the cache is full, the format string is parsed into @p tmp.
+ */
+static const fl_logr_fmt_t *fl_logr_fmt_lookup(const char *format,
+                                               fl_logr_fmt_t *tmp)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  fl_logr_fmt_t *fmt;
+  const char *key;
+  u_int32_t h, i;
+
+  h = (u_int32_t) (((uintptr_t) format >> 3) * 2654435761U);
+  for (i = 0; i < FL_LOGR_FMT_CACHE_PROBES; i++) {
+    fmt = &la->fmts[(h + i) & (FL_LOGR_FMT_CACHE_SIZE - 1)];
+    key = atomic_load_explicit(&fmt->format, memory_order_acquire);
+    if (!key) {
+      if (atomic_compare_exchange_strong(&fmt->format, &key, format)) {
+        fl_logr_fmt_parse(format, fmt);
+        atomic_store_explicit(&fmt->ready, 1, memory_order_release);
+        atomic_fetch_add_explicit(&la->nfmts, 1, memory_order_relaxed);
+        return fmt;
+      }
+    }
+    if (key == format) {
+      if (atomic_load_explicit(&fmt->ready, memory_order_acquire)) {
+        return fmt;
+      }
+      break;
+    }
+  }
+
+  fl_logr_fmt_parse(format, tmp);
+  return tmp;
+}
+
+#define FL_LOGR_ARG_PUT(_type_, _buf_, _len_, _args_)   \
+  do {                                                  \
+    _type_ _v = va_arg(_args_, _type_);                 \
+    memcpy((_buf_) + (_len_), &_v, sizeof(_v));         \
+    (_len_) += sizeof(_v);                              \
+  } while (0)
+
+/**
+ * @brief Record the arguments of a message.
+ *
+ * @return On success, 0 is returned. If the format can not be deferred, -1 is
+ * returned and @p args is not consumed.
+ */
+static int fl_logr_fmt_encode(const char *format, char *buf, va_list args)
+{
+  const fl_logr_fmt_t *fmt;
+  fl_logr_fmt_t tmp;
+  const char *str;
+  size_t len = 0, slen, sroom;
+  int i;
+
+  fmt = fl_logr_fmt_lookup(format, &tmp);
+  if (fmt->nargs < 0) {
+    return -1;
+  }
+  sroom = FL_LOGR_ASYNC_MSG_MAX_LEN - fmt->size;
+
+  for (i = 0; i < fmt->nargs; i++) {
+    switch (fmt->args[i]) {
+    case FL_LOGR_ARG_INT:
+      FL_LOGR_ARG_PUT(int, buf, len, args);
+      break;
+    case FL_LOGR_ARG_LONG:
+      FL_LOGR_ARG_PUT(long, buf, len, args);
+      break;
+    case FL_LOGR_ARG_LLONG:
+      FL_LOGR_ARG_PUT(long long, buf, len, args);
+      break;
+    case FL_LOGR_ARG_INTMAX:
+      FL_LOGR_ARG_PUT(intmax_t, buf, len, args);
+      break;
+    case FL_LOGR_ARG_SIZE:
+      FL_LOGR_ARG_PUT(size_t, buf, len, args);
+      break;
+    case FL_LOGR_ARG_PTRDIFF:
+      FL_LOGR_ARG_PUT(ptrdiff_t, buf, len, args);
+      break;
+    case FL_LOGR_ARG_DOUBLE:
+      FL_LOGR_ARG_PUT(double, buf, len, args);
+      break;
+    case FL_LOGR_ARG_LDOUBLE:
+      FL_LOGR_ARG_PUT(long double, buf, len, args);
+      break;
+    case FL_LOGR_ARG_PTR:
+      FL_LOGR_ARG_PUT(void *, buf, len, args);
+      break;
+    case FL_LOGR_ARG_STR:
+      /* Strings are truncated to fit the record */
+      str = va_arg(args, const char *);
+      if (!str) {
+        str = "(null)";
+      }
+      slen = strnlen(str, sroom);
+      sroom -= slen;
+      memcpy(buf + len, str, slen);
+      buf[len + slen] = '\0';
+      len += slen + 1;
+      break;
+    default:
+      FL_ASSERT(0);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+#define FL_LOGR_ARG_SNPRINTF(_buf_, _len_, _spec_, _stars_, _n_, _v_)   \
+  do {                                                                  \
+    if ((_n_) == 0) {                                                   \
+      (void) snprintf((_buf_), (_len_), (_spec_), (_v_));               \
+    } else if ((_n_) == 1) {                                            \
+      (void) snprintf((_buf_), (_len_), (_spec_), (_stars_)[0], (_v_)); \
+    } else {                                                            \
+      (void) snprintf((_buf_), (_len_), (_spec_), (_stars_)[0],         \
+                      (_stars_)[1], (_v_));                             \
+    }                                                                   \
+  } while (0)
+
+#define FL_LOGR_ARG_RENDER(_type_, _buf_, _len_, _spec_, _stars_, _n_,  \
+                           _args_)                                      \
+  do {                                                                  \
+    _type_ _v;                                                          \
+    memcpy(&_v, (_args_), sizeof(_v));                                  \
+    (_args_) += sizeof(_v);                                             \
+    FL_LOGR_ARG_SNPRINTF(_buf_, _len_, _spec_, _stars_, _n_, _v);       \
+  } while (0)
+
+/**
+ * @brief Render a message from its format and recorded arguments.
+ */
+static void fl_logr_fmt_render(const char *format, const char *args,
+                               char *buf, size_t buflen)
+{
+  const char *p = format, *q;
+  fl_logr_arg_e type;
+  char spec[32];
+  size_t len = 0, n;
+  int nstars, stars[2], i;
+
+  while (*p && (len < buflen - 1)) {
+    q = strchr(p, '%');
+    n = q ? (size_t) (q - p) : strlen(p);
+    if (n > buflen - 1 - len) {
+      n = buflen - 1 - len;
+    }
+    memcpy(buf + len, p, n);
+    len += n;
+    if (!q || (len == buflen - 1)) {
+      break;
+    }
+
+    p = fl_logr_fmt_spec(q + 1, &nstars, &type);
+    if ((size_t) (p - q) >= sizeof(spec)) {
+      break;
+    }
+    memcpy(spec, q, p - q);
+    spec[p - q] = '\0';
+
+    for (i = 0; i < nstars; i++) {
+      memcpy(&stars[i], args, sizeof(int));
+      args += sizeof(int);
+    }
+
+    switch (type) {
+    case FL_LOGR_ARG_NONE:
+      buf[len] = '%';
+      buf[len + 1] = '\0';
+      break;
+    case FL_LOGR_ARG_INT:
+      FL_LOGR_ARG_RENDER(int, buf + len, buflen - len, spec, stars, nstars,
+                         args);
+      break;
+    case FL_LOGR_ARG_LONG:
+      FL_LOGR_ARG_RENDER(long, buf + len, buflen - len, spec, stars, nstars,
+                         args);
+      break;
+    case FL_LOGR_ARG_LLONG:
+      FL_LOGR_ARG_RENDER(long long, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_INTMAX:
+      FL_LOGR_ARG_RENDER(intmax_t, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_SIZE:
+      FL_LOGR_ARG_RENDER(size_t, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_PTRDIFF:
+      FL_LOGR_ARG_RENDER(ptrdiff_t, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_DOUBLE:
+      FL_LOGR_ARG_RENDER(double, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_LDOUBLE:
+      FL_LOGR_ARG_RENDER(long double, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_PTR:
+      FL_LOGR_ARG_RENDER(void *, buf + len, buflen - len, spec, stars,
+                         nstars, args);
+      break;
+    case FL_LOGR_ARG_STR:
+      {
+        const char *str = args;
+
+        args += strlen(str) + 1;
+        FL_LOGR_ARG_SNPRINTF(buf + len, buflen - len, spec, stars, nstars,
+                             str);
+      }
+      break;
+    default:
+      FL_ASSERT(0);
+      buf[len] = '\0';
+      return;
+    }
+    len += strlen(buf + len);
+  }
+
+  buf[len] = '\0';
+}
+
+static u_int32_t fl_logr_async_drain(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  fl_logr_rec_t *rec;
+  u_int32_t head, n = 0;
+  char text[FL_LOGR_ASYNC_MSG_MAX_LEN * 4];
+
+  head = atomic_load_explicit(&la->head, memory_order_relaxed);
+  for (;;) {
+    rec = &la->recs[head & (la->nrecords - 1)];
+    if (atomic_load_explicit(&rec->seq, memory_order_acquire) != head + 1) {
+      break;
+    }
+
+    if (rec->format) {
+      fl_logr_fmt_render(rec->format, rec->msg, text, sizeof(text));
+      fl_logr_write(rec->priority, &rec->ts, text);
+    } else {
+      fl_logr_write(rec->priority, &rec->ts, rec->msg);
+    }
+    atomic_store_explicit(&rec->seq, head + la->nrecords,
+                          memory_order_release);
+    head++;
+    n++;
+  }
+  atomic_store_explicit(&la->head, head, memory_order_release);
+
+  la->nwritten += n;
+  if (n && la->fp) {
+    (void) fflush(la->fp);
+  }
+
+  return n;
+}
+
+static int fl_logr_async_empty(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  u_int32_t head = atomic_load_explicit(&la->head, memory_order_relaxed);
+  fl_logr_rec_t *rec = &la->recs[head & (la->nrecords - 1)];
+
+  return (atomic_load(&rec->seq) != head + 1);
+}
+
+static void fl_logr_async_wakeup(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+
+  /* Pairs with the fence in fl_logr_async_main(): either the logging thread
+   * sees the new record, or it is seen sleeping here and is woken up.
+   */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&la->sleeping, memory_order_relaxed) &&
+      atomic_exchange(&la->sleeping, 0)) {
+    (void) sem_post(&la->wakeup);
+  }
+}
+
+static void *fl_logr_async_main(void *arg)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+
+  for (;;) {
+    if (fl_logr_async_drain()) {
+      continue;
+    }
+
+    if (atomic_load(&la->stop)) {
+      break;
+    }
+
+    atomic_store(&la->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!fl_logr_async_empty() || atomic_load(&la->stop)) {
+      atomic_store(&la->sleeping, 0);
+      continue;
+    }
+
+    while ((sem_wait(&la->wakeup) < 0) && (errno == EINTR)) {
+    }
+    atomic_store(&la->sleeping, 0);
+  }
+
+  return NULL;
+}
+
+static int fl_logr_async_start(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  sigset_t set, oset;
+  int rc;
+
+  atomic_store(&la->stop, 0);
+  atomic_store(&la->sleeping, 0);
+
+  /* Signals are never delivered to the logging thread */
+  (void) sigfillset(&set);
+  (void) pthread_sigmask(SIG_SETMASK, &set, &oset);
+  rc = pthread_create(&la->thread, NULL, fl_logr_async_main, NULL);
+  (void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+  if (rc) {
+    syslog(LOG_ERR, "Unable to start the logging thread, error %d <%s>", rc,
+           strerror(rc));
+    return -1;
+  }
+
+  la->running = 1;
+  return 0;
+}
+
+/* The logging thread does not survive fork(), e.g. fl_process_daemonize().
+ * The queue is drained before forking, so that the child does not write the
+ * parent's messages again, and the child starts a thread of its own.
+ */
+static void fl_logr_async_atfork_prepare(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+
+  if (!la->running) {
+    return;
+  }
+
+  while (atomic_load(&la->head) != atomic_load(&la->tail)) {
+    fl_logr_async_wakeup();
+    (void) sched_yield();
+  }
+}
+
+static void fl_logr_async_atfork_child(void)
+{
+  if (fl_logr_async.running) {
+    fl_logr_async.running = 0;
+    (void) sem_init(&fl_logr_async.wakeup, 0, 0);
+    if (fl_logr_async_start() < 0) {
+      fl_logr_async_enabled = 0;
+    }
+  }
+}
+
+static void fl_logr_async_stop(void)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+
+  if (!la->running) {
+    return;
+  }
+
+  atomic_store(&la->stop, 1);
+  (void) sem_post(&la->wakeup);
+  (void) pthread_join(la->thread, NULL);
+  la->running = 0;
+
+  /* Messages queued while the thread was exiting */
+  (void) fl_logr_async_drain();
+}
+
+int fl_logr_cfg_async(u_int32_t nrecords, fl_logr_overflow_e overflow,
+                      FILE *fp)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  u_int32_t n, i;
+
+  if (la->recs) {
+    FL_LOGR_ERR("Asynchronous logging is already configured");
+    return -1;
+  }
+
+  if ((overflow != FL_LOGR_OVERFLOW_DROP) &&
+      (overflow != FL_LOGR_OVERFLOW_BLOCK)) {
+    FL_LOGR_ERR("Invalid logger overflow policy (%d) configuration",
+                overflow);
+    return -1;
+  }
+
+  if (!nrecords) {
+    nrecords = FL_LOGR_ASYNC_DEFAULT_NRECORDS;
+  }
+  if (nrecords > (1U << 24)) {
+    FL_LOGR_ERR("Invalid logger queue size (%u) configuration", nrecords);
+    return -1;
+  }
+  for (n = 1; n < nrecords; n <<= 1) {
+  }
+
+  FL_ALLOC(fl_logr_rec_t, n, la->recs, "Logger Queue");
+  if (!la->recs) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    atomic_init(&la->recs[i].seq, i);
+  }
+
+  if (sem_init(&la->wakeup, 0, 0) < 0) {
+    FL_LOGR_ERR("Unable to initialize the logger semaphore, error <%s>",
+                strerror(errno));
+    FL_FREE(la->recs, "Logger Queue");
+    return -1;
+  }
+  (void) pthread_atfork(fl_logr_async_atfork_prepare, NULL,
+                        fl_logr_async_atfork_child);
+
+  la->nrecords = n;
+  la->overflow = overflow;
+  la->fp = fp;
+  FL_LOGR_INFO("Asynchronous logging configured, queue size %u, overflow "
+               "policy %s", n, fl_trace_value(fl_logr_overflows, overflow));
+  return 0;
+}
+
+int fl_logr_cfg_binary(int enable)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+
+  if (!la->recs) {
+    FL_LOGR_ERR("Binary logging requires asynchronous logging");
+    return -1;
+  }
+
+  if (enable && !la->fmts) {
+    FL_ALLOC(fl_logr_fmt_t, FL_LOGR_FMT_CACHE_SIZE, la->fmts,
+             "Logger Format Cache");
+    if (!la->fmts) {
+      return -1;
+    }
+  }
+
+  if (la->binary != !!enable) {
+    FL_LOGR_INFO("Binary logging %s", enable ? "enabled" : "disabled");
+    la->binary = !!enable;
+  }
+  return 0;
+}
+
 void fl_logr_openlog(const char *ident)
 {
   openlog(ident, LOG_CONS | LOG_NDELAY | LOG_PID, LOG_LOCAL0);
+  if (fl_logr_async.recs && !fl_logr_async.running &&
+      (fl_logr_async_start() == 0)) {
+    fl_logr_async_enabled = 1;
+  }
   FL_LOGR_INFO("Logging started for %s", ident);
 }
 
 void fl_logr_closelog(const char *ident)
 {
-  openlog(ident, LOG_CONS | LOG_NDELAY | LOG_PID, LOG_LOCAL0);
   FL_LOGR_INFO("Logging stopped for %s", ident);
+
+  if (fl_logr_async_enabled) {
+    fl_logr_async_enabled = 0;
+    fl_logr_async_stop();
+    if (atomic_load(&fl_logr_async.ndropped)) {
+      syslog(LOG_WARNING, "Logger dropped %llu messages",
+             atomic_load(&fl_logr_async.ndropped));
+    }
+  }
+
+  closelog();
 }
 
 void fl_logr_cfg_priority(int priority)
@@ -84,9 +853,119 @@ void fl_logr_log(int priority, const char *format, ...)
   va_end(args);
 }
 
+static void fl_logr_vsyslog(int priority, int deferrable, const char *format,
+                            va_list args)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  fl_logr_rec_t *rec;
+  u_int32_t pos, seq;
+  int blocked = 0;
+  va_list cargs;
+
+  if (!fl_logr_async_enabled || ((priority & LOG_PRIMASK) <= LOG_ALERT)) {
+    if (priority & FL_LOGR_STDERR) {
+      va_copy(cargs, args);
+      vsyslog(priority & ~FL_LOGR_STDERR, format, cargs);
+      va_end(cargs);
+      (void) vfprintf(stderr, format, args);
+    } else {
+      vsyslog(priority, format, args);
+    }
+    return;
+  }
+
+  pos = atomic_load_explicit(&la->tail, memory_order_relaxed);
+  for (;;) {
+    rec = &la->recs[pos & (la->nrecords - 1)];
+    seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+    if (seq == pos) {
+      if (atomic_compare_exchange_weak_explicit(&la->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if ((int32_t) (seq - pos) < 0) {
+      /* Queue is full */
+      if (la->overflow == FL_LOGR_OVERFLOW_DROP) {
+        atomic_fetch_add_explicit(&la->ndropped, 1, memory_order_relaxed);
+        return;
+      }
+      if (!blocked) {
+        atomic_fetch_add_explicit(&la->nblocked, 1, memory_order_relaxed);
+        blocked = 1;
+      }
+      fl_logr_async_wakeup();
+      (void) sched_yield();
+      pos = atomic_load_explicit(&la->tail, memory_order_relaxed);
+    } else {
+      pos = atomic_load_explicit(&la->tail, memory_order_relaxed);
+    }
+  }
+
+  rec->priority = priority;
+  if (la->fp) {
+    /* The system logger stamps messages itself */
+    (void) clock_gettime(CLOCK_REALTIME_COARSE, &rec->ts);
+  }
+  rec->format = NULL;
+  if (deferrable && la->binary) {
+    va_copy(cargs, args);
+    if (fl_logr_fmt_encode(format, rec->msg, cargs) == 0) {
+      rec->format = format;
+    }
+    va_end(cargs);
+  }
+  if (!rec->format) {
+    (void) vsnprintf(rec->msg, sizeof(rec->msg), format, args);
+  }
+  atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+
+  fl_logr_async_wakeup();
+}
+
 void fl_logr_vlog(int priority, const char *format, va_list args)
 {
   if (LOG_PRIORITY_CMP(priority)) {
-    vsyslog(priority, format, args);
+    fl_logr_vsyslog(priority, 0, format, args);
+  }
+}
+
+void fl_logr_syslog(int priority, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  fl_logr_vsyslog(priority, 1, format, args);
+  va_end(args);
+}
+
+void fl_logr_dump(FILE *fd)
+{
+  fl_logr_async_t *la = &fl_logr_async;
+  u_int32_t tail, head;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Logger\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "Priority: %s\n", fl_trace_value(syslog_priorities,
+                                               cfg_log_priority));
+  if (!fl_logr_async_enabled) {
+    fprintf(fd, "Mode: Synchronous\n");
+    return;
+  }
+
+  tail = atomic_load(&la->tail);
+  head = atomic_load(&la->head);
+  fprintf(fd, "Mode: Asynchronous, writing to %s\n",
+          la->fp ? "stream" : "system logger");
+  fprintf(fd, "    Queue size %u, overflow policy %s\n", la->nrecords,
+          fl_trace_value(fl_logr_overflows, la->overflow));
+  if (la->binary) {
+    fprintf(fd, "    Deferred formatting, %u format strings cached\n",
+            atomic_load(&la->nfmts));
   }
+  fprintf(fd, "    Queued %u, written %llu, dropped %llu, blocked %llu\n",
+          tail - head, la->nwritten, atomic_load(&la->ndropped),
+          atomic_load(&la->nblocked));
 }
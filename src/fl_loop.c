@@ -0,0 +1,486 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#define _GNU_SOURCE /* pthread_attr_setaffinity_np() */
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_pool.h"
+#include "falco/fl_fds.h"
+#include "falco/fl_timer.h"
+#include "falco/fl_socket.h"
+#include "falco/fl_job.h"
+#include "falco/fl_sched.h"
+#include "falco/fl_task.h"
+#include "falco/fl_work.h"
+#include "falco/fl_loop.h"
+
+/**
+ * @brief A method posted to a loop, an entry of the loop's post queue.
+ */
+typedef struct fl_loop_post_t_ {
+  atomic_uint seq;
+  const char *name;
+  fl_job_method_t method;
+  void *app_data;
+} fl_loop_post_t;
+
+static fl_loop_t fl_loop_main = { .name = "main", .cpu = -1, .wakeup_fd = -1 };
+static FL_LOOP_LOCAL fl_loop_t *fl_loop_current;
+static u_int32_t fl_loop_nposts = FL_LOOP_DEFAULT_POST_QUEUE;
+
+/* Loops are created and joined from any thread */
+static LIST_HEAD(fl_loops_, fl_loop_t_) fl_loops;
+static pthread_mutex_t fl_loops_lock = PTHREAD_MUTEX_INITIALIZER;
+static u_int32_t fl_loops_next_id = 1;
+
+static int fl_loop_modules_init(void);
+static void *fl_loop_thread(void *arg);
+static int fl_loop_posts_create(fl_loop_t *loop);
+static void fl_loop_posts_destroy(fl_loop_t *loop);
+static void fl_loop_wakeup(fl_loop_t *loop);
+
+int fl_loop_cfg_post_queue(u_int32_t nposts)
+{
+  u_int32_t n = 1;
+
+  if (!nposts) {
+    nposts = FL_LOOP_DEFAULT_POST_QUEUE;
+  }
+  if (nposts > (1U << 30)) {
+    FL_LOGR_ERR("Invalid loop post queue size (%u) configuration", nposts);
+    return -1;
+  }
+
+  while (n < nposts) {
+    n <<= 1;
+  }
+  fl_loop_nposts = n;
+  return 0;
+}
+
+int fl_loop_module_init(void)
+{
+  /* A thread that is not running a loop yet becomes the main loop */
+  if (!fl_loop_current) {
+    if (fl_loop_posts_create(&fl_loop_main) < 0) {
+      return -1;
+    }
+    fl_loop_main.thread = pthread_self();
+    fl_loop_current = &fl_loop_main;
+
+    (void) pthread_mutex_lock(&fl_loops_lock);
+    LIST_INSERT_HEAD(&fl_loops, &fl_loop_main, loop_lc);
+    (void) pthread_mutex_unlock(&fl_loops_lock);
+  }
+
+  return fl_loop_modules_init();
+}
+
+int fl_loop_module_dump(FILE *fd)
+{
+  register fl_loop_t *li;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Loops\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  (void) pthread_mutex_lock(&fl_loops_lock);
+  LIST_FOREACH(li, &fl_loops, loop_lc) {
+    fprintf(fd, "Name: %s%s\n", li->name,
+            (li == fl_loop_current) ? " [current]" : "");
+    fprintf(fd, "    Id %u, CPU %d, stopping %s\n", li->id, li->cpu,
+            (atomic_load(&li->stop)) ? "yes" : "no");
+    fprintf(fd, "    Post queue %u, eventfd %d, wakeups %llu\n",
+            li->nposts, li->wakeup_fd, li->nwakeups);
+    fprintf(fd, "    Posted %llu, run %llu, queue full %llu\n",
+            (unsigned long long) atomic_load(&li->nposted), li->nrun,
+            (unsigned long long) atomic_load(&li->nfull));
+  }
+  (void) pthread_mutex_unlock(&fl_loops_lock);
+
+  return 0;
+}
+
+fl_loop_t *fl_loop_create(const char *name, int cpu,
+                          fl_loop_method_t method, void *app_data)
+{
+  fl_loop_t *loop;
+  pthread_attr_t attr;
+  sigset_t set, oset;
+  int rc;
+
+  FL_ASSERT(name && method);
+  if (!name || (strlen(name) >= FL_LOOP_NAME_MAX_LEN) || !method) {
+    FL_LOGR_ERR("Request to create a loop (%s) with invalid arguments",
+                (name) ? name : "");
+    return NULL;
+  }
+
+  FL_ALLOC(fl_loop_t, 1, loop, "Loop");
+  if (!loop) {
+    return NULL;
+  }
+  strcpy(loop->name, name);
+  loop->cpu = cpu;
+  loop->method = method;
+  loop->app_data = app_data;
+  atomic_init(&loop->stop, 0);
+  if (fl_loop_posts_create(loop) < 0) {
+    FL_FREE(loop, "Loop");
+    return NULL;
+  }
+
+  (void) pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (rc) {
+      FL_LOGR_ERR("Loop (%s) could not be bound to CPU %d, error %d <%s>",
+                  name, cpu, rc, strerror(rc));
+      (void) pthread_attr_destroy(&attr);
+      fl_loop_posts_destroy(loop);
+      FL_FREE(loop, "Loop");
+      return NULL;
+    }
+  }
+
+  (void) pthread_mutex_lock(&fl_loops_lock);
+  loop->id = fl_loops_next_id++;
+  LIST_INSERT_HEAD(&fl_loops, loop, loop_lc);
+  (void) pthread_mutex_unlock(&fl_loops_lock);
+
+  /* Signals are delivered to the main loop only */
+  (void) sigfillset(&set);
+  (void) pthread_sigmask(SIG_SETMASK, &set, &oset);
+  rc = pthread_create(&loop->thread, &attr, fl_loop_thread, loop);
+  (void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+  (void) pthread_attr_destroy(&attr);
+
+  if (rc) {
+    FL_LOGR_ERR("Loop (%s) thread creation failed, error %d <%s>",
+                name, rc, strerror(rc));
+    (void) pthread_mutex_lock(&fl_loops_lock);
+    LIST_REMOVE(loop, loop_lc);
+    (void) pthread_mutex_unlock(&fl_loops_lock);
+    fl_loop_posts_destroy(loop);
+    FL_FREE(loop, "Loop");
+    return NULL;
+  }
+
+  FL_LOGR_INFO("Created loop (%s, %u)", loop->name, loop->id);
+  return loop;
+}
+
+int fl_loop_join(fl_loop_t *loop)
+{
+  int rc;
+
+  if (!loop || (loop == &fl_loop_main) || (loop == fl_loop_current)) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("Request to join an invalid loop");
+    return -1;
+  }
+
+  rc = pthread_join(loop->thread, NULL);
+  if (rc) {
+    FL_LOGR_ERR("Join of loop (%s, %u) failed, error %d <%s>",
+                loop->name, loop->id, rc, strerror(rc));
+    return -1;
+  }
+
+  (void) pthread_mutex_lock(&fl_loops_lock);
+  LIST_REMOVE(loop, loop_lc);
+  (void) pthread_mutex_unlock(&fl_loops_lock);
+
+  rc = loop->rc;
+  FL_LOGR_DEBUG("Joined loop (%s, %u), return value %d",
+                loop->name, loop->id, rc);
+  fl_loop_posts_destroy(loop);
+  FL_FREE(loop, "Loop");
+  return rc;
+}
+
+int fl_loop_post(fl_loop_t *loop, const char *name,
+                 fl_job_method_t method, void *app_data)
+{
+  fl_loop_post_t *post;
+  u_int32_t pos, seq;
+
+  FL_ASSERT(loop && name && method);
+  if (!loop || !loop->posts || !name || !method) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pos = atomic_load_explicit(&loop->posts_tail, memory_order_relaxed);
+  for (;;) {
+    post = &loop->posts[pos & (loop->nposts - 1)];
+    seq = atomic_load_explicit(&post->seq, memory_order_acquire);
+    if (seq == pos) {
+      if (atomic_compare_exchange_weak_explicit(&loop->posts_tail, &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if ((int32_t) (seq - pos) < 0) {
+      atomic_fetch_add_explicit(&loop->nfull, 1, memory_order_relaxed);
+      errno = EAGAIN;
+      return -1;
+    } else {
+      pos = atomic_load_explicit(&loop->posts_tail, memory_order_relaxed);
+    }
+  }
+
+  post->name = name;
+  post->method = method;
+  post->app_data = app_data;
+  atomic_store_explicit(&post->seq, pos + 1, memory_order_release);
+  atomic_fetch_add_explicit(&loop->nposted, 1, memory_order_relaxed);
+
+  fl_loop_wakeup(loop);
+  return 0;
+}
+
+void fl_loop_dispatch(int *nfds, fd_set *fds)
+{
+  fl_loop_t *loop = fl_loop_current;
+  fl_loop_post_t *post;
+  u_int64_t count;
+  u_int32_t head, n = 0;
+
+  FL_ASSERT((*nfds) >= 0);
+
+  if (!loop || (loop->wakeup_fd < 0) ||
+      !fl_fd_isready(loop->wakeup_fd, FL_FD_OP_READ, fds)) {
+    return;
+  }
+
+  (*nfds)--;
+  fl_fd_clrready(loop->wakeup_fd, FL_FD_OP_READ, fds);
+  loop->nwakeups++;
+
+  /* Rearm the wakeup before draining. A method posted from here on either
+   * is seen by the drain, or signals the eventfd again.
+   */
+  (void) read(loop->wakeup_fd, &count, sizeof(count));
+  atomic_store(&loop->wakeup_pending, 0);
+
+  /* At most a queue full per wakeup, so that producers can not hold the loop
+   * here.
+   */
+  head = loop->posts_head;
+  while (n < loop->nposts) {
+    fl_job_method_t method;
+    const char *name;
+    void *app_data;
+
+    post = &loop->posts[head & (loop->nposts - 1)];
+    if (atomic_load_explicit(&post->seq, memory_order_acquire) != head + 1) {
+      break;
+    }
+
+    /* The entry is released first, so that its method can post again */
+    name = post->name;
+    method = post->method;
+    app_data = post->app_data;
+    atomic_store_explicit(&post->seq, head + loop->nposts,
+                          memory_order_release);
+    head++;
+    loop->posts_head = head;
+
+    method(name, app_data);
+    n++;
+  }
+  loop->nrun += n;
+
+  if (n == loop->nposts) {
+    fl_loop_wakeup(loop);
+  }
+}
+
+void fl_loop_stop(fl_loop_t *loop)
+{
+  FL_ASSERT(loop);
+  if (loop) {
+    atomic_store(&loop->stop, 1);
+    fl_loop_wakeup(loop);
+  }
+}
+
+int fl_loop_stopping(void)
+{
+  return (fl_loop_current && atomic_load(&fl_loop_current->stop));
+}
+
+fl_loop_t *fl_loop_self(void)
+{
+  return fl_loop_current;
+}
+
+static int fl_loop_modules_init(void)
+{
+  if (fl_pool_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Pool module initialization failed");
+    return -1;
+  }
+  if (fl_fds_module_init() < 0) {
+    FL_LOGR_CRIT("Falco FDs module initialization failed");
+    return -1;
+  }
+  if (fl_timer_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Timer module initialization failed");
+    return -1;
+  }
+  if (fl_socket_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Socket module initialization failed");
+    return -1;
+  }
+  if (fl_job_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Job module initialization failed");
+    return -1;
+  }
+  if (fl_sched_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Scheduler module initialization failed");
+    return -1;
+  }
+  if (fl_task_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Task module initialization failed");
+    return -1;
+  }
+  if (fl_work_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Work module initialization failed");
+    return -1;
+  }
+
+  /* Posted methods are run when the eventfd of the loop is readable */
+  if (fl_fds_get_owner(fl_loop_current->wakeup_fd, FL_FD_OWNER_LOOP) !=
+      fl_loop_current) {
+    fl_fds_set_owner(fl_loop_current->wakeup_fd, FL_FD_OWNER_LOOP,
+                     fl_loop_current);
+    FL_FD_SET(fl_loop_current->wakeup_fd, FL_FD_OP_READ);
+  }
+
+  return 0;
+}
+
+static void *fl_loop_thread(void *arg)
+{
+  fl_loop_t *loop = arg;
+
+  fl_loop_current = loop;
+  if (fl_loop_modules_init() < 0) {
+    FL_LOGR_CRIT("Loop (%s, %u) initialization failed", loop->name, loop->id);
+    loop->rc = -1;
+    return NULL;
+  }
+
+  FL_LOGR_INFO("Loop (%s, %u) started", loop->name, loop->id);
+  loop->rc = loop->method(loop, loop->app_data);
+  FL_LOGR_INFO("Loop (%s, %u) ended, return value %d",
+               loop->name, loop->id, loop->rc);
+
+  FL_FD_CLR(loop->wakeup_fd, FL_FD_OP_READ);
+  fl_fds_set_owner(loop->wakeup_fd, FL_FD_OWNER_NONE, NULL);
+  return NULL;
+}
+
+static int fl_loop_posts_create(fl_loop_t *loop)
+{
+  u_int32_t i;
+
+  loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->wakeup_fd < 0) {
+    int save_errno = errno;
+    FL_LOGR_ERR("Loop (%s) eventfd creation failed, error %d <%s>",
+                loop->name, save_errno, strerror(save_errno));
+    return -1;
+  }
+
+  FL_ALLOC(fl_loop_post_t, fl_loop_nposts, loop->posts, "Loop Post Queue");
+  if (!loop->posts) {
+    (void) close(loop->wakeup_fd);
+    loop->wakeup_fd = -1;
+    return -1;
+  }
+  loop->nposts = fl_loop_nposts;
+  for (i = 0; i < loop->nposts; i++) {
+    atomic_init(&loop->posts[i].seq, i);
+  }
+  atomic_init(&loop->posts_tail, 0);
+  loop->posts_head = 0;
+  atomic_init(&loop->wakeup_pending, 0);
+
+  return 0;
+}
+
+static void fl_loop_posts_destroy(fl_loop_t *loop)
+{
+  u_int32_t npending;
+
+  npending = atomic_load(&loop->posts_tail) - loop->posts_head;
+  if (npending) {
+    FL_LOGR_WARNING("Loop (%s, %u) ended with %u posted methods not run",
+                    loop->name, loop->id, npending);
+  }
+
+  if (loop->posts) {
+    FL_FREE(loop->posts, "Loop Post Queue");
+  }
+  if (loop->wakeup_fd >= 0) {
+    (void) close(loop->wakeup_fd);
+    loop->wakeup_fd = -1;
+  }
+}
+
+static void fl_loop_wakeup(fl_loop_t *loop)
+{
+  u_int64_t one = 1;
+
+  /* One eventfd write per drain of the loop. Pairs with the reset of
+   * wakeup_pending in fl_loop_dispatch().
+   */
+  if (!atomic_exchange(&loop->wakeup_pending, 1)) {
+    (void) write(loop->wakeup_fd, &one, sizeof(one));
+  }
+}
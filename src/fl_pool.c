@@ -0,0 +1,209 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include <string.h>
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_pool.h"
+
+/* Pools are not thread safe, each event loop has its own */
+static FL_LOOP_LOCAL LIST_HEAD(fl_pools_, fl_pool_t_) fl_pools;
+static FL_LOOP_LOCAL int fl_pools_initialized;
+
+static int fl_pool_grow(fl_pool_t *pool, u_int32_t nobjs);
+
+int fl_pool_module_init(void)
+{
+  /* Pools may be created and prewarmed before the module is initialized,
+   * they must not be forgotten.
+   */
+  if (!fl_pools_initialized) {
+    LIST_INIT(&fl_pools);
+    fl_pools_initialized = 1;
+  }
+
+  FL_LOGR_INFO("Falco Pool module initialized");
+  return 0;
+}
+
+int fl_pool_module_dump(FILE *fd)
+{
+  register fl_pool_t *li;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Pools\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  if (!fl_pools_initialized || LIST_EMPTY(&fl_pools)) {
+    fprintf(fd, "    No pools are currently present\n");
+    return 0;
+  }
+
+  LIST_FOREACH(li, &fl_pools, pool_lc) {
+    fprintf(fd, "Name: %s\n", li->name);
+    fprintf(fd, "    Object size %zu (aligned to %zu), %u objects per slab, "
+            "%u slabs\n", li->obj_size, li->align, li->slab_nobjs,
+            li->nslabs);
+    fprintf(fd, "    Objects: %u, in use %u, free %u, max in use %u\n",
+            li->nobjs, li->nobjs - li->nfree, li->nfree, li->max_used);
+    fprintf(fd, "    Gets %llu, puts %llu, failures %llu\n",
+            (unsigned long long) li->ngets, (unsigned long long) li->nputs,
+            (unsigned long long) li->nfailures);
+  }
+
+  return 0;
+}
+
+fl_pool_t *fl_pool_create(const char *name, size_t obj_size,
+                          size_t align, u_int32_t slab_nobjs)
+{
+  fl_pool_t *pool;
+
+  FL_ASSERT(name && (strlen(name) < FL_POOL_NAME_MAX_LEN));
+  FL_ASSERT(obj_size);
+  FL_ASSERT(!(align & (align - 1)));
+
+  FL_ALLOC(fl_pool_t, 1, pool, "Pool");
+  if (!pool) {
+    return NULL;
+  }
+
+  (void) strcpy(pool->name, name);
+  /* Free objects are linked through their first word. Rounding the size up
+   * to the alignment keeps every object in a slab aligned.
+   */
+  pool->align = (align > sizeof(void *)) ? align : sizeof(void *);
+  pool->obj_size = (obj_size + pool->align - 1) & ~(pool->align - 1);
+  pool->slab_nobjs = (slab_nobjs) ? slab_nobjs : FL_POOL_SLAB_NOBJS;
+
+  if (!fl_pools_initialized) {
+    LIST_INIT(&fl_pools);
+    fl_pools_initialized = 1;
+  }
+  LIST_INSERT_HEAD(&fl_pools, pool, pool_lc);
+
+  FL_LOGR_DEBUG("Created pool (%s) of objects of size %zu", pool->name,
+                pool->obj_size);
+  return pool;
+}
+
+int fl_pool_prewarm(fl_pool_t *pool, u_int32_t nobjs)
+{
+  FL_ASSERT(pool);
+
+  if (pool->nfree >= nobjs) {
+    return 0;
+  }
+
+  return fl_pool_grow(pool, nobjs - pool->nfree);
+}
+
+void *fl_pool_get(fl_pool_t *pool)
+{
+  void *obj;
+  u_int32_t nused;
+
+  FL_ASSERT(pool);
+
+  if (!pool->free_list && (fl_pool_grow(pool, pool->slab_nobjs) < 0)) {
+    pool->nfailures++;
+    return NULL;
+  }
+
+  obj = pool->free_list;
+  pool->free_list = *(void **) obj;
+  pool->nfree--;
+  pool->ngets++;
+
+  nused = pool->nobjs - pool->nfree;
+  if (nused > pool->max_used) {
+    pool->max_used = nused;
+  }
+
+  memset(obj, 0, pool->obj_size);
+  return obj;
+}
+
+void fl_pool_put(fl_pool_t *pool, void *obj)
+{
+  FL_ASSERT(pool && obj);
+  FL_ASSERT(pool->nfree < pool->nobjs);
+
+  *(void **) obj = pool->free_list;
+  pool->free_list = obj;
+  pool->nfree++;
+  pool->nputs++;
+}
+
+/* Allocate a slab of nobjs objects, and add them to the free list */
+static int fl_pool_grow(fl_pool_t *pool, u_int32_t nobjs)
+{
+  register u_int32_t i;
+  void **slabs = pool->slabs;
+  void *mem;
+  char *slab;
+  int rc;
+
+  FL_REALLOC(void *, pool->nslabs + 1, slabs, "Pool Slabs");
+  if (!slabs) {
+    return -1;
+  }
+  pool->slabs = slabs;
+
+  /* Objects are zeroed when they are handed out, the slab is not. */
+  rc = posix_memalign(&mem, pool->align, nobjs * pool->obj_size);
+  if (rc) {
+    FL_ASSERT(0);
+    FL_LOGR_CRIT("%s, %d: Unable to allocate memory [Requested %u blocks of "
+                 "size %zu each] for pool %s, error %d <%s>", __func__,
+                 __LINE__, nobjs, pool->obj_size, pool->name, rc,
+                 strerror(rc));
+    return -1;
+  }
+  slab = mem;
+  pool->slabs[pool->nslabs++] = slab;
+
+  /* Objects of a slab are handed out in the order of their addresses */
+  for (i = nobjs; i > 0; i--) {
+    void *obj = slab + ((i - 1) * pool->obj_size);
+
+    *(void **) obj = pool->free_list;
+    pool->free_list = obj;
+  }
+  pool->nobjs += nobjs;
+  pool->nfree += nobjs;
+
+  FL_LOGR_DEBUG("Pool (%s) grown by %u objects to %u objects", pool->name,
+                nobjs, pool->nobjs);
+  return 0;
+}
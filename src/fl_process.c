@@ -41,25 +41,26 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "falco/fl_defs.h"
 #include "falco/fl_logr.h"
 #include "falco/fl_signal.h"
+#include "falco/fl_fds.h"
+#include "falco/fl_pool.h"
 #include "falco/fl_timer.h"
+#include "falco/fl_job.h"
+#include "falco/fl_sched.h"
 #include "falco/fl_task.h"
 #include "falco/fl_socket.h"
 #include "falco/fl_if.h"
+#include "falco/fl_loop.h"
+#include "falco/fl_work.h"
 #include "falco/fl_process.h"
 
 int fl_init(void)
 {
-
-  if (fl_timer_module_init() < 0) {
-    FL_LOGR_CRIT("Falco Timer module initialization failed");
-    return -1;
-  }
-  if (fl_socket_module_init() < 0) {
-    FL_LOGR_CRIT("Falco Socket module initialization failed");
+  /* The modules of the main loop, then the ones common to the process */
+  if (fl_loop_module_init() < 0) {
     return -1;
   }
-  if (fl_task_module_init() < 0) {
-    FL_LOGR_CRIT("Falco Task module initialization failed");
+  if (fl_signal_module_init() < 0) {
+    FL_LOGR_CRIT("Falco Signal module initialization failed");
     return -1;
   }
   if (fl_if_module_init() < 0) {
@@ -233,9 +234,17 @@ int fl_dump(FILE *fd)
     return -1;
   }
 
+  fl_loop_module_dump(fd);
   fl_task_module_dump(fd);
   fl_socket_module_dump(fd);
   fl_timer_module_dump(fd);
+  fl_job_module_dump(fd);
+  fl_sched_module_dump(fd);
+  fl_work_module_dump(fd);
+  fl_fds_module_dump(fd);
+  fl_signal_module_dump(fd);
+  fl_pool_module_dump(fd);
+  fl_logr_dump(fd);
 
   return 0;
 }
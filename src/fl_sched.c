@@ -0,0 +1,270 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_tracevalue.h"
+#include "falco/fl_sched.h"
+
+/**
+ * @brief Scheduler configuration, common to all the event loops.
+ */
+typedef struct fl_sched_cfg_t_ {
+  fl_sched_policy_e policy;
+  u_int32_t budget;
+  u_int32_t weights[FL_SCHED_PRIORITY_MAX];
+} fl_sched_cfg_t;
+
+/**
+ * @brief Run queues and counters of the scheduler of an event loop.
+ */
+typedef struct fl_sched_t_ {
+  TAILQ_HEAD(fl_sched_runq_, fl_sched_event_t_) runqs[FL_SCHED_PRIORITY_MAX];
+  u_int32_t nqueued[FL_SCHED_PRIORITY_MAX];
+  u_int32_t max_queued[FL_SCHED_PRIORITY_MAX];
+  u_int64_t ndispatched[FL_SCHED_PRIORITY_MAX];
+  u_int32_t nrunnable;
+
+  /* Weighted round robin position */
+  int wrr_priority;
+  u_int32_t wrr_credit;
+
+  u_int64_t nruns;
+  u_int64_t nexhausted;      ///< Runs that ran out of budget
+} fl_sched_t;
+
+static fl_sched_cfg_t fl_sched_config = {
+  .policy = FL_SCHED_NONE,
+  .budget = FL_SCHED_DEFAULT_BUDGET,
+  .weights = { 8, 4, 1 },
+};
+static FL_LOOP_LOCAL fl_sched_t fl_sched;
+static FL_LOOP_LOCAL int fl_sched_initialized;
+
+static const values_t fl_sched_policies[] = {
+  { FL_SCHED_NONE,     "None"              },
+  { FL_SCHED_STRICT,   "Strict priority"   },
+  { FL_SCHED_WEIGHTED, "Weighted priority" },
+  { 0, NULL }
+};
+
+static const values_t fl_sched_priorities[] = {
+  { FL_SCHED_PRIORITY_HIGH,   "High"   },
+  { FL_SCHED_PRIORITY_MEDIUM, "Medium" },
+  { FL_SCHED_PRIORITY_LOW,    "Low"    },
+  { 0, NULL }
+};
+
+int fl_sched_cfg(fl_sched_policy_e policy, u_int32_t budget)
+{
+  if ((policy != FL_SCHED_NONE) && (policy != FL_SCHED_STRICT) &&
+      (policy != FL_SCHED_WEIGHTED)) {
+    FL_LOGR_ERR("Invalid scheduling policy (%d) configuration", policy);
+    return -1;
+  }
+
+  if ((policy == FL_SCHED_NONE) && fl_sched.nrunnable) {
+    FL_LOGR_ERR("Scheduler can not be disabled with %u events queued",
+                fl_sched.nrunnable);
+    return -1;
+  }
+
+  fl_sched_config.policy = policy;
+  fl_sched_config.budget = (budget) ? budget : FL_SCHED_DEFAULT_BUDGET;
+  FL_LOGR_INFO("Scheduling policy %s, budget %u events",
+               fl_trace_value(fl_sched_policies, policy),
+               fl_sched_config.budget);
+  return 0;
+}
+
+int fl_sched_cfg_weights(const u_int32_t weights[FL_SCHED_PRIORITY_MAX])
+{
+  int p;
+
+  for (p = 0; p < FL_SCHED_PRIORITY_MAX; p++) {
+    if (!weights[p]) {
+      FL_LOGR_ERR("Invalid scheduling weight 0 for %s priority",
+                  fl_trace_value(fl_sched_priorities, p));
+      return -1;
+    }
+  }
+
+  for (p = 0; p < FL_SCHED_PRIORITY_MAX; p++) {
+    fl_sched_config.weights[p] = weights[p];
+  }
+  fl_sched.wrr_credit = 0;
+  return 0;
+}
+
+int fl_sched_module_init(void)
+{
+  int p;
+
+  if (fl_sched_initialized) {
+    return 0;
+  }
+
+  for (p = 0; p < FL_SCHED_PRIORITY_MAX; p++) {
+    TAILQ_INIT(&fl_sched.runqs[p]);
+  }
+  fl_sched.wrr_priority = FL_SCHED_PRIORITY_MAX - 1;
+  fl_sched_initialized = 1;
+
+  FL_LOGR_INFO("Falco Scheduler module initialized");
+  return 0;
+}
+
+int fl_sched_module_dump(FILE *fd)
+{
+  fl_sched_cfg_t *cfg = &fl_sched_config;
+  fl_sched_t *sched = &fl_sched;
+  int p;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Scheduler\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "Policy: %s, budget %u events\n",
+          fl_trace_value(fl_sched_policies, cfg->policy), cfg->budget);
+  fprintf(fd, "Runs %llu, out of budget %llu\n",
+          (unsigned long long) sched->nruns,
+          (unsigned long long) sched->nexhausted);
+  for (p = 0; p < FL_SCHED_PRIORITY_MAX; p++) {
+    fprintf(fd, "    %-6s weight %u, queued %u, max queued %u, "
+            "dispatched %llu\n", fl_trace_value(fl_sched_priorities, p),
+            cfg->weights[p], sched->nqueued[p], sched->max_queued[p],
+            (unsigned long long) sched->ndispatched[p]);
+  }
+
+  return 0;
+}
+
+int fl_sched_enabled(void)
+{
+  return (fl_sched_config.policy != FL_SCHED_NONE);
+}
+
+void fl_sched_event_init(fl_sched_event_t *event,
+                         fl_sched_event_method_t method, void *owner)
+{
+  event->method = method;
+  event->owner = owner;
+  event->priority = -1;
+}
+
+void fl_sched_event_queue(fl_sched_event_t *event,
+                          fl_sched_priority_e priority)
+{
+  fl_sched_t *sched = &fl_sched;
+
+  FL_ASSERT(event->method);
+  FL_ASSERT((priority >= 0) && (priority < FL_SCHED_PRIORITY_MAX));
+
+  if (event->priority >= 0) {
+    return;
+  }
+
+  TAILQ_INSERT_TAIL(&sched->runqs[priority], event, event_lc);
+  event->priority = priority;
+  sched->nrunnable++;
+  if (++sched->nqueued[priority] > sched->max_queued[priority]) {
+    sched->max_queued[priority] = sched->nqueued[priority];
+  }
+}
+
+void fl_sched_event_cancel(fl_sched_event_t *event)
+{
+  fl_sched_t *sched = &fl_sched;
+
+  if (event->priority < 0) {
+    return;
+  }
+
+  TAILQ_REMOVE(&sched->runqs[event->priority], event, event_lc);
+  sched->nqueued[event->priority]--;
+  sched->nrunnable--;
+  event->priority = -1;
+}
+
+u_int32_t fl_sched_runnable(void)
+{
+  return fl_sched.nrunnable;
+}
+
+/* Take the first event of a run queue and dispatch it. The event is off the
+ * run queue when its method is invoked, so the method can queue it again.
+ */
+static void fl_sched_dispatch(fl_sched_t *sched, int priority)
+{
+  fl_sched_event_t *event = TAILQ_FIRST(&sched->runqs[priority]);
+
+  fl_sched_event_cancel(event);
+  sched->ndispatched[priority]++;
+  event->method(event);
+}
+
+u_int32_t fl_sched_run(void)
+{
+  fl_sched_cfg_t *cfg = &fl_sched_config;
+  fl_sched_t *sched = &fl_sched;
+  u_int32_t nrun = 0;
+  int p;
+
+  while (sched->nrunnable && (nrun < cfg->budget)) {
+    if (cfg->policy == FL_SCHED_WEIGHTED) {
+      p = sched->wrr_priority;
+      if (!sched->wrr_credit || !sched->nqueued[p]) {
+        sched->wrr_priority = (p + 1) % FL_SCHED_PRIORITY_MAX;
+        sched->wrr_credit = cfg->weights[sched->wrr_priority];
+        continue;
+      }
+      sched->wrr_credit--;
+    } else {
+      p = FL_SCHED_PRIORITY_HIGH;
+      while (!sched->nqueued[p]) {
+        p++;
+      }
+    }
+
+    fl_sched_dispatch(sched, p);
+    nrun++;
+  }
+
+  if (nrun) {
+    sched->nruns++;
+    if (sched->nrunnable) {
+      sched->nexhausted++;
+    }
+  }
+
+  return nrun;
+}
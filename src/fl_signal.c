@@ -30,14 +30,46 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *******************************************************************************/
 
+#include <sys/signalfd.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "falco/fl_stdlib.h"
 #include "falco/fl_tracevalue.h"
 #include "falco/fl_logr.h"
+#include "falco/fl_fds.h"
 #include "falco/fl_signal.h"
 
+#define FL_SIGNALFD_READ_BATCH 16
+
+/**
+ * @brief State of loop delivered signals.
+ */
+typedef struct fl_signalfd_t_ {
+  int fd;
+  int registered;            ///< fd has been added to the loop
+  sigset_t mask;
+  fl_signal_handler_t handlers[NSIG];
+  u_int64_t nwakeups;
+  u_int64_t ndispatched;
+} fl_signalfd_t;
+
+static fl_signal_delivery_e fl_signal_delivery = FL_SIGNAL_DELIVERY_ASYNC;
+static int fl_signal_module_initialized;
+static fl_signalfd_t fl_signalfd = { .fd = -1 };
+
+static const values_t fl_signal_deliveries[] = {
+  { FL_SIGNAL_DELIVERY_ASYNC, "Asynchronous (sigaction)" },
+  { FL_SIGNAL_DELIVERY_LOOP,  "Event loop (signalfd)"    },
+  { 0, NULL }
+};
+
+static int fl_signalfd_add(int signum, fl_signal_handler_t sighandler);
+static int fl_signalfd_remove(int signum);
+static void fl_signalfd_register(void);
+
 const values_t fl_signals[] = {
   { SIGHUP,  "Reconfigure"    },
   { SIGABRT, "Abort"          },
@@ -47,9 +79,65 @@ const values_t fl_signals[] = {
   { SIGUSR2, "User 2"         },
   { SIGTSTP, "Stop from TTY", },
   { SIGTTIN, "TTY Input"      },
-  { SIGTTOU, "TTY Output"     }
+  { SIGTTOU, "TTY Output"     },
+  { 0, NULL }
 };
 
+int fl_signal_cfg_delivery(fl_signal_delivery_e delivery)
+{
+  if ((delivery != FL_SIGNAL_DELIVERY_ASYNC) &&
+      (delivery != FL_SIGNAL_DELIVERY_LOOP)) {
+    FL_LOGR_ERR("Invalid signal delivery (%d) configuration", delivery);
+    return -1;
+  }
+
+  if (fl_signalfd.fd >= 0) {
+    FL_LOGR_ERR("Signal delivery can not be changed after handlers are added");
+    return -1;
+  }
+
+  fl_signal_delivery = delivery;
+  return 0;
+}
+
+int fl_signal_module_init(void)
+{
+  fl_signal_module_initialized = 1;
+  fl_signalfd_register();
+
+  FL_LOGR_INFO("Falco Signal module initialized");
+  return 0;
+}
+
+int fl_signal_module_dump(FILE *fd)
+{
+  fl_signalfd_t *sfd = &fl_signalfd;
+  int signum;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Signals\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "Delivery: %s\n", fl_trace_value(fl_signal_deliveries,
+                                               fl_signal_delivery));
+  if (sfd->fd < 0) {
+    return 0;
+  }
+
+  fprintf(fd, "signalfd: %d, wakeups %llu, signals dispatched %llu\n",
+          sfd->fd, (unsigned long long) sfd->nwakeups,
+          (unsigned long long) sfd->ndispatched);
+  fprintf(fd, "Signals:");
+  for (signum = 1; signum < NSIG; signum++) {
+    if (sfd->handlers[signum]) {
+      fprintf(fd, " %d", signum);
+    }
+  }
+  fprintf(fd, "\n");
+
+  return 0;
+}
+
 int fl_signal_register_handlers(fl_signal_handler_regn_t *sighandler_registrations)
 {
   fl_signal_handler_regn_t *sr;
@@ -67,6 +155,10 @@ int fl_signal_add(int signum, fl_signal_handler_t sighandler)
 {
   struct sigaction act;
 
+  if (fl_signal_delivery == FL_SIGNAL_DELIVERY_LOOP) {
+    return fl_signalfd_add(signum, sighandler);
+  }
+
   (void) memset(&act, 0, sizeof(struct sigaction));
   act.sa_flags = SA_SIGINFO;
   act.sa_sigaction = sighandler;
@@ -86,6 +178,11 @@ int fl_signal_remove(int signum)
 {
   struct sigaction act;
 
+  if ((fl_signalfd.fd >= 0) && (signum > 0) && (signum < NSIG) &&
+      sigismember(&fl_signalfd.mask, signum)) {
+    return fl_signalfd_remove(signum);
+  }
+
   (void) memset(&act, 0, sizeof(struct sigaction));
 
   if (sigaction(signum, &act, NULL) < 0) {
@@ -147,3 +244,148 @@ int fl_signals_unblock(sigset_t *set)
 
   return 0;
 }
+
+void fl_signals_dispatch(int *nfds, fd_set *fds)
+{
+  fl_signalfd_t *sfd = &fl_signalfd;
+  struct signalfd_siginfo ssi[FL_SIGNALFD_READ_BATCH];
+  fl_signal_handler_t sighandler;
+  siginfo_t si;
+  ssize_t rlen;
+  int i, n;
+
+  FL_ASSERT((*nfds) >= 0);
+
+  if ((sfd->fd < 0) || !fl_fd_isready(sfd->fd, FL_FD_OP_READ, fds)) {
+    return;
+  }
+
+  (*nfds)--;
+  fl_fd_clrready(sfd->fd, FL_FD_OP_READ, fds);
+  sfd->nwakeups++;
+
+  for (;;) {
+    rlen = read(sfd->fd, ssi, sizeof(ssi));
+    if (rlen < 0) {
+      int save_errno = errno;
+
+      if (save_errno == EINTR) {
+        continue;
+      }
+      if (save_errno != EAGAIN) {
+        FL_LOGR_ERR("signalfd (%d) read failed, error %d <%s>", sfd->fd,
+                    save_errno, strerror(save_errno));
+      }
+      break;
+    }
+
+    n = rlen / sizeof(struct signalfd_siginfo);
+    for (i = 0; i < n; i++) {
+      /* A handler may remove this (or any other) signal */
+      sighandler = sfd->handlers[ssi[i].ssi_signo];
+      if (!sighandler) {
+        continue;
+      }
+
+      (void) memset(&si, 0, sizeof(si));
+      si.si_signo = ssi[i].ssi_signo;
+      si.si_errno = ssi[i].ssi_errno;
+      si.si_code = ssi[i].ssi_code;
+      si.si_pid = ssi[i].ssi_pid;
+      si.si_uid = ssi[i].ssi_uid;
+      si.si_status = ssi[i].ssi_status;
+      si.si_value.sival_ptr = (void *) (uintptr_t) ssi[i].ssi_ptr;
+
+      sfd->ndispatched++;
+      sighandler(si.si_signo, &si, NULL);
+    }
+
+    if (n < FL_SIGNALFD_READ_BATCH) {
+      break;
+    }
+  }
+}
+
+static void fl_signalfd_register(void)
+{
+  fl_signalfd_t *sfd = &fl_signalfd;
+
+  if (!fl_signal_module_initialized || (sfd->fd < 0) || sfd->registered) {
+    return;
+  }
+
+  fl_fds_set_owner(sfd->fd, FL_FD_OWNER_SIGNAL, sfd);
+  FL_FD_SET(sfd->fd, FL_FD_OP_READ);
+  sfd->registered = 1;
+}
+
+static int fl_signalfd_add(int signum, fl_signal_handler_t sighandler)
+{
+  fl_signalfd_t *sfd = &fl_signalfd;
+  sigset_t set;
+  int fd, save_errno;
+
+  if ((signum <= 0) || (signum >= NSIG) || (signum == SIGKILL) ||
+      (signum == SIGSTOP)) {
+    FL_LOGR_ERR("Unable to add handler for %d(%s), invalid signal",
+                signum, fl_trace_value(fl_signals, signum));
+    return -1;
+  }
+
+  (void) sigemptyset(&set);
+  (void) sigaddset(&set, signum);
+  if (sigprocmask(SIG_BLOCK, &set, NULL) < 0) {
+    save_errno = errno;
+    FL_LOGR_ERR("Unable to block %d(%s), error %d <%s>", signum,
+                fl_trace_value(fl_signals, signum), save_errno,
+                strerror(save_errno));
+    return -1;
+  }
+
+  (void) sigaddset(&sfd->mask, signum);
+  fd = signalfd(sfd->fd, &sfd->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    save_errno = errno;
+    FL_LOGR_ERR("Unable to add %d(%s) to the signalfd, error %d <%s>",
+                signum, fl_trace_value(fl_signals, signum), save_errno,
+                strerror(save_errno));
+    (void) sigdelset(&sfd->mask, signum);
+    (void) sigprocmask(SIG_UNBLOCK, &set, NULL);
+    return -1;
+  }
+  sfd->fd = fd;
+  sfd->handlers[signum] = sighandler;
+  fl_signalfd_register();
+
+  FL_LOGR_DEBUG("Added handler for %d(%s) to signalfd %d",
+                signum, fl_trace_value(fl_signals, signum), fd);
+  return 0;
+}
+
+static int fl_signalfd_remove(int signum)
+{
+  fl_signalfd_t *sfd = &fl_signalfd;
+  sigset_t set;
+  int save_errno;
+
+  (void) sigdelset(&sfd->mask, signum);
+  sfd->handlers[signum] = NULL;
+  if (signalfd(sfd->fd, &sfd->mask, SFD_NONBLOCK | SFD_CLOEXEC) < 0) {
+    save_errno = errno;
+    FL_LOGR_ERR("Unable to remove %d(%s) from the signalfd, error %d <%s>",
+                signum, fl_trace_value(fl_signals, signum), save_errno,
+                strerror(save_errno));
+    return -1;
+  }
+
+  /* A pending signal is now delivered with its default action, as it is
+   * after removing an asynchronous handler.
+   */
+  (void) sigemptyset(&set);
+  (void) sigaddset(&set, signum);
+  (void) sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+  FL_LOGR_DEBUG("Removed handler for %d(%s) from signalfd %d",
+                signum, fl_trace_value(fl_signals, signum), sfd->fd);
+  return 0;
+}
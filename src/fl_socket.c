@@ -30,14 +30,23 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *******************************************************************************/
 
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
+
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "falco/fl_defs.h"
 #include "falco/fl_stdlib.h"
 #include "falco/fl_fds.h"
 #include "falco/fl_task.h"
+#include "falco/fl_timer.h"
+#include "falco/fl_pool.h"
+#include "falco/fl_job.h"
 
 #define SA_CAST(_addr_)  (struct sockaddr *)(_addr_)
 #define SA_CCAST(_addr_) (const struct sockaddr *)(_addr_)
@@ -49,8 +58,37 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
     }                                           \
   } while(0)
 
-static fd_set exec_rbits, exec_wbits, exec_ebits;
-static LIST_HEAD(fl_sockets_, fl_socket_t_) fl_sockets;
+/* Socket operations pending in the scheduler */
+#define FL_SOCKET_SCHED_ACCEPT 0x01
+#define FL_SOCKET_SCHED_READ   0x02
+#define FL_SOCKET_SCHED_WRITE  0x04
+
+static FL_LOOP_LOCAL fd_set exec_rbits, exec_wbits, exec_ebits;
+static FL_LOOP_LOCAL LIST_HEAD(fl_sockets_, fl_socket_t_) fl_sockets;
+/* Spare fd that is given up to accept (and close) connections when the process
+ * runs out of fds. Opened when a socket is set to the high-rate accept mode.
+ */
+static FL_LOOP_LOCAL int fl_socket_reserve_fd = -1;
+/* Socket that fl_socket_generic_nb_recv() is draining, or whose transmit
+ * queue is being flushed. Reset when the socket is closed from one of its
+ * methods, so that the socket is not touched any further.
+ */
+static FL_LOOP_LOCAL fl_socket_t *fl_socket_draining;
+#if (defined(ENABLE_INSTRUMENTATION))
+/* Socket whose method fl_socket_dispatch_op() is running. Reset when the
+ * socket is closed by the method, so that its histograms are not touched.
+ */
+static FL_LOOP_LOCAL fl_socket_t *fl_socket_dispatching;
+#endif /* ENABLE_INSTRUMENTATION */
+static FL_LOOP_LOCAL fl_pool_t *fl_socket_pool;
+static FL_LOOP_LOCAL fl_pool_t *fl_socket_meta_pool;
+static u_int32_t fl_socket_pool_nprewarm;
+
+/* Adaptive busy-poll mode of the loops, and socket level busy polling */
+static u_int32_t fl_socket_busy_poll_max_us;
+static u_int32_t fl_socket_so_busy_poll_us;
+static int fl_socket_so_prefer_busy_poll;
+static FL_LOOP_LOCAL fl_socket_busy_poll_stats_t fl_socket_busy_poll;
 
 static const values_t fl_socket_domains[] = {
   { AF_INET,   "AF_INET"   },
@@ -86,6 +124,9 @@ static const values_t fl_sockoptions[] = {
   { FL_SOCKOPT_RCVTIMEO,            "Recv-Timeout"               },
   { FL_SOCKOPT_RCVWAIT,             "Recv-Wait"                  },
   { FL_SOCKOPT_SNDTIMEO,            "Send-Timeout"               },
+  { FL_SOCKOPT_ACCEPT_BUDGET,       "Accept-Budget"              },
+  { FL_SOCKOPT_REUSEPORT,           "Reuse-Port"                 },
+  { FL_SOCKOPT_PERSISTENT_READ,     "Persistent-Read"            },
   { 0, NULL }
 };
 
@@ -97,6 +138,14 @@ static const values_t fl_sockflags[] = {
   { FL_SOCKF_LISTEN,             "Listen"              },
   { FL_SOCKF_NONBLOCKING,        "Non-Blocking"        },
   { FL_SOCKF_RCVWAIT,            "Recv-Wait"           },
+  { FL_SOCKF_CONNECTING,         "Connecting"          },
+  { FL_SOCKF_TXQ_HIGH,           "TxQ-High"            },
+  { FL_SOCKF_DEFERRED,           "Deferred"            },
+  { FL_SOCKF_LOCAL_ADDR,         "Local-Addr"          },
+  { FL_SOCKF_LOCAL_ADDR_STR,     "Local-Addr-Str"      },
+  { FL_SOCKF_REMOTE_ADDR_STR,    "Remote-Addr-Str"     },
+  { FL_SOCKF_PERSISTENT_READ,    "Persistent-Read"     },
+  { FL_SOCKF_READ_PAUSED,        "Read-Paused"         },
   { 0, NULL }
 };
 
@@ -104,6 +153,50 @@ static fl_socket_t *fl_socket_alloc(fl_task_t *task, const char *name,
                                     int domain, int type, int protocol,
                                     int sockfd);
 static int fl_socket_get_local_addr(fl_socket_t *nflsk);
+static void fl_socket_set_local_addr(fl_socket_t *flsk,
+                                     const struct sockaddr_storage *addr,
+                                     socklen_t addrlen);
+static void fl_socket_format_addr(const fl_socket_t *flsk,
+                                  const struct sockaddr_storage *addr,
+                                  char *dst);
+static int fl_sockaddr_is_wildcard(const struct sockaddr_storage *ss);
+static int fl_socket_accept_one(fl_socket_t *flsk, int peerfd,
+                                const struct sockaddr_storage *addr,
+                                socklen_t addrlen);
+static int fl_socket_accept_reject(fl_socket_t *flsk);
+static void fl_socket_set_remote_addr(fl_socket_t *flsk,
+                                      const struct sockaddr_storage *addr,
+                                      socklen_t addrlen);
+
+static int fl_socket_txq_grow(fl_socket_t *flsk);
+static void fl_socket_txq_flush(fl_socket_t *flsk);
+
+static fl_socket_dgram_batch_t *fl_socket_dgram_batch_alloc(fl_socket_t *flsk,
+                                                            u_int32_t ndgrams,
+                                                            u_int32_t nmsgs);
+static void fl_socket_dgram_batch_free(fl_socket_dgram_batch_t *batch);
+static int fl_socket_tx_batch_grow(fl_socket_t *flsk);
+static void fl_socket_rx_batch_process(fl_socket_t *flsk);
+static void fl_socket_tx_batch_flush(fl_socket_t *flsk);
+
+static u_int64_t fl_socket_now_ns(void);
+static int fl_socket_busy_poll_spin(fd_set *rfds, fd_set *wfds, fd_set *efds);
+static void fl_socket_busy_poll_adapt(u_int64_t block_ns);
+static void fl_socket_set_busy_poll(fl_socket_t *flsk);
+static void fl_socket_want_read(fl_socket_t *flsk);
+static int fl_socket_drain_more(fl_socket_t *flsk, u_int32_t *ndrained);
+
+static void fl_socket_backoff(fl_socket_t *flsk, fl_fd_op_e op, int error);
+static void fl_socket_backoff_timeout(const char *timer_name, void *app_data);
+
+static void fl_socket_nb_connect_end(fl_socket_t *flsk);
+static void fl_socket_nb_connect_complete(fl_socket_t *flsk);
+static void fl_socket_nb_connect_timeout(const char *timer_name,
+                                         void *app_data);
+
+static void fl_socket_dispatch(fl_socket_t *flsk, u_int8_t op);
+static void fl_socket_dispatch_op(fl_socket_t *flsk, u_int8_t op);
+static void fl_socket_sched_dispatch(fl_sched_event_t *event);
 
 static ssize_t fl_socket_recvfrom(fl_socket_t *flsk, void *buf, size_t len,
                                   struct sockaddr_storage *src_addr,
@@ -117,9 +210,61 @@ static ssize_t fl_socket_sendto(fl_socket_t *flsk, const void *buf, size_t len,
 static ssize_t fl_socket_sendmsg(fl_socket_t *flsk, const struct msghdr *msg);
 static ssize_t fl_socket_send(fl_socket_t *flsk, const void *buf, size_t len);
 
+int fl_socket_cfg_prewarm(u_int32_t nsockets)
+{
+  fl_socket_pool_nprewarm = nsockets;
+  if (fl_socket_pool) {
+    return ((fl_pool_prewarm(fl_socket_pool, nsockets) < 0) ||
+            (fl_pool_prewarm(fl_socket_meta_pool, nsockets) < 0)) ? -1 : 0;
+  }
+
+  return 0;
+}
+
+int fl_socket_cfg_busy_poll(u_int32_t max_us)
+{
+  if (max_us > 1000000) {
+    FL_LOGR_ERR("Busy-poll budget (%u us) must not exceed a second", max_us);
+    return -1;
+  }
+
+  fl_socket_busy_poll_max_us = max_us;
+  return 0;
+}
+
+int fl_socket_cfg_sock_busy_poll(u_int32_t busy_poll_us, int prefer)
+{
+  if (busy_poll_us > INT_MAX) {
+    FL_LOGR_ERR("Invalid socket busy poll time (%u us)", busy_poll_us);
+    return -1;
+  }
+
+  fl_socket_so_busy_poll_us = busy_poll_us;
+  fl_socket_so_prefer_busy_poll = (busy_poll_us && prefer);
+  return 0;
+}
+
+void fl_socket_get_busy_poll_stats(fl_socket_busy_poll_stats_t *stats)
+{
+  FL_ASSERT(stats);
+  *stats = fl_socket_busy_poll;
+}
+
 int fl_socket_module_init(void)
 {
   LIST_INIT(&fl_sockets);
+  if (!fl_socket_pool) {
+    /* Sockets are aligned to a cache line, their metadata is kept apart. */
+    fl_socket_pool = fl_pool_create("Socket", sizeof(fl_socket_t),
+                                    FL_SOCKET_CACHELINE_SIZE, 0);
+    fl_socket_meta_pool = fl_pool_create("Socket Metadata",
+                                         sizeof(fl_socket_meta_t), 0, 0);
+    if (!fl_socket_pool || !fl_socket_meta_pool ||
+        (fl_socket_cfg_prewarm(fl_socket_pool_nprewarm) < 0)) {
+      FL_LOGR_ERR("Socket pool creation failed");
+      return -1;
+    }
+  }
 
   FL_LOGR_INFO("Falco Socket module initialized");
   return 0;
@@ -133,6 +278,26 @@ int fl_socket_module_dump(FILE *fd)
   fprintf(fd, "Sockets\n");
   fprintf(fd, "--------------------------------------------------------------------------------\n\n");
 
+  if (fl_socket_busy_poll_max_us) {
+    register fl_socket_busy_poll_stats_t *bp = &fl_socket_busy_poll;
+
+    fprintf(fd, "    Busy poll: budget %u us (max %u us), %llu spins, "
+            "%llu hits, %llu misses, %llu blocks\n", bp->budget_us,
+            fl_socket_busy_poll_max_us, (unsigned long long) bp->nspins,
+            (unsigned long long) bp->nhits, (unsigned long long) bp->nmisses,
+            (unsigned long long) bp->nblocks);
+    fprintf(fd, "    Busy poll: %llu us spinning, %.2f us to a hit on average, "
+            "%llu us blocked\n", (unsigned long long) bp->spin_ns / 1000,
+            (bp->nhits) ? ((double) bp->hit_ns / bp->nhits / 1000) : 0.0,
+            (unsigned long long) bp->block_ns / 1000);
+  }
+  if (fl_socket_so_busy_poll_us) {
+    fprintf(fd, "    Socket busy poll: %u us%s\n\n", fl_socket_so_busy_poll_us,
+            (fl_socket_so_prefer_busy_poll) ? ", preferred" : "");
+  } else if (fl_socket_busy_poll_max_us) {
+    fprintf(fd, "\n");
+  }
+
   if (LIST_EMPTY(&fl_sockets)) {
     fprintf(fd, "    No sockets are currently present\n");
     return 0;
@@ -144,7 +309,7 @@ int fl_socket_module_dump(FILE *fd)
     register int sw = fl_fd_isset(li->sockfd, FL_FD_OP_WRITE);
     register int se = fl_fd_isset(li->sockfd, FL_FD_OP_EXCEPT);
 
-    fprintf(fd, "Name: %s(%d)\n", li->name, li->sockfd);
+    fprintf(fd, "Name: %s(%d)\n", li->meta->name, li->sockfd);
 
     if (li->task) {
       fprintf(fd, "    Task: %s\n", li->task->name);
@@ -156,15 +321,40 @@ int fl_socket_module_dump(FILE *fd)
     if (li->flags) {
       fprintf(fd, "    %s\n", fl_trace_flags(fl_sockflags, li->flags));
     }
-    fprintf(fd, "    Local address: %s, Remote address: %s\n",
-            (strlen(li->local_addr)) ? li->local_addr : "None",
-            (strlen(li->remote_addr)) ? li->remote_addr : "None");
+    {
+      register const char *la = fl_socket_local_addr_str(li);
+      register const char *ra = fl_socket_remote_addr_str(li);
+
+      fprintf(fd, "    Local address: %s, Remote address: %s\n",
+              (*la) ? la : "None", (*ra) ? ra : "None");
+    }
     if (sr || sw || se) {
       fprintf(fd, "    Selected for:                %s%s%s\n",
               (sr) ? "Read " : "",
               (sw) ? "Write " : "",
               (se) ? "Except" : "");
     }
+    if (FL_TEST_BIT(li->flags, FL_SOCKF_LISTEN)) {
+      fprintf(fd, "    Accept budget:     %u, wakeups %llu, accepted %llu, "
+              "rejected %llu, budget exhausted %llu, errors %llu, "
+              "largest burst %u\n", li->accept_budget,
+              (unsigned long long) li->accept_stats.nwakeups,
+              (unsigned long long) li->accept_stats.naccepted,
+              (unsigned long long) li->accept_stats.nrejected,
+              (unsigned long long) li->accept_stats.nexhausted,
+              (unsigned long long) li->accept_stats.nerrors,
+              li->accept_stats.max_burst);
+    }
+    if (li->ndeferrals) {
+      fprintf(fd, "    Deferrals:         %llu, current back-off %u ms\n",
+              (unsigned long long) li->ndeferrals, li->backoff_ms);
+    }
+    fl_hist_dump(fd, "    Accept time:       ",
+                 li->meta->hist[FL_SOCKET_HIST_ACCEPT]);
+    fl_hist_dump(fd, "    Recv time:         ",
+                 li->meta->hist[FL_SOCKET_HIST_RECV]);
+    fl_hist_dump(fd, "    Send time:         ",
+                 li->meta->hist[FL_SOCKET_HIST_SEND]);
     if (li->rbuf) {
       fprintf(fd, "    Read buffer size:  %d bytes\n", (int) li->trbuf_len);
       fprintf(fd, "    Read data length:  %d bytes (current)\n", (int) li->crdata_len);
@@ -173,11 +363,33 @@ int fl_socket_module_dump(FILE *fd)
       fprintf(fd, "    Write buffer size: %d bytes\n", (int) li->twbuf_len);
       fprintf(fd, "    Write data length: %d bytes (current)\n", (int) li->cwdata_len);
     }
+    if (li->rx_batch) {
+      fprintf(fd, "    Receive batch:     %u buffers, %llu calls, "
+              "%llu datagrams, %llu errors\n", li->rx_batch->size,
+              (unsigned long long) li->rx_batch->ncalls,
+              (unsigned long long) li->rx_batch->ndgrams,
+              (unsigned long long) li->rx_batch->nerrors);
+    }
+    if (li->tx_batch) {
+      fprintf(fd, "    Transmit batch:    %u queued, %llu calls, "
+              "%llu datagrams, %llu errors\n", li->tx_batch->count,
+              (unsigned long long) li->tx_batch->ncalls,
+              (unsigned long long) li->tx_batch->ndgrams,
+              (unsigned long long) li->tx_batch->nerrors);
+    }
+    if (li->txq_count || li->txq_high_wm) {
+      fprintf(fd, "    Transmit queue:    %u buffers, %lu bytes "
+              "(watermarks %lu/%lu bytes)\n",
+              li->txq_count, (unsigned long) li->txq_bytes,
+              (unsigned long) li->txq_low_wm, (unsigned long) li->txq_high_wm);
+    }
 
     fprintf(fd, "    accept_method:               %s\n",
             (li->accept_method) ? "yes" : "no");
     fprintf(fd, "    connect_method:              %s\n",
             (li->connect_method) ? "yes" : "no");
+    fprintf(fd, "    connect_error_method:        %s\n",
+            (li->connect_error_method) ? "yes" : "no");
     fprintf(fd, "    connect_complete_method:     %s\n",
             (li->connect_complete_method) ? "yes" : "no");
     fprintf(fd, "    recv_method:                 %s\n",
@@ -283,6 +495,20 @@ u_int16_t fl_sockaddr_port_hbo(const struct sockaddr_storage *ss)
   return 0;
 }
 
+static int fl_sockaddr_is_wildcard(const struct sockaddr_storage *ss)
+{
+  switch(ss->ss_family) {
+  case AF_INET:
+    return (((struct sockaddr_in *)ss)->sin_addr.s_addr == htonl(INADDR_ANY));
+  case AF_INET6:
+    return IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)ss)->sin6_addr);
+  default:
+    break;
+  }
+
+  return 0;
+}
+
 int fl_sockaddr_cmp(const struct sockaddr *sa1, const struct sockaddr *sa2)
 {
   FL_ASSERT(sa1 && sa2);
@@ -340,10 +566,60 @@ int fl_sockaddr_nw_cmp(const struct sockaddr *sa1,
   return -1;
 }
 
+const char *fl_socket_local_addr_str(fl_socket_t *flsk)
+{
+  FL_ASSERT(flsk);
+
+  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR_STR)) {
+    return flsk->meta->local_addr;
+  }
+
+  if (!FL_TEST_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR) &&
+      (!FL_TEST_BIT(flsk->flags, (FL_SOCKF_BOUND_IN | FL_SOCKF_BOUND_IN6 |
+                                  FL_SOCKF_BOUND_UNIX | FL_SOCKF_CONNECTED)) ||
+       (fl_socket_get_local_addr(flsk) < 0))) {
+    return "";
+  }
+
+  fl_socket_format_addr(flsk, &flsk->meta->sa_local, flsk->meta->local_addr);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR_STR);
+  return flsk->meta->local_addr;
+}
+
+const char *fl_socket_remote_addr_str(fl_socket_t *flsk)
+{
+  FL_ASSERT(flsk);
+
+  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_REMOTE_ADDR_STR)) {
+    return flsk->meta->remote_addr;
+  }
+
+  if (flsk->meta->sa_remote.ss_family == AF_UNSPEC) {
+    return "";
+  }
+
+  fl_socket_format_addr(flsk, &flsk->meta->sa_remote, flsk->meta->remote_addr);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_REMOTE_ADDR_STR);
+  return flsk->meta->remote_addr;
+}
+
+int fl_socket_get_hist(const fl_socket_t *flsk, fl_socket_hist_e which,
+                       fl_hist_snapshot_t *snap)
+{
+  if (!flsk || (which < 0) || (which >= FL_SOCKET_HIST_MAX) || !snap) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("Invalid request for a socket histogram (%d)", which);
+    return -1;
+  }
+
+  fl_hist_snapshot(flsk->meta->hist[which], snap);
+  return 0;
+}
+
 fl_socket_t *fl_socket_socket(fl_task_t *task, const char *name,
                               int domain, int type, int protocol)
 {
-  int retries, sockfd, save_errno;
+  int sockfd, save_errno;
   fl_socket_t *flsk;
 
   FL_ASSERT((domain == AF_INET) || (domain == AF_INET6) || (domain == AF_UNIX));
@@ -356,10 +632,13 @@ fl_socket_t *fl_socket_socket(fl_task_t *task, const char *name,
     FL_ASSERT(strlen(name) < FL_SOCKET_NAME_MAX_LEN);
   }
 
-  retries = 3;
-  while (((sockfd = socket(domain, type, protocol)) < 0) && retries--) {
-    save_errno = errno;
+  /* Running out of resources is not waited upon here, that would stall the
+   * loop. The error is returned to the application, which can retry later.
+   */
+  while (((sockfd = socket(domain, type, protocol)) < 0) && (errno == EINTR));
 
+  if (sockfd < 0) {
+    save_errno = errno;
     FL_LOGR_ERR("Socket creation for %s%s%s domain %s(%d), type %s(%d), "
                 "protocol %s(%d) failed, error %d <%s>",
                 (name) ? "\"" : "", (name) ? name : "", (name) ? "\", " : "",
@@ -367,20 +646,7 @@ fl_socket_t *fl_socket_socket(fl_task_t *task, const char *name,
                 fl_trace_value(fl_socket_types, type), type,
                 fl_trace_value(fl_socket_protocols, protocol), protocol,
                 save_errno, strerror(save_errno));
-
-    if (save_errno == EINTR) {
-      retries++;
-      continue;
-    } else if ((save_errno == EMFILE) || (save_errno == ENFILE) ||
-               (save_errno == ENOBUFS) || (save_errno == ENOMEM)) {
-      /* Let us wait to see if any resources will get freed in the system. */
-      sleep(3);
-    } else {
-      break;
-    }
-  }
-
-  if (sockfd < 0) {
+    errno = save_errno;
     return NULL;
   }
 
@@ -392,8 +658,6 @@ fl_socket_t *fl_socket_socket(fl_task_t *task, const char *name,
     return NULL;
   }
 
-  fl_fds_set_max_fd(sockfd);
-
   return flsk;
 }
 
@@ -408,7 +672,7 @@ int fl_socket_setsockopt(fl_socket_t *flsk, fl_sockoption_e option, ...)
 
   sockfd = flsk->sockfd;
   FL_LOGR_DEBUG("Set socket (%s, %d) option %s(%d)",
-                flsk->name, sockfd,
+                flsk->meta->name, sockfd,
                 fl_trace_value(fl_sockoptions, option), option);
 
   va_start(vargs, option);
@@ -450,6 +714,65 @@ int fl_socket_setsockopt(fl_socket_t *flsk, fl_sockoption_e option, ...)
     }
     break;
 
+  case FL_SOCKOPT_ACCEPT_BUDGET:
+    {
+      int budget = va_arg(vargs, int);
+
+      if (budget < 0) {
+        rc = -1;
+        errno = EINVAL;
+        break;
+      }
+
+      /* accept4() is called until the backlog is drained, the listening
+       * socket must not block. A budget of 0 leaves the blocking mode of the
+       * socket as it is.
+       */
+      if (budget > 0) {
+        intv = 1;
+        rc = ioctl(sockfd, (unsigned long) FIONBIO, (char *) &intv,
+                   sizeof(intv));
+        if (rc < 0) {
+          break;
+        }
+        FL_SET_BIT(flsk->flags, FL_SOCKF_NONBLOCKING);
+      }
+      flsk->accept_budget = budget;
+
+      if (budget && (fl_socket_reserve_fd < 0)) {
+        fl_socket_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (fl_socket_reserve_fd < 0) {
+          FL_LOGR_WARNING("Could not reserve a file descriptor for accept, "
+                          "error %d <%s>", errno, strerror(errno));
+        }
+      }
+    }
+    break;
+
+  case FL_SOCKOPT_REUSEPORT:
+    {
+      intv = va_arg(vargs, int);
+      rc = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &intv, sizeof(intv));
+    }
+    break;
+
+  case FL_SOCKOPT_PERSISTENT_READ:
+    {
+      intv = va_arg(vargs, int);
+      if (intv && !FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
+        rc = -1;
+        errno = EINVAL;
+        break;
+      }
+
+      if (intv) {
+        FL_SET_BIT(flsk->flags, FL_SOCKF_PERSISTENT_READ);
+      } else {
+        FL_RESET_BIT(flsk->flags, FL_SOCKF_PERSISTENT_READ);
+      }
+    }
+    break;
+
   default:
     rc = -1;
     errno = EINVAL;
@@ -457,7 +780,7 @@ int fl_socket_setsockopt(fl_socket_t *flsk, fl_sockoption_e option, ...)
 
   if (rc < 0) {
     FL_LOGR_WARNING("Set socket (%s, %d) option %s(%d) failed, error %d <%s>",
-                    flsk->name, flsk->sockfd,
+                    flsk->meta->name, flsk->sockfd,
                     fl_trace_value(fl_sockoptions, option), option,
                     errno, strerror(errno));
   }
@@ -479,6 +802,18 @@ void fl_socket_set_connect_complete_method(fl_socket_t *flsk, fl_socket_connect_
   flsk->connect_complete_method = connect_complete_method;
 }
 
+void fl_socket_set_deferred_method(fl_socket_t *flsk, fl_socket_deferred_method_t deferred_method)
+{
+  FL_ASSERT(flsk);
+  flsk->deferred_method = deferred_method;
+}
+
+void fl_socket_set_connect_error_method(fl_socket_t *flsk, fl_socket_connect_error_method_t connect_error_method)
+{
+  FL_ASSERT(flsk);
+  flsk->connect_error_method = connect_error_method;
+}
+
 void fl_socket_set_recv_method(fl_socket_t *flsk,
                                fl_socket_recv_method_t recv_method)
 {
@@ -535,6 +870,144 @@ void fl_socket_set_send_error_method(fl_socket_t *flsk, fl_socket_send_error_met
   flsk->send_error_method = send_error_method;
 }
 
+void fl_socket_set_send_batch_complete_method(fl_socket_t *flsk, fl_socket_dgram_batch_method_t send_batch_complete_method)
+{
+  FL_ASSERT(flsk);
+  flsk->send_batch_complete_method = send_batch_complete_method;
+}
+
+int fl_socket_offload(fl_socket_t *flsk, fl_work_method_t method,
+                      fl_work_done_method_t done_method, void *app_data)
+{
+  fl_socket_meta_t *meta;
+
+  FL_ASSERT(flsk);
+  meta = flsk->meta;
+
+  if (!meta->strand) {
+    meta->strand = fl_work_strand_create();
+    if (!meta->strand) {
+      return -1;
+    }
+  }
+
+  if (!fl_work_submit(meta->strand, flsk, method, done_method, app_data)) {
+    FL_LOGR_ERR("Offload of work of socket (%s, %d) failed",
+                meta->name, flsk->sockfd);
+    return -1;
+  }
+
+  return 0;
+}
+
+void fl_socket_set_txq_buf_complete_method(fl_socket_t *flsk, fl_socket_txq_buf_complete_method_t txq_buf_complete_method)
+{
+  FL_ASSERT(flsk);
+  flsk->txq_buf_complete_method = txq_buf_complete_method;
+}
+
+void fl_socket_set_txq_watermarks(fl_socket_t *flsk,
+                                  size_t low_wm, size_t high_wm,
+                                  fl_socket_txq_watermark_method_t high_method,
+                                  fl_socket_txq_watermark_method_t low_method)
+{
+  FL_ASSERT(flsk);
+  FL_ASSERT(!high_wm || (low_wm < high_wm));
+
+  flsk->txq_low_wm = low_wm;
+  flsk->txq_high_wm = high_wm;
+  flsk->txq_high_method = high_method;
+  flsk->txq_low_method = low_method;
+}
+
+int fl_socket_close(fl_socket_t *flsk)
+{
+  register fl_task_t *task;
+  int sockfd, rc, save_errno = 0;
+  register int h;
+
+  if (!flsk) {
+    FL_ASSERT(flsk);
+    FL_LOGR_ERR("Request to close an invalid socket");
+    return -1;
+  }
+
+  task = flsk->task;
+  sockfd = flsk->sockfd;
+
+  /* Stop watching the sockfd, also in the current set of ready fds, so that
+   * it is not processed any further in this loop.
+   */
+  if (fl_fd_isset(sockfd, FL_FD_OP_READ)) {
+    FL_FD_CLR(sockfd, FL_FD_OP_READ);
+  }
+  if (fl_fd_isset(sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_CLR(sockfd, FL_FD_OP_WRITE);
+  }
+  if (fl_fd_isset(sockfd, FL_FD_OP_EXCEPT)) {
+    FL_FD_CLR(sockfd, FL_FD_OP_EXCEPT);
+  }
+  fl_fd_clrready(sockfd, FL_FD_OP_READ, &exec_rbits);
+  fl_fd_clrready(sockfd, FL_FD_OP_WRITE, &exec_wbits);
+  fl_fd_clrready(sockfd, FL_FD_OP_EXCEPT, &exec_ebits);
+  fl_fds_set_owner(sockfd, FL_FD_OWNER_NONE, NULL);
+  fl_sched_event_cancel(&flsk->sched_event);
+  flsk->sched_ops = 0;
+  if (fl_socket_draining == flsk) {
+    fl_socket_draining = NULL;
+  }
+#if (defined(ENABLE_INSTRUMENTATION))
+  if (fl_socket_dispatching == flsk) {
+    fl_socket_dispatching = NULL;
+  }
+#endif /* ENABLE_INSTRUMENTATION */
+
+  if (flsk->meta->strand) {
+    fl_work_strand_close(flsk->meta->strand);
+  }
+  if (flsk->connect_timer) {
+    (void) fl_timer_delete(flsk->connect_timer);
+  }
+  if (flsk->backoff_timer) {
+    (void) fl_timer_delete(flsk->backoff_timer);
+  }
+  if (flsk->txq) {
+    FL_FREE(flsk->txq, "Socket Transmit Queue");
+  }
+  if (flsk->rx_batch) {
+    fl_socket_dgram_batch_free(flsk->rx_batch);
+  }
+  if (flsk->tx_batch) {
+    fl_socket_dgram_batch_free(flsk->tx_batch);
+  }
+
+  LIST_REMOVE(flsk, socket_lc);
+  if (task) {
+    LIST_REMOVE(flsk, task_socket_lc);
+  }
+
+  rc = close(sockfd);
+  if (rc < 0) {
+    save_errno = errno;
+    FL_LOGR_ERR("Close of socket (%s, %s, %d) failed, error %d <%s>",
+                (task) ? task->name : "", flsk->meta->name, sockfd,
+                save_errno, strerror(save_errno));
+  } else {
+    FL_LOGR_DEBUG("Closed socket (%s, %s, %d)",
+                  (task) ? task->name : "", flsk->meta->name, sockfd);
+  }
+
+  for (h = 0; h < FL_SOCKET_HIST_MAX; h++) {
+    if (flsk->meta->hist[h]) {
+      fl_hist_delete(flsk->meta->hist[h]);
+    }
+  }
+  FL_POOL_FREE(fl_socket_meta_pool, flsk->meta, "Socket Metadata");
+  FL_POOL_FREE(fl_socket_pool, flsk, "Socket");
+  errno = save_errno;
+  return rc;
+}
+
 int fl_socket_bind(fl_socket_t *flsk,
                    const struct sockaddr_storage *addr, socklen_t addrlen)
 {
@@ -549,20 +1022,22 @@ int fl_socket_bind(fl_socket_t *flsk,
   if (rc < 0) {
     int save_errno = errno;
     FL_LOGR_ERR("Socket (%s, %s, %d) bind to %s:%d failed, error %d <%s>",
-                (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                 fl_sockaddr_ntop(addr, addrstr, INET6_ADDRSTRLEN),
                 fl_sockaddr_port_hbo(addr), save_errno, strerror(save_errno));
     return -1;
   }
 
-  (void) fl_sockaddr_ntop(addr, flsk->local_addr, FL_SOCKADDR_STR_MAX_LEN);
+  if ((flsk->domain == AF_UNIX) || fl_sockaddr_port_hbo(addr)) {
+    fl_socket_set_local_addr(flsk, addr, addrlen);
+  } /* else, the port is chosen by the kernel */
   FL_SET_BIT(flsk->flags,
              (flsk->domain == AF_INET)  ? FL_SOCKF_BOUND_IN  :
              (flsk->domain == AF_INET6) ? FL_SOCKF_BOUND_IN6 :
              FL_SOCKF_BOUND_UNIX);
 
   FL_LOGR_INFO("Socket (%s, %s, %d) bound to %s:%d",
-               (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+               (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                fl_sockaddr_ntop(addr, addrstr, INET6_ADDRSTRLEN),
                fl_sockaddr_port_hbo(addr));
   return 0;
@@ -584,15 +1059,16 @@ int fl_socket_listen(fl_socket_t *flsk, int backlog)
     int save_errno = errno;
     FL_LOGR_ERR("Listen on socket (%s, %s, %d) (with backlog %d) failed, "
                 "error %d <%s>",
-                (task) ? task->name : "", flsk->name, flsk->sockfd, backlog,
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd, backlog,
                 save_errno, strerror(save_errno));
     return(rc);
   }
 
+  FL_SET_BIT(flsk->flags, FL_SOCKF_LISTEN);
   FL_FD_SET(flsk->sockfd, FL_FD_OP_ACCEPT);
 
   FL_LOGR_ERR("Socket (%s, %s, %d) is now to set to listen <%s>",
-              (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+              (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
               fl_trace_flags(fl_sockflags, flsk->flags));
   return(0);
 }
@@ -601,89 +1077,97 @@ void fl_socket_generic_accept(fl_socket_t *flsk)
 {
   register fl_task_t *task = flsk->task;
   struct sockaddr_storage addr;
-  socklen_t addrlen = sizeof(addr);
-  int peerfd, save_errno, retries;
-  fl_socket_t *nflsk;
-  char addrstr[INET6_ADDRSTRLEN+1] = { 0 };
+  socklen_t addrlen;
+  int peerfd, save_errno = 0;
+  u_int32_t budget, naccepted = 0;
 
   FL_LOGR_DEBUG("Process accept on socket (%s, %s, %d)",
-                (task) ? task->name : "", flsk->name, flsk->sockfd);
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
   FL_ASSERT(flsk->connect_complete_method);
 
-  retries = 3;
-  while (((peerfd = accept(flsk->sockfd, (struct sockaddr *)&addr,
-                           &addrlen)) < 0) &&
-         retries--) {
-    save_errno = errno;
-
-    FL_LOGR_ERR("accept() on socket (%s, %s, %d) failed, error %d <%s>",
-                (task) ? task->name : "", flsk->name, flsk->sockfd,
-                save_errno, strerror(save_errno));
+  budget = (flsk->accept_budget) ? flsk->accept_budget : 1;
+  flsk->accept_stats.nwakeups++;
 
-    if (save_errno == EINTR) {
-      retries++;
-      continue;
-    } else if ((save_errno == EMFILE) || (save_errno == ENFILE) ||
-               (save_errno == ENOBUFS) || (save_errno == ENOMEM)) {
-      /* Let us wait to see if any resources will get freed in the system. */
-      sleep(3);
+  while (naccepted < budget) {
+    addrlen = sizeof(addr);
+    if (flsk->accept_budget) {
+      peerfd = accept4(flsk->sockfd, SA_CAST(&addr), &addrlen,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
     } else {
-      break;
+      peerfd = accept(flsk->sockfd, SA_CAST(&addr), &addrlen);
     }
-  }
 
-  if (peerfd < 0) {
-    if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK) ||
-        (save_errno == ECONNABORTED)) {
-      /* We will set the fd again so that we can come back to this later. */
-      FL_FD_SET(flsk->sockfd, FL_FD_OP_ACCEPT);
-      return;
-    }
+    if (peerfd < 0) {
+      save_errno = errno;
 
-    FL_LOGR_CRIT("accept() on socket (%s, %s, %d) failed, "
-                 "irrecoverable error %d <%s>. This socket shall not be "
-                 "processed further.",
-                 (task) ? task->name : "", flsk->name, flsk->sockfd,
-                 save_errno, strerror(save_errno));
-    return;
-  }
+      if (save_errno == EINTR) {
+        continue;
+      }
+      if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (save_errno == ECONNABORTED) {
+        if (flsk->accept_budget) {
+          continue;
+        }
+        break;
+      }
 
-  fl_fds_set_max_fd(peerfd);
+      flsk->accept_stats.nerrors++;
+      if (((save_errno == EMFILE) || (save_errno == ENFILE)) &&
+          flsk->accept_budget && (fl_socket_reserve_fd >= 0)) {
+        if (fl_socket_accept_reject(flsk) == 0) {
+          /* The connection has been taken off the backlog and closed, carry
+           * on with the rest of the backlog.
+           */
+          naccepted++;
+          continue;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+          break;
+        }
+      }
 
-  /* Set the fd again so that we can process other incoming connections */
-  FL_FD_SET(flsk->sockfd, FL_FD_OP_ACCEPT);
+      FL_LOGR_ERR("accept() on socket (%s, %s, %d) failed, error %d <%s>",
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                  save_errno, strerror(save_errno));
 
-  nflsk = fl_socket_alloc(task, "", flsk->domain, flsk->type, flsk->protocol,
-                          peerfd);
-  if (!nflsk || (fl_socket_get_local_addr(nflsk) < 0)) {
-    FL_LOGR_ERR("Closing connection from %s:%d on socket (%s, %s, %d)",
-                fl_sockaddr_ntop(&addr, addrstr, INET6_ADDRSTRLEN),
-                fl_sockaddr_port_hbo(&addr),
-                (task) ? task->name : "", "", peerfd);
-    (void) close(peerfd);
-    return;
-  }
+      if ((save_errno == EMFILE) || (save_errno == ENFILE) ||
+          (save_errno == ENOBUFS) || (save_errno == ENOMEM)) {
+        /* Resources may get freed in the system. Accepting is parked, and
+         * retried after a back-off.
+         */
+        fl_socket_backoff(flsk, FL_FD_OP_ACCEPT, save_errno);
+        return;
+      }
 
-  fl_sockaddr_dup(&nflsk->sa_remote, &addr, addrlen);
-  memset(flsk->remote_addr, 0, FL_SOCKADDR_STR_MAX_LEN);
-  if (((flsk->domain == AF_INET) || (flsk->domain == AF_INET6)) &&
-      ((flsk->type == SOCK_DGRAM) || (flsk->type == SOCK_SEQPACKET) ||
-       (flsk->type == SOCK_STREAM))) {
-    sprintf(flsk->remote_addr, "%s:%d",
-            fl_sockaddr_ntop(&flsk->sa_remote, flsk->remote_addr,
-                             FL_SOCKADDR_STR_MAX_LEN - 1),
-            fl_sockaddr_port_hbo(&flsk->sa_remote));
-  } else {
-    sprintf(flsk->remote_addr, "%s",
-            fl_sockaddr_ntop(&flsk->sa_remote, flsk->remote_addr,
-                             FL_SOCKADDR_STR_MAX_LEN - 1));
+      FL_LOGR_CRIT("accept() on socket (%s, %s, %d) failed, "
+                   "irrecoverable error %d <%s>. This socket shall not be "
+                   "processed further.",
+                   (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                   save_errno, strerror(save_errno));
+      return;
+    }
+
+    naccepted++;
+    flsk->backoff_ms = 0;
+    /* File descriptors are available again, restore a lost reserve. */
+    if (flsk->accept_budget && (fl_socket_reserve_fd < 0)) {
+      fl_socket_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    (void) fl_socket_accept_one(flsk, peerfd, &addr, addrlen);
   }
 
-  FL_LOGR_INFO("Accepted connection %s -> %s on socket (%s, %s, %d)",
-               nflsk->local_addr, nflsk->remote_addr,
-               (task) ? task->name : "", "", peerfd);
+  if (naccepted > flsk->accept_stats.max_burst) {
+    flsk->accept_stats.max_burst = naccepted;
+  }
+  if (flsk->accept_budget && (naccepted == budget)) {
+    /* More connections may be pending, they are accepted in the next loop. */
+    flsk->accept_stats.nexhausted++;
+  }
 
-  flsk->connect_complete_method(nflsk);
+  /* Set the fd again so that we can process other incoming connections */
+  FL_FD_SET(flsk->sockfd, FL_FD_OP_ACCEPT);
 }
 
 int fl_socket_generic_connect(fl_socket_t *flsk,
@@ -715,57 +1199,122 @@ int fl_socket_generic_connect(fl_socket_t *flsk,
                 "error %d <%s>",
                 fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)),
                 fl_sockaddr_port_hbo(addr),
-                (task) ? task->name : "", flsk->name, flsk->sockfd,
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
                 save_errno, strerror(save_errno));
     return rc;
   }
 
-  if (fl_socket_get_local_addr(flsk) < 0) {
-    FL_LOGR_ERR("Closing connection to %s:%d on socket (%s, %s, %d)",
-                fl_sockaddr_ntop(addr, addrstr, INET6_ADDRSTRLEN),
-                fl_sockaddr_port_hbo(addr),
-                (task) ? task->name : "", flsk->name, flsk->sockfd);
-    (void) close(flsk->sockfd);
-    return -1;
-  }
-
-  fl_sockaddr_dup(&flsk->sa_remote, addr, addrlen);
-  memset(flsk->remote_addr, 0, FL_SOCKADDR_STR_MAX_LEN);
-  sprintf(flsk->remote_addr, "%s:%d",
-          fl_sockaddr_ntop(&flsk->sa_remote, flsk->remote_addr,
-                           FL_SOCKADDR_STR_MAX_LEN - 1),
-          fl_sockaddr_port_hbo(&flsk->sa_remote));
+  /* The local address is fetched when it is needed. */
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR | FL_SOCKF_LOCAL_ADDR_STR);
+  fl_socket_set_remote_addr(flsk, addr, addrlen);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_CONNECTED);
 
-  FL_LOGR_ERR("Connected from %s -> %s on socket (%s, %s, %d)",
-              flsk->local_addr, flsk->remote_addr,
-              (task) ? task->name : "", flsk->name, flsk->sockfd);
+  FL_LOGR_DEBUG("Connected from %s -> %s on socket (%s, %s, %d)",
+                fl_socket_local_addr_str(flsk), fl_socket_remote_addr_str(flsk),
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
   return 0;
 }
 
-ssize_t fl_socket_generic_recv(fl_socket_t *flsk, void *buf, size_t len,
-                               struct sockaddr_storage *src_addr,
-                               socklen_t *addrlen)
+int fl_socket_generic_nb_connect(fl_socket_t *flsk,
+                                 const struct sockaddr_storage *addr,
+                                 socklen_t addrlen, u_int32_t timeout_ms)
 {
+  fl_task_t *task;
+  int rc, save_errno;
+  char addrstr[FL_SOCKADDR_STR_MAX_LEN] = { 0 };
+  char timer_name[FL_TIMER_NAME_MAX_LEN];
 
-  FL_ASSERT(flsk && buf && len);
-  /* There can be only one outstanding recv buffer (for now) */
-  FL_ASSERT(!flsk->rbuf && !flsk->trbuf_len && !flsk->crdata_len);
-  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
-    FL_ASSERT(flsk->nb_recv_method && flsk->recv_complete_method &&
-              flsk->recv_error_method);
-  }
-  if (flsk->type == SOCK_STREAM) {
+  FL_ASSERT(flsk &&
+            ((flsk->type == SOCK_SEQPACKET) || (flsk->type == SOCK_STREAM)));
+  FL_ASSERT(addr && addrlen);
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING));
+  FL_ASSERT(!FL_TEST_BIT(flsk->flags,
+                         FL_SOCKF_CONNECTED | FL_SOCKF_CONNECTING));
+  FL_ASSERT(flsk->connect_complete_method && flsk->connect_error_method);
+
+  task = flsk->task;
+
+  /* An interrupted non-blocking connect() carries on asynchronously, just
+   * like one that is in progress. Its outcome is known from the sockfd
+   * becoming writable.
+   */
+  rc = connect(flsk->sockfd, SA_CCAST(addr), addrlen);
+  save_errno = errno;
+  if ((rc < 0) && (save_errno != EINPROGRESS) && (save_errno != EINTR)) {
+    FL_LOGR_ERR("Attempt to connect to %s:%d on socket (%s, %s, %d) failed, "
+                "error %d <%s>",
+                fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)),
+                fl_sockaddr_port_hbo(addr),
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                save_errno, strerror(save_errno));
+    return -1;
+  }
+
+  if (timeout_ms) {
+    (void) snprintf(timer_name, sizeof(timer_name), "Connect(%d)",
+                    flsk->sockfd);
+    flsk->connect_timer = fl_timer_create_ms(task, timeout_ms, 0,
+                                             fl_socket_nb_connect_timeout,
+                                             timer_name, flsk);
+    if (!flsk->connect_timer ||
+        (fl_timer_start(flsk->connect_timer, NULL) < 0)) {
+      FL_LOGR_ERR("Attempt to connect to %s:%d on socket (%s, %s, %d) failed, "
+                  "could not start the connect timer",
+                  fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)),
+                  fl_sockaddr_port_hbo(addr),
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
+      if (flsk->connect_timer) {
+        (void) fl_timer_delete(flsk->connect_timer);
+        flsk->connect_timer = NULL;
+      }
+      return -1;
+    }
+  }
+
+  fl_socket_set_remote_addr(flsk, addr, addrlen);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_CONNECTING);
+
+  /* The outcome, even of a connect() that has completed right away, is
+   * delivered from fl_socket_process_writes().
+   */
+  FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
+
+  FL_LOGR_DEBUG("Connecting to %s:%d on socket (%s, %s, %d), timeout %u ms",
+                fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)),
+                fl_sockaddr_port_hbo(addr),
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                timeout_ms);
+  return 0;
+}
+
+ssize_t fl_socket_generic_recv(fl_socket_t *flsk, void *buf, size_t len,
+                               struct sockaddr_storage *src_addr,
+                               socklen_t *addrlen)
+{
+
+  FL_ASSERT(flsk && buf && len);
+  /* There can be only one outstanding recv buffer (for now). In persistent
+   * read mode, the buffer stays posted, and can be replaced between messages.
+   */
+  FL_ASSERT((!flsk->rbuf && !flsk->trbuf_len && !flsk->crdata_len) ||
+            FL_TEST_BIT(flsk->flags, FL_SOCKF_PERSISTENT_READ));
+  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
+    FL_ASSERT(flsk->nb_recv_method && flsk->recv_complete_method &&
+              flsk->recv_error_method);
+  }
+  if (flsk->type == SOCK_STREAM) {
     FL_ASSERT(flsk->recv_is_msg_complete_method);
   }
 
   flsk->rbuf = buf;
   flsk->trbuf_len = len;
+  flsk->crdata_len = 0;
 
   if (FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
-    /* We will set the fd for writing and return. The process_sockets shall take
-     * care of calling the non-blocking send routine.
+    /* We will set the fd for reading and return. The process_sockets shall
+     * take care of calling the non-blocking recv routine.
      */
-    FL_FD_SET(flsk->sockfd, FL_FD_OP_READ);
+    fl_socket_want_read(flsk);
     return 0;
   }
 
@@ -787,12 +1336,20 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
   ssize_t rlen;
   int retries = 3, save_errno;
   socklen_t addrlen;
+  u_int32_t ndrained = 0;
 
   FL_ASSERT(flsk);
   task = flsk->task;
 
+  fl_socket_draining = flsk;
+  if (flsk->rx_batch) {
+    fl_socket_rx_batch_process(flsk);
+    return;
+  }
+
   if ((flsk->type == SOCK_DGRAM) || (flsk->type == SOCK_RAW)) {
-    addrlen = sizeof(flsk->rbuf_src_addr);
+  next_dgram:
+    addrlen = sizeof(flsk->meta->rbuf_src_addr);
 
     while (retries > 0) {
       if (flsk->type == SOCK_DGRAM) {
@@ -800,7 +1357,7 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
                         flsk->trbuf_len,
                         FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING) ?
                         MSG_DONTWAIT : 0,
-                        SA_CAST(&flsk->rbuf_src_addr), &addrlen);
+                        SA_CAST(&flsk->meta->rbuf_src_addr), &addrlen);
       } else {
         rlen = recvmsg(flsk->sockfd, (struct msghdr *) flsk->rbuf,
                        FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING) ?
@@ -821,21 +1378,24 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
         continue;
       }
       if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
-        FL_FD_SET(flsk->sockfd, FL_FD_OP_READ);
+        fl_socket_want_read(flsk);
         return;
       }
 
       FL_LOGR_ERR("NBRx on socket (%s, %s, %d) failed, error %d <%s>. "
                   "recv shall not be attempted on this socket.",
-                  (task) ? task->name : "", flsk->name, flsk->sockfd,
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
                   save_errno, strerror(save_errno));
       flsk->recv_error_method(flsk);
       return;
     }
 
     FL_LOGR_DEBUG("Received %d bytes on socket (%s, %s, %d)", (int)rlen,
-                  (task) ? task->name : "", flsk->name, flsk->sockfd);
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
     flsk->recv_complete_method(flsk);
+    if (fl_socket_drain_more(flsk, &ndrained)) {
+      goto next_dgram;
+    }
     return;
   }
 
@@ -847,7 +1407,7 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
 
     if (rlen == 0) {
       FL_LOGR_ERR("Detected connection close on socket (%s, %s, %d)",
-                  (task) ? task->name : "", flsk->name, flsk->sockfd);
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
       flsk->recv_error_method(flsk);
       return;
     }
@@ -860,13 +1420,13 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
         continue;
       }
       if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
-        FL_FD_SET(flsk->sockfd, FL_FD_OP_READ);
+        fl_socket_want_read(flsk);
         return;
       }
 
       FL_LOGR_ERR("Rx on socket (%s, %s, %d) failed, error %d <%s>. "
                   "Send shall not be attempted on this socket.",
-                  (task) ? task->name : "", flsk->name, flsk->sockfd,
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
                   save_errno, strerror(save_errno));
       flsk->recv_error_method(flsk);
       return;
@@ -876,7 +1436,16 @@ void fl_socket_generic_nb_recv(fl_socket_t *flsk)
     flsk->crdata_len += rlen;
     if (flsk->recv_is_msg_complete_method(flsk)) {
       flsk->recv_complete_method(flsk);
-      return;
+      if ((fl_socket_draining != flsk) ||
+          !FL_TEST_BIT(flsk->flags, FL_SOCKF_PERSISTENT_READ)) {
+        return;
+      }
+
+      /* The next message is received into the same buffer. */
+      flsk->crdata_len = 0;
+      if (!fl_socket_drain_more(flsk, &ndrained)) {
+        return;
+      }
     }
 
     retries = 3;
@@ -890,8 +1459,11 @@ ssize_t fl_socket_generic_send(fl_socket_t *flsk, void *buf, size_t len,
 {
 
   FL_ASSERT(flsk && buf && len);
-  /* There can be only one outstanding send buffer (for now) */
+  /* There can be only one outstanding send buffer. Use the transmit queue
+   * (fl_socket_txq_append()) for more.
+   */
   FL_ASSERT(!flsk->wbuf && !flsk->twbuf_len && !flsk->cwdata_len);
+  FL_ASSERT(!flsk->txq_count);
   if (FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
     FL_ASSERT(flsk->nb_send_method && flsk->send_complete_method &&
               flsk->send_error_method);
@@ -905,7 +1477,7 @@ ssize_t fl_socket_generic_send(fl_socket_t *flsk, void *buf, size_t len,
 
   if (FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING)) {
     if ((flsk->type == SOCK_DGRAM) || (flsk->type == SOCK_RAW)) {
-      fl_sockaddr_dup(&flsk->wbuf_dest_addr, dest_addr, addrlen);
+      fl_sockaddr_dup(&flsk->meta->wbuf_dest_addr, dest_addr, addrlen);
     }
 
     /* We will set the fd for writing and return. The process_sockets shall take
@@ -931,11 +1503,20 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
 {
   register fl_task_t *task;
   ssize_t wlen;
-  int retries = 3, sleep_duration = 3;
+  int retries = 3;
 
   FL_ASSERT(flsk);
   task = flsk->task;
 
+  if (flsk->txq_count) {
+    fl_socket_txq_flush(flsk);
+    return;
+  }
+  if (flsk->tx_batch && flsk->tx_batch->count) {
+    fl_socket_tx_batch_flush(flsk);
+    return;
+  }
+
   while (retries > 0) {
 
     if (flsk->type == SOCK_DGRAM) {
@@ -943,8 +1524,8 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
                     (flsk->twbuf_len - flsk->cwdata_len),
                     FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING) ?
                     MSG_DONTWAIT : 0,
-                    SA_CAST(&flsk->wbuf_dest_addr),
-                    fl_sockaddr_len(SA_CAST(&flsk->wbuf_dest_addr)));
+                    SA_CAST(&flsk->meta->wbuf_dest_addr),
+                    fl_sockaddr_len(SA_CAST(&flsk->meta->wbuf_dest_addr)));
     } else if (flsk->type == SOCK_RAW) {
       wlen = sendmsg(flsk->sockfd, (const struct msghdr *) flsk->wbuf,
                     FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING) ?
@@ -959,7 +1540,7 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
     if (wlen == 0) {
       if (flsk->type == SOCK_STREAM) {
         FL_LOGR_ERR("Connection closed on socket (%s, %s, %d)",
-                    (task) ? task->name : "", flsk->name, flsk->sockfd);
+                    (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
         flsk->send_error_method(flsk);
         return;
       }
@@ -975,18 +1556,14 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
         retries++;
       } else if ((save_errno == ENETUNREACH) || (save_errno == EHOSTUNREACH) ||
                  (save_errno == ENOBUFS)) {
-        retries--;
-        FL_LOGR_NOTICE("Tx on socket (%s, %s, %d) failed, error %d <%s>. "
-                       "Shall retry after %d seconds",
-                       (task) ? task->name : "", flsk->name, flsk->sockfd,
-                       save_errno, strerror(save_errno), sleep_duration);
-        sleep(sleep_duration);
+        fl_socket_backoff(flsk, FL_FD_OP_WRITE, save_errno);
+        return;
       } else if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
         break;
       } else {
         FL_LOGR_ERR("Tx on socket (%s, %s, %d) failed, error %d <%s>. "
                     "Send shall not be attempted on this socket.",
-                    (task) ? task->name : "", flsk->name, flsk->sockfd,
+                    (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
                     save_errno, strerror(save_errno));
         flsk->send_error_method(flsk);
         return;
@@ -996,6 +1573,7 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
 
       /* We have tranmistted something. */
       flsk->cwdata_len += wlen;
+      flsk->backoff_ms = 0;
 
       if (flsk->cwdata_len == flsk->twbuf_len) {
         flsk->send_complete_method(flsk);
@@ -1010,34 +1588,211 @@ void fl_socket_generic_nb_send(fl_socket_t *flsk)
   FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
 }
 
+ssize_t fl_socket_txq_append(fl_socket_t *flsk, void *buf, size_t len)
+{
+  register fl_socket_txbuf_t *txb;
+
+  FL_ASSERT(flsk && buf && len);
+  FL_ASSERT(flsk->type == SOCK_STREAM);
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING));
+  FL_ASSERT(flsk->nb_send_method && flsk->send_error_method);
+  FL_ASSERT(!flsk->wbuf);
+
+  if ((flsk->txq_count == flsk->txq_size) && (fl_socket_txq_grow(flsk) < 0)) {
+    return -1;
+  }
+
+  txb = &flsk->txq[(flsk->txq_head + flsk->txq_count) % flsk->txq_size];
+  txb->buf = buf;
+  txb->len = len;
+  flsk->txq_count++;
+  flsk->txq_bytes += len;
+
+  /* The queue is flushed when the sockfd becomes writable, unless sending
+   * has been deferred. A queue emptied more than once within a flush is
+   * armed by the first append.
+   */
+  if ((flsk->txq_count == 1) && !FL_TEST_BIT(flsk->flags, FL_SOCKF_DEFERRED) &&
+      !fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
+  }
+
+  if (flsk->txq_high_wm && (flsk->txq_bytes >= flsk->txq_high_wm) &&
+      !FL_TEST_BIT(flsk->flags, FL_SOCKF_TXQ_HIGH)) {
+    FL_SET_BIT(flsk->flags, FL_SOCKF_TXQ_HIGH);
+    FL_LOGR_DEBUG("Transmit queue of socket (%s, %s, %d) reached its high "
+                  "watermark, %lu bytes queued",
+                  (flsk->task) ? flsk->task->name : "", flsk->meta->name,
+                  flsk->sockfd, (unsigned long) flsk->txq_bytes);
+    if (flsk->txq_high_method) {
+      flsk->txq_high_method(flsk, flsk->txq_bytes);
+    }
+  }
+
+  return flsk->txq_bytes;
+}
+
+int fl_socket_recv_batch(fl_socket_t *flsk, void **bufs, size_t buf_len,
+                         u_int32_t nbufs,
+                         fl_socket_dgram_batch_method_t recv_batch_method)
+{
+  register fl_socket_dgram_batch_t *batch;
+  register u_int32_t i;
+
+  FL_ASSERT(flsk && bufs && buf_len && nbufs && recv_batch_method);
+  FL_ASSERT(flsk->type == SOCK_DGRAM);
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING));
+  FL_ASSERT(flsk->nb_recv_method && flsk->recv_error_method);
+  FL_ASSERT(!flsk->rx_batch && !flsk->rbuf);
+
+  batch = fl_socket_dgram_batch_alloc(flsk, nbufs, nbufs);
+  if (!batch) {
+    return -1;
+  }
+
+  /* The message headers point to the buffers and the source addresses of
+   * the datagrams for good, recvmmsg() fills them in place.
+   */
+  for (i = 0; i < nbufs; i++) {
+    FL_ASSERT(bufs[i]);
+    batch->iovs[i].iov_base = bufs[i];
+    batch->iovs[i].iov_len = buf_len;
+    batch->msgs[i].msg_hdr.msg_name = &batch->dgrams[i].addr;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  flsk->rx_batch = batch;
+  flsk->recv_batch_method = recv_batch_method;
+  fl_socket_want_read(flsk);
+
+  FL_LOGR_DEBUG("Socket (%s, %s, %d) receives batches of %u datagrams",
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name,
+                flsk->sockfd, nbufs);
+  return 0;
+}
+
+int fl_socket_pause_read(fl_socket_t *flsk)
+{
+  if (!flsk) {
+    FL_ASSERT(flsk);
+    return -1;
+  }
+
+  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_READ_PAUSED)) {
+    return 0;
+  }
+
+  FL_SET_BIT(flsk->flags, FL_SOCKF_READ_PAUSED);
+  if (fl_fd_isset(flsk->sockfd, FL_FD_OP_READ)) {
+    FL_FD_CLR(flsk->sockfd, FL_FD_OP_READ);
+  }
+  fl_fd_clrready(flsk->sockfd, FL_FD_OP_READ, &exec_rbits);
+
+  FL_LOGR_DEBUG("Paused receiving on socket (%s, %s, %d)",
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name,
+                flsk->sockfd);
+  return 0;
+}
+
+int fl_socket_resume_read(fl_socket_t *flsk)
+{
+  if (!flsk) {
+    FL_ASSERT(flsk);
+    return -1;
+  }
+
+  if (!FL_TEST_BIT(flsk->flags, FL_SOCKF_READ_PAUSED)) {
+    return 0;
+  }
+
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_READ_PAUSED);
+  if (flsk->rbuf || flsk->rx_batch) {
+    fl_socket_want_read(flsk);
+  }
+
+  FL_LOGR_DEBUG("Resumed receiving on socket (%s, %s, %d)",
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name,
+                flsk->sockfd);
+  return 0;
+}
+
+ssize_t fl_socket_send_batch(fl_socket_t *flsk, void *buf, size_t len,
+                             const struct sockaddr_storage *dest_addr,
+                             socklen_t addrlen)
+{
+  register fl_socket_dgram_batch_t *batch;
+  register fl_socket_dgram_t *dgram;
+
+  FL_ASSERT(flsk && buf && len && dest_addr && addrlen);
+  FL_ASSERT(flsk->type == SOCK_DGRAM);
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_NONBLOCKING));
+  FL_ASSERT(flsk->nb_send_method && !flsk->wbuf);
+
+  if ((!flsk->tx_batch || (flsk->tx_batch->count == flsk->tx_batch->size)) &&
+      (fl_socket_tx_batch_grow(flsk) < 0)) {
+    return -1;
+  }
+
+  batch = flsk->tx_batch;
+  dgram = &batch->dgrams[(batch->head + batch->count) % batch->size];
+  dgram->buf = buf;
+  dgram->len = len;
+  fl_sockaddr_dup(&dgram->addr, dest_addr, addrlen);
+  dgram->addrlen = addrlen;
+  dgram->error = 0;
+  batch->count++;
+
+  /* The queued datagrams are transmitted when the sockfd becomes writable,
+   * unless sending has been deferred. A ring emptied more than once within
+   * a flush is armed by the first datagram.
+   */
+  if ((batch->count == 1) && !FL_TEST_BIT(flsk->flags, FL_SOCKF_DEFERRED) &&
+      !fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
+  }
+
+  return batch->count;
+}
+
 int fl_socket_select(fd_set **rfds, fd_set **wfds, fd_set **efds)
 {
-  fl_fd_set_t *fdset;
-  int nfds, njobs = 0;
+  int nfds, njobs;
   struct timeval tv = { 0 };
+  u_int64_t block_start = 0;
 
   FL_ASSERT(rfds && wfds && efds);
   *rfds = *wfds = *efds = NULL;
 
   if (fl_fds_anyfds_set(FL_FD_OP_READ)) {
     *rfds = &exec_rbits;
-    fdset = fl_fds_get_set(FL_FD_OP_READ);
-    memcpy(*rfds, &fdset->fd_bits, sizeof(fd_set));
   }
   if (fl_fds_anyfds_set(FL_FD_OP_WRITE)) {
     *wfds = &exec_wbits;
-    fdset = fl_fds_get_set(FL_FD_OP_WRITE);
-    memcpy(*wfds, &fdset->fd_bits, sizeof(fd_set));
   }
   if (fl_fds_anyfds_set(FL_FD_OP_EXCEPT)) {
     *efds = &exec_ebits;
-    fdset = fl_fds_get_set(FL_FD_OP_EXCEPT);
-    memcpy(*efds, &fdset->fd_bits, sizeof(fd_set));
+  }
+
+  /* Poll, rather than block, while deferred work or scheduled events are
+   * pending
+   */
+  njobs = fl_jobs_pending() + fl_sched_runnable();
+
+  /* Spin for a while before blocking, in busy-poll mode */
+  if (!njobs && fl_socket_busy_poll_max_us) {
+    nfds = fl_socket_busy_poll_spin(*rfds, *wfds, *efds);
+    if (nfds > 0) {
+      return nfds;
+    }
+    block_start = fl_socket_now_ns();
   }
 
  retry_select:
-  nfds = select(fl_fds_get_max_fd() + 1, *rfds, *wfds, *efds,
-                (njobs) ? &tv : NULL);
+  nfds = fl_fds_wait(*rfds, *wfds, *efds, (njobs) ? &tv : NULL);
+  if (block_start && (nfds >= 0)) {
+    fl_socket_busy_poll_adapt(fl_socket_now_ns() - block_start);
+  }
   if ((nfds == 0) && !njobs) {
     FL_LOGR_ERR("select() fired with no fds");
     FL_ASSERT(0);
@@ -1059,13 +1814,24 @@ void fl_socket_process_reads(int *nfds, fd_set *fds)
 {
   int save_nfds = *nfds;
   register fl_socket_t *li;
+  register int i, nready;
+  const int *ready;
 
   FL_ASSERT(*nfds);
 
-  LIST_FOREACH(li, &fl_sockets, socket_lc) {
-    register int sockfd = li->sockfd;
+  /* Only the fds that were found ready are visited, and each is mapped to its
+   * falco socket through the fd registry.
+   */
+  nready = fl_fds_get_ready(&ready);
+  for (i = 0; (i < nready) && (*nfds > 0); i++) {
+    register int sockfd = ready[i];
+
+    if (!fl_fd_isready(sockfd, FL_FD_OP_READ, fds)) {
+      continue;
+    }
 
-    if (!FD_ISSET(sockfd, fds)) {
+    li = fl_fds_get_owner(sockfd, FL_FD_OWNER_SOCKET);
+    if (!li) {
       continue;
     }
 
@@ -1077,13 +1843,16 @@ void fl_socket_process_reads(int *nfds, fd_set *fds)
      */
     if (li->nb_recv_method) {
       /* Clear the fd because we are going to process it now. If the app wants
-       * to read again, then it will have to set it again.
+       * to read again, then it will have to set it again. In persistent read
+       * mode, the fd stays set until the app pauses the socket.
        */
-      FL_FD_CLR(sockfd, FL_FD_OP_READ);
+      if (!FL_TEST_BIT(li->flags, FL_SOCKF_PERSISTENT_READ)) {
+        FL_FD_CLR(sockfd, FL_FD_OP_READ);
+      }
       /* Clear the fd from the exec_rbits */
-      FD_CLR(sockfd, fds);
+      fl_fd_clrready(sockfd, FL_FD_OP_READ, fds);
       (*nfds)--;
-      li->nb_recv_method(li);
+      fl_socket_dispatch(li, FL_SOCKET_SCHED_READ);
     }
   }
 
@@ -1096,23 +1865,34 @@ void fl_socket_process_writes(int *nfds, fd_set *fds)
 {
   int save_nfds = *nfds;
   register fl_socket_t *li;
+  register int i, nready;
+  const int *ready;
 
   FL_ASSERT(*nfds);
 
-  LIST_FOREACH(li, &fl_sockets, socket_lc) {
-    register int sockfd = li->sockfd;
+  /* Only the fds that were found ready are visited, and each is mapped to its
+   * falco socket through the fd registry.
+   */
+  nready = fl_fds_get_ready(&ready);
+  for (i = 0; (i < nready) && (*nfds > 0); i++) {
+    register int sockfd = ready[i];
+
+    if (!fl_fd_isready(sockfd, FL_FD_OP_WRITE, fds)) {
+      continue;
+    }
 
-    if (!FD_ISSET(sockfd, fds)) {
+    li = fl_fds_get_owner(sockfd, FL_FD_OWNER_SOCKET);
+    if (!li) {
       continue;
     }
 
     FL_ASSERT(fl_fd_isset(sockfd, FL_FD_OP_WRITE));
-    FL_ASSERT(li->nb_send_method);
+    FL_ASSERT(li->nb_send_method || FL_TEST_BIT(li->flags, FL_SOCKF_CONNECTING));
 
     FL_FD_CLR(sockfd, FL_FD_OP_WRITE);
-    FD_CLR(sockfd, fds);
+    fl_fd_clrready(sockfd, FL_FD_OP_WRITE, fds);
     (*nfds)--;
-    li->nb_send_method(li);
+    fl_socket_dispatch(li, FL_SOCKET_SCHED_WRITE);
   }
 
   if (save_nfds && ((save_nfds - *nfds) > 0)) {
@@ -1124,13 +1904,24 @@ void fl_socket_process_connections(int *nfds, fd_set *fds)
 {
   int save_nfds = *nfds;
   register fl_socket_t *li;
+  register int i, nready;
+  const int *ready;
 
   FL_ASSERT(*nfds);
 
-  LIST_FOREACH(li, &fl_sockets, socket_lc) {
-    register int sockfd = li->sockfd;
+  /* Only the fds that were found ready are visited, and each is mapped to its
+   * falco socket through the fd registry.
+   */
+  nready = fl_fds_get_ready(&ready);
+  for (i = 0; (i < nready) && (*nfds > 0); i++) {
+    register int sockfd = ready[i];
 
-    if (!FD_ISSET(sockfd, fds)) {
+    if (!fl_fd_isready(sockfd, FL_FD_OP_ACCEPT, fds)) {
+      continue;
+    }
+
+    li = fl_fds_get_owner(sockfd, FL_FD_OWNER_SOCKET);
+    if (!li) {
       continue;
     }
 
@@ -1138,9 +1929,9 @@ void fl_socket_process_connections(int *nfds, fd_set *fds)
     FL_ASSERT(li->accept_method);
 
     FL_FD_CLR(sockfd, FL_FD_OP_ACCEPT);
-    FD_CLR(sockfd, fds);
+    fl_fd_clrready(sockfd, FL_FD_OP_ACCEPT, fds);
     (*nfds)--;
-    li->accept_method(li);
+    fl_socket_dispatch(li, FL_SOCKET_SCHED_ACCEPT);
   }
 
   if (save_nfds && ((save_nfds - *nfds) > 0)) {
@@ -1148,6 +1939,97 @@ void fl_socket_process_connections(int *nfds, fd_set *fds)
   }
 }
 
+static void fl_socket_dispatch(fl_socket_t *flsk, u_int8_t op)
+{
+  if (!fl_sched_enabled()) {
+    fl_socket_dispatch_op(flsk, op);
+    return;
+  }
+
+  /* The fd has been cleared from the watched set, so the operation stays
+   * pending in the run queue of the socket's task priority until the
+   * scheduler gets to it.
+   */
+  flsk->sched_ops |= op;
+  fl_sched_event_queue(&flsk->sched_event, FL_TASK_PRIORITY(flsk->task));
+}
+
+static void fl_socket_dispatch_op(fl_socket_t *flsk, u_int8_t op)
+{
+#if (defined(ENABLE_INSTRUMENTATION))
+  register fl_task_t *task = flsk->task;
+
+  fl_socket_dispatching = flsk;
+#endif /* ENABLE_INSTRUMENTATION */
+  FL_HIST_NOW(start);
+
+  switch (op) {
+  case FL_SOCKET_SCHED_ACCEPT:
+    if (!flsk->accept_method) {
+      return;
+    }
+    flsk->accept_method(flsk);
+    break;
+
+  case FL_SOCKET_SCHED_READ:
+    if (!flsk->nb_recv_method ||
+        FL_TEST_BIT(flsk->flags, FL_SOCKF_READ_PAUSED)) {
+      return;
+    }
+    flsk->nb_recv_method(flsk);
+    break;
+
+  case FL_SOCKET_SCHED_WRITE:
+    if (FL_TEST_BIT(flsk->flags, FL_SOCKF_CONNECTING)) {
+      fl_socket_nb_connect_complete(flsk);
+    } else if (flsk->nb_send_method) {
+      flsk->nb_send_method(flsk);
+    } else {
+      return;
+    }
+    break;
+
+  default:
+    FL_ASSERT(0);
+    return;
+  }
+
+#if (defined(ENABLE_INSTRUMENTATION))
+  /* The socket may have been closed by its method, only the task is
+   * accounted then. The operation bits are in the order of fl_socket_hist_e.
+   */
+  {
+    u_int64_t elapsed = fl_hist_now_ns() - start;
+
+    if (fl_socket_dispatching == flsk) {
+      FL_HIST_RECORD(&flsk->meta->hist[__builtin_ctz(op)], elapsed);
+      fl_socket_dispatching = NULL;
+    }
+    if (task) {
+      FL_HIST_RECORD(&task->hist, elapsed);
+    }
+  }
+#endif /* ENABLE_INSTRUMENTATION */
+}
+
+static void fl_socket_sched_dispatch(fl_sched_event_t *event)
+{
+  fl_socket_t *flsk = event->owner;
+  u_int8_t op;
+
+  /* One operation per dispatch, so that a socket that is both readable and
+   * writable accounts for two units of the budget. The remaining operations
+   * go to the tail of the run queue.
+   */
+  op = flsk->sched_ops & -flsk->sched_ops;
+  flsk->sched_ops &= ~op;
+  if (flsk->sched_ops) {
+    fl_sched_event_queue(event, FL_TASK_PRIORITY(flsk->task));
+  }
+
+  fl_socket_dispatch_op(flsk, op);
+}
+
 static fl_socket_t *fl_socket_alloc(fl_task_t *task, const char *name,
                                     int domain, int type, int protocol,
                                     int sockfd)
@@ -1159,16 +2041,27 @@ static fl_socket_t *fl_socket_alloc(fl_task_t *task, const char *name,
     return NULL;
   }
 
-  FL_ALLOC(fl_socket_t, 1, flsk, "Socket");
+  FL_POOL_ALLOC(fl_socket_t, fl_socket_pool, flsk, "Socket");
   if (!flsk) {
     return NULL;
   }
+  FL_POOL_ALLOC(fl_socket_meta_t, fl_socket_meta_pool, flsk->meta,
+                "Socket Metadata");
+  if (!flsk->meta) {
+    FL_POOL_FREE(fl_socket_pool, flsk, "Socket");
+    return NULL;
+  }
 
-  strcpy(flsk->name, name);
+  strcpy(flsk->meta->name, name);
+  fl_sched_event_init(&flsk->sched_event, fl_socket_sched_dispatch, flsk);
   flsk->domain = domain;
   flsk->type = type;
   flsk->protocol = protocol;
   flsk->sockfd = sockfd;
+  fl_fds_set_owner(sockfd, FL_FD_OWNER_SOCKET, flsk);
+  if (fl_socket_so_busy_poll_us) {
+    fl_socket_set_busy_poll(flsk);
+  }
 
   if (LIST_EMPTY(&fl_sockets)) {
     LIST_INSERT_HEAD(&fl_sockets, flsk, socket_lc);
@@ -1216,6 +2109,90 @@ static fl_socket_t *fl_socket_alloc(fl_task_t *task, const char *name,
   return flsk;
 }
 
+/* Set up a falco socket for a connection accepted on flsk, and notify the
+ * application.
+ */
+static int fl_socket_accept_one(fl_socket_t *flsk, int peerfd,
+                                const struct sockaddr_storage *addr,
+                                socklen_t addrlen)
+{
+  register fl_task_t *task = flsk->task;
+  fl_socket_t *nflsk;
+  char addrstr[INET6_ADDRSTRLEN+1] = { 0 };
+
+  nflsk = fl_socket_alloc(task, "", flsk->domain, flsk->type, flsk->protocol,
+                          peerfd);
+  if (!nflsk) {
+    FL_LOGR_ERR("Closing connection from %s:%d on socket (%s, %s, %d)",
+                fl_sockaddr_ntop(addr, addrstr, INET6_ADDRSTRLEN),
+                fl_sockaddr_port_hbo(addr),
+                (task) ? task->name : "", "", peerfd);
+    (void) close(peerfd);
+    return -1;
+  }
+
+  if (flsk->accept_budget) {
+    /* accept4() has created a non-blocking socket. */
+    FL_SET_BIT(nflsk->flags, FL_SOCKF_NONBLOCKING);
+  }
+  flsk->accept_stats.naccepted++;
+
+  /* The local address of the connection is that of the listening socket,
+   * unless the listening socket is bound to a wildcard address. Then, it is
+   * fetched when it is needed.
+   */
+  if (FL_TEST_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR) &&
+      !fl_sockaddr_is_wildcard(&flsk->meta->sa_local)) {
+    fl_socket_set_local_addr(nflsk, &flsk->meta->sa_local, sizeof(flsk->meta->sa_local));
+  }
+  fl_socket_set_remote_addr(nflsk, addr, addrlen);
+  FL_SET_BIT(nflsk->flags, FL_SOCKF_CONNECTED);
+
+  FL_LOGR_DEBUG("Accepted connection %s -> %s on socket (%s, %s, %d)",
+                fl_socket_local_addr_str(nflsk),
+                fl_socket_remote_addr_str(nflsk),
+                (task) ? task->name : "", "", peerfd);
+
+  flsk->connect_complete_method(nflsk);
+  return 0;
+}
+
+/* Out of fds. Give up the reserved fd to take a connection off the backlog,
+ * close it, and reserve the fd again. This keeps the backlog from filling up
+ * and the listening socket from being reported ready over and over.
+ */
+static int fl_socket_accept_reject(fl_socket_t *flsk)
+{
+  register fl_task_t *task = flsk->task;
+  int peerfd, save_errno;
+
+  (void) close(fl_socket_reserve_fd);
+  while (((peerfd = accept(flsk->sockfd, NULL, NULL)) < 0) &&
+         (errno == EINTR));
+  save_errno = errno;
+  if (peerfd >= 0) {
+    (void) close(peerfd);
+    flsk->accept_stats.nrejected++;
+  }
+  fl_socket_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fl_socket_reserve_fd < 0) {
+    FL_LOGR_WARNING("Could not reserve a file descriptor for accept again, "
+                    "error %d <%s>. Shall retry on the next accept",
+                    errno, strerror(errno));
+  }
+
+  if (peerfd < 0) {
+    /* errno is that of accept() */
+    errno = save_errno;
+    return -1;
+  }
+
+  FL_LOGR_WARNING("Out of file descriptors, closed a connection pending on "
+                  "socket (%s, %s, %d)",
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
+  return 0;
+}
+
 static int fl_socket_get_local_addr(fl_socket_t *flsk)
 {
   register fl_task_t *task;
@@ -1225,32 +2202,688 @@ static int fl_socket_get_local_addr(fl_socket_t *flsk)
   FL_ASSERT(flsk && flsk->sockfd);
   task = flsk->task;
 
-  rc = getsockname(flsk->sockfd, SA_CAST(&flsk->sa_local), &addrlen);
+  rc = getsockname(flsk->sockfd, SA_CAST(&flsk->meta->sa_local), &addrlen);
   if (rc < 0) {
     int save_errno = errno;
     FL_LOGR_ERR("Attempt to get local address on socket (%s, %s, %d) failed, "
                 "error %d <%s>", (task) ? task->name : "",
-                flsk->name, flsk->sockfd, save_errno, strerror(save_errno));
+                flsk->meta->name, flsk->sockfd, save_errno, strerror(save_errno));
     return rc;
   }
 
-  memset(flsk->local_addr, 0, FL_SOCKADDR_STR_MAX_LEN);
-  if (((flsk->domain == AF_INET) || (flsk->domain == AF_INET6)) &&
-      ((flsk->type == SOCK_DGRAM) || (flsk->type == SOCK_SEQPACKET) ||
-       (flsk->type == SOCK_STREAM))) {
-    sprintf(flsk->local_addr, "%s:%d",
-            fl_sockaddr_ntop(&flsk->sa_local, flsk->local_addr,
-                             FL_SOCKADDR_STR_MAX_LEN - 1),
-            fl_sockaddr_port_hbo(&flsk->sa_local));
-  } else {
-    sprintf(flsk->local_addr, "%s",
-            fl_sockaddr_ntop(&flsk->sa_local, flsk->local_addr,
-                             FL_SOCKADDR_STR_MAX_LEN - 1));
+  FL_SET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR);
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR_STR);
+  return 0;
+}
+
+static void fl_socket_set_local_addr(fl_socket_t *flsk,
+                                     const struct sockaddr_storage *addr,
+                                     socklen_t addrlen)
+{
+  fl_sockaddr_dup(&flsk->meta->sa_local, addr, addrlen);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR);
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR_STR);
+}
+
+static int fl_socket_txq_grow(fl_socket_t *flsk)
+{
+  register u_int32_t nsize = (flsk->txq_size) ? (flsk->txq_size * 2) : 16;
+  register u_int32_t i;
+  fl_socket_txbuf_t *ntxq;
+
+  FL_ALLOC(fl_socket_txbuf_t, nsize, ntxq, "Socket Transmit Queue");
+  if (!ntxq) {
+    FL_LOGR_CRIT("Could not grow the transmit queue of socket (%s, %s, %d) to "
+                 "%u buffers", (flsk->task) ? flsk->task->name : "",
+                 flsk->meta->name, flsk->sockfd, nsize);
+    return -1;
+  }
+
+  /* Unwrap the ring, so that the first buffer is at index 0. */
+  for (i = 0; i < flsk->txq_count; i++) {
+    ntxq[i] = flsk->txq[(flsk->txq_head + i) % flsk->txq_size];
+  }
+  if (flsk->txq) {
+    FL_FREE(flsk->txq, "Socket Transmit Queue");
   }
 
+  flsk->txq = ntxq;
+  flsk->txq_size = nsize;
+  flsk->txq_head = 0;
   return 0;
 }
 
+static void fl_socket_txq_flush(fl_socket_t *flsk)
+{
+  register fl_task_t *task = flsk->task;
+  struct iovec iov[FL_SOCKET_TXQ_IOV_MAX];
+  struct msghdr msg;
+  ssize_t wlen;
+  register u_int32_t i, niov;
+
+  while (flsk->txq_count) {
+    niov = (flsk->txq_count < FL_SOCKET_TXQ_IOV_MAX) ?
+      flsk->txq_count : FL_SOCKET_TXQ_IOV_MAX;
+    for (i = 0; i < niov; i++) {
+      register fl_socket_txbuf_t *txb =
+        &flsk->txq[(flsk->txq_head + i) % flsk->txq_size];
+
+      iov[i].iov_base = txb->buf;
+      iov[i].iov_len = txb->len;
+    }
+    /* Skip what has been transmitted of the first buffer. */
+    iov[0].iov_base = ((u_int8_t *) iov[0].iov_base) + flsk->txq_off;
+    iov[0].iov_len -= flsk->txq_off;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+
+    wlen = sendmsg(flsk->sockfd, &msg, MSG_DONTWAIT);
+    if (wlen < 0) {
+      int save_errno = errno;
+
+      if (save_errno == EINTR) {
+        continue;
+      }
+      if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (save_errno == ENOBUFS) {
+        fl_socket_backoff(flsk, FL_FD_OP_WRITE, save_errno);
+        return;
+      }
+
+      FL_LOGR_ERR("Tx on socket (%s, %s, %d) failed, error %d <%s>. "
+                  "Send shall not be attempted on this socket.",
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                  save_errno, strerror(save_errno));
+      flsk->send_error_method(flsk);
+      return;
+    }
+
+    flsk->txq_bytes -= wlen;
+    flsk->backoff_ms = 0;
+
+    /* Retire the buffers that have been transmitted completely. A partially
+     * transmitted buffer stays at the head of the queue.
+     */
+    while (wlen > 0) {
+      register fl_socket_txbuf_t *txb = &flsk->txq[flsk->txq_head];
+      register size_t remaining = txb->len - flsk->txq_off;
+
+      if ((size_t) wlen < remaining) {
+        flsk->txq_off += wlen;
+        break;
+      }
+
+      wlen -= remaining;
+      flsk->txq_off = 0;
+      flsk->txq_head = (flsk->txq_head + 1) % flsk->txq_size;
+      flsk->txq_count--;
+      if (flsk->txq_buf_complete_method) {
+        fl_socket_draining = flsk;
+        flsk->txq_buf_complete_method(flsk, txb->buf, txb->len);
+        if (fl_socket_draining != flsk) {
+          return;
+        }
+      }
+    }
+
+    if (FL_TEST_BIT(flsk->flags, FL_SOCKF_TXQ_HIGH) &&
+        (flsk->txq_bytes <= flsk->txq_low_wm)) {
+      FL_RESET_BIT(flsk->flags, FL_SOCKF_TXQ_HIGH);
+      FL_LOGR_DEBUG("Transmit queue of socket (%s, %s, %d) drained to its low "
+                    "watermark, %lu bytes queued",
+                    (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                    (unsigned long) flsk->txq_bytes);
+      if (flsk->txq_low_method) {
+        fl_socket_draining = flsk;
+        flsk->txq_low_method(flsk, flsk->txq_bytes);
+        if (fl_socket_draining != flsk) {
+          return;
+        }
+      }
+    }
+  }
+
+  /* A callback appending to an emptied queue has armed the sockfd already. */
+  if (flsk->txq_count) {
+    if (!fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+      FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
+    }
+    return;
+  }
+  if (fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_CLR(flsk->sockfd, FL_FD_OP_WRITE);
+  }
+
+  if (flsk->send_complete_method) {
+    fl_socket_draining = flsk;
+    flsk->send_complete_method(flsk);
+  }
+}
+
+static fl_socket_dgram_batch_t *fl_socket_dgram_batch_alloc(fl_socket_t *flsk,
+                                                            u_int32_t ndgrams,
+                                                            u_int32_t nmsgs)
+{
+  fl_socket_dgram_batch_t *batch;
+
+  FL_ALLOC(fl_socket_dgram_batch_t, 1, batch, "Socket Datagram Batch");
+  if (batch) {
+    FL_ALLOC(fl_socket_dgram_t, ndgrams, batch->dgrams,
+             "Socket Datagram Batch");
+    FL_ALLOC(struct mmsghdr, nmsgs, batch->msgs, "Socket Datagram Batch");
+    FL_ALLOC(struct iovec, nmsgs, batch->iovs, "Socket Datagram Batch");
+  }
+
+  if (!batch || !batch->dgrams || !batch->msgs || !batch->iovs) {
+    FL_LOGR_CRIT("Could not allocate a batch of %u datagrams for socket "
+                 "(%s, %s, %d)", ndgrams, (flsk->task) ? flsk->task->name : "",
+                 flsk->meta->name, flsk->sockfd);
+    if (batch) {
+      fl_socket_dgram_batch_free(batch);
+    }
+    return NULL;
+  }
+
+  batch->size = ndgrams;
+  return batch;
+}
+
+static void fl_socket_dgram_batch_free(fl_socket_dgram_batch_t *batch)
+{
+  if (batch->dgrams) {
+    FL_FREE(batch->dgrams, "Socket Datagram Batch");
+  }
+  if (batch->msgs) {
+    FL_FREE(batch->msgs, "Socket Datagram Batch");
+  }
+  if (batch->iovs) {
+    FL_FREE(batch->iovs, "Socket Datagram Batch");
+  }
+  FL_FREE(batch, "Socket Datagram Batch");
+}
+
+static int fl_socket_tx_batch_grow(fl_socket_t *flsk)
+{
+  register fl_socket_dgram_batch_t *batch = flsk->tx_batch;
+  register u_int32_t i;
+  fl_socket_dgram_t *ndgrams;
+  u_int32_t nsize;
+
+  if (!batch) {
+    flsk->tx_batch = fl_socket_dgram_batch_alloc(flsk,
+                                                 FL_SOCKET_DGRAM_BATCH_MAX,
+                                                 FL_SOCKET_DGRAM_BATCH_MAX);
+    return (flsk->tx_batch) ? 0 : -1;
+  }
+
+  nsize = batch->size * 2;
+  FL_ALLOC(fl_socket_dgram_t, nsize, ndgrams, "Socket Datagram Batch");
+  if (!ndgrams) {
+    return -1;
+  }
+
+  /* Unwrap the ring, so that the first datagram is at index 0. */
+  for (i = 0; i < batch->count; i++) {
+    ndgrams[i] = batch->dgrams[(batch->head + i) % batch->size];
+  }
+  FL_FREE(batch->dgrams, "Socket Datagram Batch");
+
+  batch->dgrams = ndgrams;
+  batch->size = nsize;
+  batch->head = 0;
+  return 0;
+}
+
+static void fl_socket_rx_batch_process(fl_socket_t *flsk)
+{
+  register fl_socket_dgram_batch_t *batch;
+  register fl_task_t *task = flsk->task;
+  register u_int32_t i;
+  u_int32_t ndrained = 0, size;
+  int rc;
+
+ next_batch:
+  batch = flsk->rx_batch;
+  size = batch->size;
+  for (i = 0; i < size; i++) {
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+  }
+
+  do {
+    rc = recvmmsg(flsk->sockfd, batch->msgs, batch->size, MSG_DONTWAIT, NULL);
+  } while ((rc < 0) && (errno == EINTR));
+
+  if (rc < 0) {
+    int save_errno = errno;
+
+    if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
+      fl_socket_want_read(flsk);
+      return;
+    }
+
+    batch->nerrors++;
+    FL_LOGR_ERR("Batched Rx on socket (%s, %s, %d) failed, error %d <%s>. "
+                "recv shall not be attempted on this socket.",
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                save_errno, strerror(save_errno));
+    flsk->recv_error_method(flsk);
+    return;
+  }
+
+  for (i = 0; i < (u_int32_t) rc; i++) {
+    register fl_socket_dgram_t *dgram = &batch->dgrams[i];
+
+    dgram->buf = batch->iovs[i].iov_base;
+    dgram->len = batch->msgs[i].msg_len;
+    dgram->addrlen = batch->msgs[i].msg_hdr.msg_namelen;
+    dgram->error = (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ?
+      EMSGSIZE : 0;
+  }
+  batch->ncalls++;
+  batch->ndgrams += rc;
+
+  /* The buffers are reused for the next batch, keep receiving. */
+  fl_socket_want_read(flsk);
+
+  FL_LOGR_DEBUG("Received a batch of %d datagrams on socket (%s, %s, %d)",
+                rc, (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
+  flsk->recv_batch_method(flsk, batch->dgrams, rc);
+
+  /* A short batch means that the socket has been drained. */
+  if (((u_int32_t) rc == size) && fl_socket_drain_more(flsk, &ndrained)) {
+    goto next_batch;
+  }
+}
+
+static void fl_socket_tx_batch_flush(fl_socket_t *flsk)
+{
+  register fl_socket_dgram_batch_t *batch = flsk->tx_batch;
+  register fl_task_t *task = flsk->task;
+  fl_socket_dgram_t sent[FL_SOCKET_DGRAM_BATCH_MAX];
+  register u_int32_t i, n;
+  int rc;
+
+  while (batch->count) {
+    /* A batch is a contiguous run of the ring. */
+    n = batch->size - batch->head;
+    if (n > batch->count) {
+      n = batch->count;
+    }
+    if (n > FL_SOCKET_DGRAM_BATCH_MAX) {
+      n = FL_SOCKET_DGRAM_BATCH_MAX;
+    }
+
+    for (i = 0; i < n; i++) {
+      register fl_socket_dgram_t *dgram = &batch->dgrams[batch->head + i];
+      register struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+
+      batch->iovs[i].iov_base = dgram->buf;
+      batch->iovs[i].iov_len = dgram->len;
+      memset(hdr, 0, sizeof(*hdr));
+      hdr->msg_name = &dgram->addr;
+      hdr->msg_namelen = dgram->addrlen;
+      hdr->msg_iov = &batch->iovs[i];
+      hdr->msg_iovlen = 1;
+    }
+
+    rc = sendmmsg(flsk->sockfd, batch->msgs, n, MSG_DONTWAIT);
+    batch->ncalls++;
+    if (rc < 0) {
+      int save_errno = errno;
+
+      if (save_errno == EINTR) {
+        continue;
+      }
+      if ((save_errno == EAGAIN) || (save_errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (save_errno == ENOBUFS) {
+        fl_socket_backoff(flsk, FL_FD_OP_WRITE, save_errno);
+        return;
+      }
+
+      /* The first datagram of the batch failed. It is handed back with the
+       * error, and the rest of the queue is transmitted.
+       */
+      batch->dgrams[batch->head].error = save_errno;
+      batch->nerrors++;
+      FL_LOGR_ERR("Batched Tx on socket (%s, %s, %d) failed, error %d <%s>",
+                  (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                  save_errno, strerror(save_errno));
+      rc = 1;
+    } else {
+      batch->ndgrams += rc;
+      flsk->backoff_ms = 0;
+    }
+
+    /* The method can queue more datagrams, which may move the ring. Hand it
+     * a copy of the datagrams that are done.
+     */
+    memcpy(sent, &batch->dgrams[batch->head], rc * sizeof(fl_socket_dgram_t));
+    batch->head = (batch->head + rc) % batch->size;
+    batch->count -= rc;
+
+    if (flsk->send_batch_complete_method) {
+      fl_socket_draining = flsk;
+      flsk->send_batch_complete_method(flsk, sent, rc);
+      if (fl_socket_draining != flsk) {
+        return;
+      }
+    }
+  }
+
+  /* The method queuing on an emptied ring has armed the sockfd already. */
+  if (batch->count) {
+    if (!fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+      FL_FD_SET(flsk->sockfd, FL_FD_OP_WRITE);
+    }
+  } else if (fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_CLR(flsk->sockfd, FL_FD_OP_WRITE);
+  }
+}
+
+static u_int64_t fl_socket_now_ns(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u_int64_t) ts.tv_sec * 1000000000ULL) + (u_int64_t) ts.tv_nsec;
+}
+
+/* Check for readiness, without blocking, until an fd is ready or the spin
+ * budget runs out. Signals, timers and posts from other threads are all fds,
+ * so nothing is missed while spinning.
+ */
+static int fl_socket_busy_poll_spin(fd_set *rfds, fd_set *wfds, fd_set *efds)
+{
+  register fl_socket_busy_poll_stats_t *bp = &fl_socket_busy_poll;
+  struct timeval tv = { 0 };
+  u_int64_t start, now, deadline;
+  int nfds;
+
+  if (!bp->budget_us) {
+    return 0;
+  }
+
+  bp->nspins++;
+  start = now = fl_socket_now_ns();
+  deadline = start + ((u_int64_t) bp->budget_us * 1000);
+  do {
+    nfds = fl_fds_wait(rfds, wfds, efds, &tv);
+    if (nfds != 0) {
+      break;
+    }
+    now = fl_socket_now_ns();
+  } while (now < deadline);
+
+  if (nfds > 0) {
+    now = fl_socket_now_ns();
+    bp->nhits++;
+    bp->hit_ns += now - start;
+  } else {
+    bp->nmisses++;
+  }
+  bp->spin_ns += now - start;
+
+  /* Errors are reported by the blocking wait that follows */
+  return (nfds > 0) ? nfds : 0;
+}
+
+/* Adapt the spin budget to the time that the loop blocked for, which is the
+ * time to the next event after the spin. An event that arrives within the
+ * maximum budget would have been caught by spinning longer. Otherwise,
+ * spinning only burns the CPU.
+ */
+static void fl_socket_busy_poll_adapt(u_int64_t block_ns)
+{
+  register fl_socket_busy_poll_stats_t *bp = &fl_socket_busy_poll;
+  u_int32_t max_us = fl_socket_busy_poll_max_us;
+
+  bp->nblocks++;
+  bp->block_ns += block_ns;
+
+  if (block_ns <= ((u_int64_t) max_us * 1000)) {
+    bp->budget_us = (bp->budget_us) ? (bp->budget_us * 2) :
+      FL_SOCKET_BUSY_POLL_BASE_US;
+    if (bp->budget_us > max_us) {
+      bp->budget_us = max_us;
+    }
+  } else {
+    bp->budget_us /= 2;
+    if (bp->budget_us < FL_SOCKET_BUSY_POLL_BASE_US) {
+      bp->budget_us = 0;
+    }
+  }
+}
+
+static void fl_socket_set_busy_poll(fl_socket_t *flsk)
+{
+  int intv = (int) fl_socket_so_busy_poll_us;
+
+  if (setsockopt(flsk->sockfd, SOL_SOCKET, SO_BUSY_POLL, &intv,
+                 sizeof(intv)) < 0) {
+    FL_LOGR_WARNING("Set SO_BUSY_POLL (%d us) on socket (%s, %d) failed, "
+                    "error %d <%s>", intv, flsk->meta->name, flsk->sockfd,
+                    errno, strerror(errno));
+    return;
+  }
+
+#ifdef SO_PREFER_BUSY_POLL
+  if (fl_socket_so_prefer_busy_poll) {
+    intv = 1;
+    if (setsockopt(flsk->sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &intv,
+                   sizeof(intv)) < 0) {
+      FL_LOGR_WARNING("Set SO_PREFER_BUSY_POLL on socket (%s, %d) failed, "
+                      "error %d <%s>", flsk->meta->name, flsk->sockfd,
+                      errno, strerror(errno));
+    }
+  }
+#endif
+}
+
+/* Watch the sockfd for read, unless it already is or receiving has been
+ * paused.
+ */
+static void fl_socket_want_read(fl_socket_t *flsk)
+{
+  if (!FL_TEST_BIT(flsk->flags, FL_SOCKF_READ_PAUSED) &&
+      !fl_fd_isset(flsk->sockfd, FL_FD_OP_READ)) {
+    FL_FD_SET(flsk->sockfd, FL_FD_OP_READ);
+  }
+}
+
+/* Called after a receive method of a socket has returned, to decide whether to
+ * keep receiving from it. The socket must not be touched if it has been
+ * closed by the method.
+ */
+static int fl_socket_drain_more(fl_socket_t *flsk, u_int32_t *ndrained)
+{
+  if (fl_socket_draining != flsk) {
+    return 0;
+  }
+
+  return (FL_TEST_BIT(flsk->flags, FL_SOCKF_PERSISTENT_READ) &&
+          !FL_TEST_BIT(flsk->flags, FL_SOCKF_READ_PAUSED) &&
+          (++(*ndrained) < FL_SOCKET_DRAIN_MAX));
+}
+
+/* Park an operation that failed with a transient error. The sockfd is not
+ * watched for the operation until the back-off timer fires.
+ */
+static void fl_socket_backoff(fl_socket_t *flsk, fl_fd_op_e op, int error)
+{
+  register fl_task_t *task = flsk->task;
+  char timer_name[FL_TIMER_NAME_MAX_LEN];
+
+  FL_ASSERT(!flsk->backoff_timer);
+
+  flsk->backoff_ms = (flsk->backoff_ms) ?
+    (flsk->backoff_ms * 2) : FL_SOCKET_BACKOFF_MIN_MS;
+  if (flsk->backoff_ms > FL_SOCKET_BACKOFF_MAX_MS) {
+    flsk->backoff_ms = FL_SOCKET_BACKOFF_MAX_MS;
+  }
+  flsk->backoff_op = op;
+  flsk->ndeferrals++;
+  FL_SET_BIT(flsk->flags, FL_SOCKF_DEFERRED);
+
+  /* A callback run before the failure may have armed the operation again. */
+  if (fl_fd_isset(flsk->sockfd, op)) {
+    FL_FD_CLR(flsk->sockfd, op);
+  }
+
+  (void) snprintf(timer_name, sizeof(timer_name), "Backoff(%d)", flsk->sockfd);
+  flsk->backoff_timer = fl_timer_create_ms(task, flsk->backoff_ms, 0,
+                                           fl_socket_backoff_timeout,
+                                           timer_name, flsk);
+  if (!flsk->backoff_timer ||
+      (fl_timer_start(flsk->backoff_timer, NULL) < 0)) {
+    /* Without a timer, the operation is retried in the next loop. */
+    FL_LOGR_ERR("Could not start back-off timer on socket (%s, %s, %d)",
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
+    if (flsk->backoff_timer) {
+      (void) fl_timer_delete(flsk->backoff_timer);
+      flsk->backoff_timer = NULL;
+    }
+    FL_RESET_BIT(flsk->flags, FL_SOCKF_DEFERRED);
+    FL_FD_SET(flsk->sockfd, op);
+    return;
+  }
+
+  FL_LOGR_NOTICE("Operation on socket (%s, %s, %d) failed, error %d <%s>. "
+                 "Shall retry after %u ms",
+                 (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                 error, strerror(error), flsk->backoff_ms);
+
+  if (flsk->deferred_method) {
+    flsk->deferred_method(flsk, error, flsk->backoff_ms);
+  }
+}
+
+static void fl_socket_backoff_timeout(const char *timer_name, void *app_data)
+{
+  register fl_socket_t *flsk = app_data;
+
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_DEFERRED));
+
+  (void) fl_timer_delete(flsk->backoff_timer);
+  flsk->backoff_timer = NULL;
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_DEFERRED);
+
+  /* The operation is retried from the loop, as soon as the sockfd is ready. */
+  FL_FD_SET(flsk->sockfd, flsk->backoff_op);
+}
+
+static void fl_socket_set_remote_addr(fl_socket_t *flsk,
+                                      const struct sockaddr_storage *addr,
+                                      socklen_t addrlen)
+{
+  if (addr != &flsk->meta->sa_remote) {
+    fl_sockaddr_dup(&flsk->meta->sa_remote, addr, addrlen);
+  }
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_REMOTE_ADDR_STR);
+}
+
+static void fl_socket_format_addr(const fl_socket_t *flsk,
+                                  const struct sockaddr_storage *addr,
+                                  char *dst)
+{
+  char addrstr[FL_SOCKADDR_STR_MAX_LEN] = { 0 };
+
+  if ((flsk->domain == AF_INET) || (flsk->domain == AF_INET6)) {
+    (void) snprintf(dst, FL_SOCKADDR_STR_MAX_LEN, "%s:%d",
+                    fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)),
+                    fl_sockaddr_port_hbo(addr));
+  } else {
+    (void) snprintf(dst, FL_SOCKADDR_STR_MAX_LEN, "%s",
+                    fl_sockaddr_ntop(addr, addrstr, sizeof(addrstr)));
+  }
+}
+
+static void fl_socket_nb_connect_end(fl_socket_t *flsk)
+{
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_CONNECTING);
+  if (flsk->connect_timer) {
+    (void) fl_timer_delete(flsk->connect_timer);
+    flsk->connect_timer = NULL;
+  }
+}
+
+static void fl_socket_nb_connect_complete(fl_socket_t *flsk)
+{
+  register fl_task_t *task = flsk->task;
+  int error = 0;
+  socklen_t len = sizeof(error);
+
+  fl_socket_nb_connect_end(flsk);
+
+  if (getsockopt(flsk->sockfd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+    error = errno;
+  }
+
+  if (error) {
+    char addrstr[FL_SOCKADDR_STR_MAX_LEN] = { 0 };
+
+    FL_LOGR_ERR("Attempt to connect to %s:%d on socket (%s, %s, %d) failed, "
+                "error %d <%s>",
+                fl_sockaddr_ntop(&flsk->meta->sa_remote, addrstr, sizeof(addrstr)),
+                fl_sockaddr_port_hbo(&flsk->meta->sa_remote),
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd,
+                error, strerror(error));
+    flsk->connect_error_method(flsk, error);
+    return;
+  }
+
+  /* The local address is fetched when it is needed. */
+  FL_RESET_BIT(flsk->flags, FL_SOCKF_LOCAL_ADDR | FL_SOCKF_LOCAL_ADDR_STR);
+  FL_SET_BIT(flsk->flags, FL_SOCKF_CONNECTED);
+
+  FL_LOGR_DEBUG("Connected from %s -> %s on socket (%s, %s, %d)",
+                fl_socket_local_addr_str(flsk), fl_socket_remote_addr_str(flsk),
+                (task) ? task->name : "", flsk->meta->name, flsk->sockfd);
+  flsk->connect_complete_method(flsk);
+}
+
+static void fl_socket_nb_connect_timeout(const char *timer_name,
+                                         void *app_data)
+{
+  register fl_socket_t *flsk = app_data;
+  register fl_task_t *task = flsk->task;
+  struct sockaddr sa_unspec;
+  char addrstr[FL_SOCKADDR_STR_MAX_LEN] = { 0 };
+
+  FL_ASSERT(FL_TEST_BIT(flsk->flags, FL_SOCKF_CONNECTING));
+  FL_LOGR_ERR("Attempt to connect to %s:%d on socket (%s, %s, %d) timed out "
+              "(%s)",
+              fl_sockaddr_ntop(&flsk->meta->sa_remote, addrstr, sizeof(addrstr)),
+              fl_sockaddr_port_hbo(&flsk->meta->sa_remote),
+              (task) ? task->name : "", flsk->meta->name, flsk->sockfd, timer_name);
+
+  /* The timer is deleted here, timer_name must not be accessed anymore. */
+  fl_socket_nb_connect_end(flsk);
+
+  /* Stop watching the sockfd, also in the current set of ready fds, and
+   * abort the attempt by dissolving the association. With the scheduler, the
+   * fd may already be cleared and the write pending in the run queue.
+   */
+  if (fl_fd_isset(flsk->sockfd, FL_FD_OP_WRITE)) {
+    FL_FD_CLR(flsk->sockfd, FL_FD_OP_WRITE);
+  }
+  fl_fd_clrready(flsk->sockfd, FL_FD_OP_WRITE, &exec_wbits);
+  flsk->sched_ops &= ~FL_SOCKET_SCHED_WRITE;
+  if (!flsk->sched_ops) {
+    fl_sched_event_cancel(&flsk->sched_event);
+  }
+  memset(&sa_unspec, 0, sizeof(sa_unspec));
+  sa_unspec.sa_family = AF_UNSPEC;
+  (void) connect(flsk->sockfd, &sa_unspec, sizeof(sa_unspec));
+
+  flsk->connect_error_method(flsk, ETIMEDOUT);
+}
+
 static ssize_t fl_socket_recvfrom(fl_socket_t *flsk, void *buf, size_t len,
                                   struct sockaddr_storage *src_addr,
                                   socklen_t *addrlen)
@@ -1269,7 +2902,7 @@ static ssize_t fl_socket_recvfrom(fl_socket_t *flsk, void *buf, size_t len,
   if (rc == -1) {
     FL_LOGR_ERR("recvfrom on socket (%s, %s, %d) failed, "
                 "error %d <%s>",
-                (flsk->task) ? flsk->task->name : "", flsk->name,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name,
                 flsk->sockfd, save_errno, strerror(save_errno));
   }
 
@@ -1292,7 +2925,7 @@ static ssize_t fl_socket_recvmsg(fl_socket_t *flsk, struct msghdr *msg)
   if (rc == -1) {
     FL_LOGR_ERR("recvmsg on socket (%s, %s, %d) failed, "
                 "error %d <%s>",
-                (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                 save_errno, strerror(save_errno));
   }
 
@@ -1315,7 +2948,7 @@ static ssize_t fl_socket_recv(fl_socket_t *flsk, void *buf, size_t len)
   if (rc == -1) {
     FL_LOGR_ERR("recv on socket (%s, %s, %d) failed, "
                 "error %d <%s>",
-                (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                 save_errno, strerror(save_errno));
   }
 
@@ -1343,7 +2976,7 @@ static ssize_t fl_socket_sendto(fl_socket_t *flsk, const void *buf, size_t len,
                 "error %d <%s>",
                 fl_sockaddr_ntop(dest_addr, addrstr, INET6_ADDRSTRLEN),
                 fl_sockaddr_port_hbo(dest_addr),
-                (int) len, (flsk->task) ? flsk->task->name : "", flsk->name,
+                (int) len, (flsk->task) ? flsk->task->name : "", flsk->meta->name,
                 flsk->sockfd, save_errno, strerror(save_errno));
   }
 
@@ -1365,7 +2998,7 @@ static ssize_t fl_socket_sendmsg(fl_socket_t *flsk, const struct msghdr *msg)
 
   if (rc == -1) {
     FL_LOGR_ERR("sendmsg on socket (%s, %s, %d) failed, error %d <%s>",
-                (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                 save_errno, strerror(save_errno));
   }
 
@@ -1389,11 +3022,11 @@ static ssize_t fl_socket_send(fl_socket_t *flsk, const void *buf, size_t len)
   if (rc == -1) {
     FL_LOGR_ERR("send to %s:%d (%d bytes) on socket (%s, %s, %d) failed, "
                 "error %d <%s>",
-                fl_sockaddr_ntop(&flsk->sa_remote, addrstr,
+                fl_sockaddr_ntop(&flsk->meta->sa_remote, addrstr,
                                  INET6_ADDRSTRLEN),
-                fl_sockaddr_port_hbo(&flsk->sa_remote),
+                fl_sockaddr_port_hbo(&flsk->meta->sa_remote),
                 (int) len,
-                (flsk->task) ? flsk->task->name : "", flsk->name, flsk->sockfd,
+                (flsk->task) ? flsk->task->name : "", flsk->meta->name, flsk->sockfd,
                 save_errno, strerror(save_errno));
   }
 
@@ -32,16 +32,45 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <string.h>
 
+#include "falco/fl_defs.h"
 #include "falco/fl_stdlib.h"
 #include "falco/fl_task.h"
 #include "falco/fl_socket.h"
 #include "falco/fl_timer.h"
+#include "falco/fl_pool.h"
 
-static LIST_HEAD(fl_tasks_, fl_task_t_) fl_tasks;
+static FL_LOOP_LOCAL LIST_HEAD(fl_tasks_, fl_task_t_) fl_tasks;
+
+static const values_t fl_task_priorities[] = {
+  { FL_SCHED_PRIORITY_HIGH,   "High"   },
+  { FL_SCHED_PRIORITY_MEDIUM, "Medium" },
+  { FL_SCHED_PRIORITY_LOW,    "Low"    },
+  { 0, NULL }
+};
+static FL_LOOP_LOCAL fl_pool_t *fl_task_pool;
+static u_int32_t fl_task_pool_nprewarm;
+
+int fl_task_cfg_prewarm(u_int32_t ntasks)
+{
+  fl_task_pool_nprewarm = ntasks;
+  if (fl_task_pool) {
+    return fl_pool_prewarm(fl_task_pool, ntasks);
+  }
+
+  return 0;
+}
 
 int fl_task_module_init(void)
 {
   LIST_INIT(&fl_tasks);
+  if (!fl_task_pool) {
+    fl_task_pool = fl_pool_create("Task", sizeof(fl_task_t), 0, 0);
+    if (!fl_task_pool ||
+        (fl_pool_prewarm(fl_task_pool, fl_task_pool_nprewarm) < 0)) {
+      FL_LOGR_ERR("Task pool creation failed");
+      return -1;
+    }
+  }
 
   FL_LOGR_INFO("Falco Task module initialized");
   return 0;
@@ -67,21 +96,24 @@ int fl_task_module_dump(FILE *fd)
     ntimers = nsockets = 0;
 
     fprintf(fd, "Name: %s\n", task_li->name);
-    fprintf(fd, "    reinit method: %s\n",
+    fprintf(fd, "    priority:         %s\n",
+            fl_trace_value(fl_task_priorities, task_li->priority));
+    fprintf(fd, "    reinit method:    %s\n",
             (task_li->reinit_method) ? "yes" : "no");
-    fprintf(fd, "    reinit method: %s\n",
+    fprintf(fd, "    terminate method: %s\n",
             (task_li->terminate_method) ? "yes" : "no");
-    fprintf(fd, "    dump method:   %s\n",
+    fprintf(fd, "    dump method:      %s\n",
             (task_li->dump_method) ? "yes" : "no");
 
     LIST_FOREACH(task_timer_li, &task_li->task_timers, task_timer_lc) {
       ntimers++;
     }
     LIST_FOREACH(task_socket_li, &task_li->task_sockets, task_socket_lc) {
-      ntimers++;
+      nsockets++;
     }
 
     fprintf(fd, "    %d timers, %d sockets\n", ntimers, nsockets);
+    fl_hist_dump(fd, "    method time:      ", task_li->hist);
     fprintf(fd, "\n");
   }
 
@@ -94,12 +126,13 @@ fl_task_t *fl_task_create(const char *name)
 
   FL_ASSERT(name && strlen(name) && (strlen(name) < FL_TASK_NAME_MAX_LEN));
 
-  FL_ALLOC(fl_task_t, 1, task, "Task");
+  FL_POOL_ALLOC(fl_task_t, fl_task_pool, task, "Task");
   if (!task) {
     return NULL;
   }
 
   (void) strcpy(task->name, name);
+  task->priority = FL_SCHED_PRIORITY_MEDIUM;
   if (LIST_EMPTY(&fl_tasks)) {
     LIST_INSERT_HEAD(&fl_tasks, task, task_lc);
   } else {
@@ -120,7 +153,7 @@ fl_task_t *fl_task_create(const char *name)
   LIST_INIT(&task->task_timers);
   LIST_INIT(&task->task_sockets);
 
-  return NULL;
+  return task;
 }
 
 int fl_task_delete(fl_task_t *task)
@@ -128,6 +161,35 @@ int fl_task_delete(fl_task_t *task)
   return -1;
 }
 
+int fl_task_set_priority(fl_task_t *task, fl_sched_priority_e priority)
+{
+  if (!task || (priority < 0) || (priority >= FL_SCHED_PRIORITY_MAX)) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("Invalid task priority (%d) configuration", priority);
+    return -1;
+  }
+
+  if (task->priority != priority) {
+    FL_LOGR_INFO("Task %s priority changed from %s -> %s", task->name,
+                 fl_trace_value(fl_task_priorities, task->priority),
+                 fl_trace_value(fl_task_priorities, priority));
+    task->priority = priority;
+  }
+  return 0;
+}
+
+int fl_task_get_hist(const fl_task_t *task, fl_hist_snapshot_t *snap)
+{
+  if (!task || !snap) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("Invalid request for a task histogram");
+    return -1;
+  }
+
+  fl_hist_snapshot(task->hist, snap);
+  return 0;
+}
+
 fl_task_t *fl_task_validate_taskptr(fl_task_t *task)
 {
   register fl_task_t *task_li;
@@ -143,8 +205,23 @@ fl_task_t *fl_task_validate_taskptr(fl_task_t *task)
 
 void fl_tasks_reinit()
 {
+  register fl_task_t *task_li;
+
+  LIST_FOREACH(task_li, &fl_tasks, task_lc) {
+    if (task_li->reinit_method) {
+      task_li->reinit_method(task_li);
+    }
+  }
 }
 
 void fl_tasks_terminate()
 {
+  register fl_task_t *task_li, *task_next;
+
+  for (task_li = LIST_FIRST(&fl_tasks); task_li; task_li = task_next) {
+    task_next = LIST_NEXT(task_li, task_lc);
+    if (task_li->terminate_method) {
+      task_li->terminate_method(task_li);
+    }
+  }
 }
@@ -33,20 +33,130 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "falco/fl_defs.h"
 #include "falco/fl_stdlib.h"
 #include "falco/fl_timer.h"
 #include "falco/fl_logr.h"
 #include "falco/fl_fds.h"
+#include "falco/fl_pool.h"
+
+#define FL_TIMER_WHEEL_SLOT_MASK   (FL_TIMER_WHEEL_SLOTS - 1)
+#define FL_TIMER_WHEEL_BITMAP_LEN  (FL_TIMER_WHEEL_SLOTS / 64)
+/* Maximum number of ticks a timer can be away from the current tick. Timers
+ * further away are parked in the last level and reinserted when cascaded.
+ */
+#define FL_TIMER_WHEEL_MAX_TICKS                                        \
+  ((((u_int64_t) 1) << (FL_TIMER_WHEEL_LEVELS * FL_TIMER_WHEEL_SLOT_BITS)) - 1)
+#define FL_TIMER_WHEEL_NO_TICK     UINT64_MAX
+
+#define FL_TIMER_LEVEL_SHIFT(_l_)  ((_l_) * FL_TIMER_WHEEL_SLOT_BITS)
+
+#define FL_TIMER_IS_ONESHOT(_t_)                                        \
+  (!(_t_)->its.it_interval.tv_sec && !(_t_)->its.it_interval.tv_nsec)
+
+/**
+ * @brief Hierarchical timing wheel.
+ *
+ * Level l has FL_TIMER_WHEEL_SLOTS slots, each slot spanning
+ * FL_TIMER_WHEEL_SLOTS^l ticks. Timers are inserted in the level that covers
+ * their distance from the current tick, and are cascaded to the lower levels
+ * as the current tick advances.
+ */
+typedef struct fl_timer_wheel_t_ {
+  int timerfd; ///< Single timerfd that drives the wheel
+  struct timespec base; ///< Monotonic time of tick 0
+  u_int64_t now; ///< Current tick, i.e. the wheel has been processed up to it
+  u_int64_t armed; ///< Tick for which the timerfd is armed
+  u_int32_t ntimers; ///< Number of timers that are armed
+  u_int64_t bitmap[FL_TIMER_WHEEL_LEVELS][FL_TIMER_WHEEL_BITMAP_LEN];
+  TAILQ_HEAD(fl_timer_slot_, fl_timer_t_) slots[FL_TIMER_WHEEL_LEVELS][FL_TIMER_WHEEL_SLOTS];
+  struct fl_timer_slot_ expired; ///< Timers expired and pending dispatch
+
+  /* Stats */
+  u_int64_t nwakeups; ///< Number of times the timerfd has fired
+  u_int64_t nexpired; ///< Number of timer expirations dispatched
+  u_int32_t max_batch; ///< Largest number of timers dispatched in one wakeup
+} fl_timer_wheel_t;
+
+static FL_LOOP_LOCAL LIST_HEAD(fl_timers_, fl_timer_t_) fl_timers;
+static FL_LOOP_LOCAL fl_timer_wheel_t fl_timer_wheel = { .timerfd = -1 };
+static FL_LOOP_LOCAL fl_pool_t *fl_timer_pool;
+static u_int32_t fl_timer_pool_nprewarm;
+#if (defined(ENABLE_INSTRUMENTATION))
+/* Timer whose method is running. Reset when the timer is deleted by the
+ * method, so that its histogram is not touched.
+ */
+static FL_LOOP_LOCAL fl_timer_t *fl_timer_invoking;
+#endif /* ENABLE_INSTRUMENTATION */
+
+static u_int64_t fl_timer_ts_to_ticks(const struct timespec *ts);
+static u_int64_t fl_timer_wheel_current_tick(fl_timer_wheel_t *wheel);
+static void fl_timer_wheel_insert(fl_timer_wheel_t *wheel, fl_timer_t *timer);
+static void fl_timer_wheel_remove(fl_timer_wheel_t *wheel, fl_timer_t *timer);
+static u_int64_t fl_timer_wheel_next_tick(fl_timer_wheel_t *wheel);
+static void fl_timer_wheel_advance(fl_timer_wheel_t *wheel, u_int64_t target);
+static int fl_timer_wheel_arm(fl_timer_wheel_t *wheel, u_int64_t tick);
+static void fl_timer_dispatch(fl_timer_t *timer);
+static void fl_timer_invoke(fl_timer_t *timer);
+static void fl_timer_sched_dispatch(fl_sched_event_t *event);
+#if (defined(ENABLE_INSTRUMENTATION))
+static u_int64_t fl_timer_tick_to_ns(fl_timer_wheel_t *wheel, u_int64_t tick);
+#endif /* ENABLE_INSTRUMENTATION */
 
-static LIST_HEAD(fl_timers_, fl_timer_t_) fl_timers;
+int fl_timer_cfg_prewarm(u_int32_t ntimers)
+{
+  fl_timer_pool_nprewarm = ntimers;
+  if (fl_timer_pool) {
+    return fl_pool_prewarm(fl_timer_pool, ntimers);
+  }
 
-static void fl_timer_dispatch(fl_timer_t *timer);
+  return 0;
+}
 
 int fl_timer_module_init()
 {
+  fl_timer_wheel_t *wheel = &fl_timer_wheel;
+  register int l, s;
+
   LIST_INIT(&fl_timers);
+  if (!fl_timer_pool) {
+    fl_timer_pool = fl_pool_create("Timer", sizeof(fl_timer_t), 0, 0);
+    if (!fl_timer_pool ||
+        (fl_pool_prewarm(fl_timer_pool, fl_timer_pool_nprewarm) < 0)) {
+      FL_LOGR_ERR("Timer pool creation failed");
+      return -1;
+    }
+  }
+
+  for (l = 0; l < FL_TIMER_WHEEL_LEVELS; l++) {
+    for (s = 0; s < FL_TIMER_WHEEL_SLOTS; s++) {
+      TAILQ_INIT(&wheel->slots[l][s]);
+    }
+  }
+  TAILQ_INIT(&wheel->expired);
+  memset(wheel->bitmap, 0, sizeof(wheel->bitmap));
+
+  if (clock_gettime(CLOCK_MONOTONIC, &wheel->base) < 0) {
+    FL_LOGR_ERR("Timer wheel could not read the monotonic clock, error <%s>",
+                strerror(errno));
+    return -1;
+  }
+
+  wheel->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (wheel->timerfd < 0) {
+    FL_LOGR_ERR("Timer wheel timerfd creation failed, error <%s>",
+                strerror(errno));
+    return -1;
+  }
+
+  /* The wheel timerfd is always selected for read, it is only readable when
+   * it is armed and has fired.
+   */
+  fl_fds_set_owner(wheel->timerfd, FL_FD_OWNER_TIMER, wheel);
+  FL_FD_SET(wheel->timerfd, FL_FD_OP_READ);
 
   FL_LOGR_INFO("Falco Timer module initialized");
   return 0;
@@ -54,26 +164,41 @@ int fl_timer_module_init()
 
 int fl_timer_module_dump(FILE *fd)
 {
+  fl_timer_wheel_t *wheel = &fl_timer_wheel;
   register fl_timer_t *li;
 
   fprintf(fd, "\n--------------------------------------------------------------------------------\n");
   fprintf(fd, "Timers\n");
   fprintf(fd, "--------------------------------------------------------------------------------\n\n");
 
+  fprintf(fd, "    Timer wheel (%d): %u timers armed, tick %llu, "
+          "armed for tick %llu\n", wheel->timerfd, wheel->ntimers,
+          (unsigned long long) wheel->now,
+          (unsigned long long) wheel->armed);
+  fprintf(fd, "    %llu wakeups, %llu expirations, largest batch %u\n\n",
+          (unsigned long long) wheel->nwakeups,
+          (unsigned long long) wheel->nexpired, wheel->max_batch);
+
   if (LIST_EMPTY(&fl_timers)) {
     fprintf(fd, "    No timers are currently present\n");
     return 0;
   }
 
   LIST_FOREACH(li, &fl_timers, timer_lc) {
-    fprintf(fd, "Name: %s(%d)\n", li->name, li->timerfd);
+    fprintf(fd, "Name: %s\n", li->name);
     if (li->task) {
       fprintf(fd, "      Task: %s\n", li->task->name);
     }
-    fprintf(fd, "      when: %d seconds, interval: %d seconds, %s\n",
-            li->fire_when, li->fire_interval,
-            fl_fd_isset(li->timerfd, FL_FD_OP_READ) ? "armed" : "disarmed");
+    fprintf(fd, "      when: %ld.%03ld seconds, interval: %ld.%03ld seconds, "
+            "%s%s\n",
+            (long) li->its.it_value.tv_sec, li->its.it_value.tv_nsec / 1000000L,
+            (long) li->its.it_interval.tv_sec,
+            li->its.it_interval.tv_nsec / 1000000L,
+            FL_TEST_BIT(li->flags, FL_TIMERF_ARMED) ? "armed" : "disarmed",
+            FL_TIMER_IS_ONESHOT(li) ? ", one-shot" : "");
     fprintf(fd, "      %d dispatches\n", li->ndispatches);
+    fl_hist_dump(fd, "      method time: ", li->hist[FL_TIMER_HIST_DURATION]);
+    fl_hist_dump(fd, "      lateness:    ", li->hist[FL_TIMER_HIST_LATENESS]);
   }
 
   return 0;
@@ -82,73 +207,75 @@ int fl_timer_module_dump(FILE *fd)
 void *fl_timer_create(fl_task_t *task, int fire_when, int fire_interval,
                       fl_app_timer_method_t timer_method,
                       const char *timer_name, void *app_data)
+{
+  struct itimerspec its;
+
+  FL_ASSERT((fire_when > 0) && (fire_interval >= 0));
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = fire_when;
+  its.it_interval.tv_sec = fire_interval;
+
+  return fl_timer_create_its(task, &its, timer_method, timer_name, app_data);
+}
+
+void *fl_timer_create_ms(fl_task_t *task, u_int32_t fire_when_ms,
+                         u_int32_t fire_interval_ms,
+                         fl_app_timer_method_t timer_method,
+                         const char *timer_name, void *app_data)
+{
+  struct itimerspec its;
+
+  its.it_value.tv_sec = fire_when_ms / 1000;
+  its.it_value.tv_nsec = (fire_when_ms % 1000) * 1000000L;
+  its.it_interval.tv_sec = fire_interval_ms / 1000;
+  its.it_interval.tv_nsec = (fire_interval_ms % 1000) * 1000000L;
+
+  return fl_timer_create_its(task, &its, timer_method, timer_name, app_data);
+}
+
+void *fl_timer_create_its(fl_task_t *task, const struct itimerspec *its,
+                          fl_app_timer_method_t timer_method,
+                          const char *timer_name, void *app_data)
 {
   register fl_timer_t *timer;
 
-  FL_ASSERT((fire_interval > 0) && (fire_when == fire_interval));
+  FL_ASSERT(its && (its->it_value.tv_sec || its->it_value.tv_nsec));
   FL_ASSERT(timer_method);
   FL_ASSERT(timer_name && strlen(timer_name) &&
             (strlen(timer_name) < FL_TIMER_NAME_MAX_LEN));
+  if (!its || (!its->it_value.tv_sec && !its->it_value.tv_nsec) ||
+      (its->it_value.tv_sec < 0) || (its->it_interval.tv_sec < 0)) {
+    FL_LOGR_ERR("Request to create timer (%s) with an invalid expiration",
+                (timer_name) ? timer_name : "");
+    return NULL;
+  }
   FL_LOGR_DEBUG("Request to create timer (%s)"
-                "[fire at %d seconds, interval %d seconds]",
-                timer_name, fire_when, fire_interval);
+                "[fire at %ld.%09ld seconds, interval %ld.%09ld seconds]",
+                timer_name,
+                (long) its->it_value.tv_sec, its->it_value.tv_nsec,
+                (long) its->it_interval.tv_sec, its->it_interval.tv_nsec);
 
-  FL_ALLOC(fl_timer_t, 1, timer, "Timer");
+  FL_POOL_ALLOC(fl_timer_t, fl_timer_pool, timer, "Timer");
   if (!timer) {
     FL_LOGR_CRIT("%s(%s): Could not allocate memory for Timer",
                  __func__, timer_name);
     return NULL;
   }
 
-  timer->timerfd = timerfd_create(CLOCK_MONOTONIC, 0);
-  if (timer->timerfd < 0) {
-    FL_LOGR_ERR("Timer (%s) creation failed, error <%s>", timer_name,
-                strerror(errno));
-    FL_FREE(timer, "Timer");
-    return NULL;
-  }
-
-  timer->fire_when = fire_when;
-  timer->fire_interval = fire_interval;
+  timer->its = *its;
+  timer->fire_when = its->it_value.tv_sec;
+  timer->fire_interval = its->it_interval.tv_sec;
   timer->timer_method = timer_method;
   timer->app_data = app_data;
   (void) strcpy(timer->name, timer_name);
+  fl_sched_event_init(&timer->sched_event, fl_timer_sched_dispatch, timer);
 
-  if (LIST_EMPTY(&fl_timers)) {
-    LIST_INSERT_HEAD(&fl_timers, timer, timer_lc);
-  } else {
-    fl_timer_t *timer_li;
-
-    LIST_FOREACH(timer_li, &fl_timers, timer_lc) {
-      if (timer_li->timerfd > timer->timerfd) {
-        LIST_INSERT_BEFORE(timer_li, timer, timer_lc);
-        break;
-      }
-      if (LIST_NEXT(timer_li, timer_lc) == NULL) {
-        LIST_INSERT_AFTER(timer_li, timer, timer_lc);
-        break;
-      }
-    }
-  }
+  LIST_INSERT_HEAD(&fl_timers, timer, timer_lc);
 
   if (task) {
     if (fl_task_validate_taskptr(task)) {
-      if (LIST_EMPTY(&task->task_timers)) {
-        LIST_INSERT_HEAD(&task->task_timers, timer, task_timer_lc);
-      } else {
-        fl_timer_t *timer_li;
-
-        LIST_FOREACH(timer_li, &task->task_timers, task_timer_lc) {
-          if (timer_li->timerfd > timer->timerfd) {
-            LIST_INSERT_BEFORE(timer_li, timer, task_timer_lc);
-            break;
-          }
-          if (LIST_NEXT(timer_li, task_timer_lc) == NULL) {
-            LIST_INSERT_AFTER(timer_li, timer, task_timer_lc);
-            break;
-          }
-        }
-      }
+      LIST_INSERT_HEAD(&task->task_timers, timer, task_timer_lc);
       timer->task = task;
     } else {
       FL_LOGR_WARNING("Request to associate timer (%s) with an unrecognized "
@@ -156,16 +283,17 @@ void *fl_timer_create(fl_task_t *task, int fire_when, int fire_interval,
     }
   }
 
-  FL_LOGR_DEBUG("Created timer (%s, %s, %d)"
-                "[fire at %d seconds, interval %d seconds]",
-                (task) ? task->name : "", timer_name, timer->timerfd,
-                fire_when, fire_interval);
+  FL_LOGR_DEBUG("Created timer (%s, %s)%s",
+                (task) ? task->name : "", timer_name,
+                (FL_TIMER_IS_ONESHOT(timer)) ? " [one-shot]" : "");
   return timer;
 }
 
 int fl_timer_start(fl_timer_t *timer, void *app_data)
 {
+  fl_timer_wheel_t *wheel = &fl_timer_wheel;
   fl_task_t *task;
+  u_int64_t now;
 
   if (!timer) {
     FL_ASSERT(timer);
@@ -177,63 +305,63 @@ int fl_timer_start(fl_timer_t *timer, void *app_data)
 
   if (app_data) {
     if (timer->app_data) {
-      FL_LOGR_NOTICE("Timer (%s, %s, %d) application data overwritten",
-                     (task) ? task->name : "", timer->name, timer->timerfd);
+      FL_LOGR_NOTICE("Timer (%s, %s) application data overwritten",
+                     (task) ? task->name : "", timer->name);
     }
     timer->app_data = app_data;
   }
 
-  timer->its.it_value.tv_sec = timer->fire_when;
-  timer->its.it_interval.tv_sec = timer->fire_interval;
-  if (timerfd_settime(timer->timerfd, 0, &(timer->its), NULL) < 0) {
-    int save_errno = errno;
-    FL_LOGR_ERR("Starting timer (%s, %s, %d) failed, error <%s>",
-                (task) ? task->name : "", timer->name, timer->timerfd,
-                strerror(save_errno));
-    return -save_errno;
+  if (FL_TEST_BIT(timer->flags, FL_TIMERF_ARMED)) {
+    fl_timer_wheel_remove(wheel, timer);
   }
 
-  fl_fds_set_max_fd(timer->timerfd);
-  FL_FD_SET(timer->timerfd, FL_FD_OP_READ);
+  now = fl_timer_wheel_current_tick(wheel);
+  if (!wheel->ntimers && (now > wheel->now)) {
+    /* Nothing is pending in the wheel, let it catch up with the clock. */
+    wheel->now = now;
+  }
+  timer->expires = now + fl_timer_ts_to_ticks(&timer->its.it_value);
+  fl_timer_wheel_insert(wheel, timer);
+
+  if (!wheel->armed || (timer->expires < wheel->armed)) {
+    if (fl_timer_wheel_arm(wheel, fl_timer_wheel_next_tick(wheel)) < 0) {
+      int save_errno = errno;
+      FL_LOGR_ERR("Starting timer (%s, %s) failed, error <%s>",
+                  (task) ? task->name : "", timer->name, strerror(save_errno));
+      fl_timer_wheel_remove(wheel, timer);
+      return -save_errno;
+    }
+  }
 
   return 0;
 }
 
 int fl_timer_stop(fl_timer_t *timer)
 {
-  fl_task_t *task;
-
   if (!timer) {
     FL_ASSERT(timer);
     FL_LOGR_ERR("Request to stop an invalid (NULL) timer");
     return -1;
   }
 
-  FL_ASSERT(fl_fd_isset(timer->timerfd, FL_FD_OP_READ));
-  FL_FD_CLR(timer->timerfd, FL_FD_OP_READ);
-
-  task = timer->task;
-
-  timer->its.it_value.tv_sec = 0;
-  timer->its.it_interval.tv_sec = 0;
-  if (timerfd_settime(timer->timerfd, 0, &(timer->its), NULL) < 0) {
-    int save_errno = errno;
-    FL_LOGR_ERR("Stopping timer (%s, %s, %d) failed, error <%s>",
-                (task) ? task->name : "", timer->name, timer->timerfd,
-                strerror(save_errno));
-    return -save_errno;
+  if (!FL_TEST_BIT(timer->flags, FL_TIMERF_ARMED)) {
+    return 0;
   }
 
+  /* The wheel timerfd is left armed. If this was the earliest timer, the
+   * next wakeup finds nothing to dispatch and rearms for the next expiry.
+   */
+  fl_timer_wheel_remove(&fl_timer_wheel, timer);
+  fl_sched_event_cancel(&timer->sched_event);
+
   return 0;
 }
 
 int fl_timer_delete(fl_timer_t *timer)
 {
-  register fl_timer_t *timer_li;
   fl_task_t *task;
-
   char name[FL_TIMER_NAME_MAX_LEN] = { 0 };
-  int fd, rc;
+  register int h;
 
   if (!timer) {
     FL_ASSERT(timer);
@@ -241,91 +369,401 @@ int fl_timer_delete(fl_timer_t *timer)
     return -1;
   }
 
-  LIST_FOREACH(timer_li, &fl_timers, timer_lc) {
-    if (timer_li == timer) {
-      break;
-    }
-  }
-  if (!timer_li) {
-    FL_ASSERT(timer_li);
-    FL_LOGR_ERR("Request to delete timer (%s) not in list", timer->name);
-    return -1;
-  }
-
   task = timer->task;
-
   (void) strcpy(name, timer->name);
-  fd = timer->timerfd;
 
-  rc = close(fd);
-  if (rc < 0) {
-    FL_LOGR_ERR("Closing timer (%s, %s, %d) failed, error <%s>. "
-                "Shall proceed to delete timer.",
-                (task) ? task->name : "", name, fd, strerror(errno));
+  if (FL_TEST_BIT(timer->flags, FL_TIMERF_ARMED)) {
+    fl_timer_wheel_remove(&fl_timer_wheel, timer);
   }
+  fl_sched_event_cancel(&timer->sched_event);
 
   LIST_REMOVE(timer, timer_lc);
-  FL_FREE(timer, "Timer");
+  if (task) {
+    LIST_REMOVE(timer, task_timer_lc);
+  }
+#if (defined(ENABLE_INSTRUMENTATION))
+  if (fl_timer_invoking == timer) {
+    fl_timer_invoking = NULL;
+  }
+#endif /* ENABLE_INSTRUMENTATION */
+  for (h = 0; h < FL_TIMER_HIST_MAX; h++) {
+    if (timer->hist[h]) {
+      fl_hist_delete(timer->hist[h]);
+    }
+  }
+  FL_POOL_FREE(fl_timer_pool, timer, "Timer");
 
-  FL_LOGR_DEBUG("Deleted timer (%s, %s, %d)", (task) ? task->name : "",
-                name, fd);
-  return rc;
+  FL_LOGR_DEBUG("Deleted timer (%s, %s)", (task) ? task->name : "", name);
+  return 0;
+}
+
+int fl_timer_get_hist(const fl_timer_t *timer, fl_timer_hist_e which,
+                      fl_hist_snapshot_t *snap)
+{
+  if (!timer || (which < 0) || (which >= FL_TIMER_HIST_MAX) || !snap) {
+    FL_ASSERT(0);
+    FL_LOGR_ERR("Invalid request for a timer histogram (%d)", which);
+    return -1;
+  }
+
+  fl_hist_snapshot(timer->hist[which], snap);
+  return 0;
 }
 
 void fl_timers_dispatch(int *nfds, fd_set *fds)
 {
-  int save_nfds = *nfds;
+  fl_timer_wheel_t *wheel = &fl_timer_wheel;
   register fl_timer_t *timer;
-  register int timerfd;
+  u_int32_t nbatch = 0;
+  u_int64_t nexp;
+  ssize_t rlen;
 
   FL_ASSERT((*nfds) >= 0);
 
-  LIST_FOREACH(timer, &fl_timers, timer_lc) {
-    timerfd = timer->timerfd;
+  if ((wheel->timerfd < 0) ||
+      !fl_fd_isready(wheel->timerfd, FL_FD_OP_READ, fds)) {
+    return;
+  }
 
-    if (!FD_ISSET(timerfd, fds)) {
-      continue;
+  (*nfds)--;
+  /* We do not clear the wheel timerfd from the read operation (i.e.
+   * select_rbits). We only clear it from the exec_bits here.
+   */
+  fl_fd_clrready(wheel->timerfd, FL_FD_OP_READ, fds);
+
+  rlen = read(wheel->timerfd, &nexp, sizeof(uint64_t));
+  if ((rlen != sizeof(uint64_t)) && (errno != EAGAIN)) {
+    int save_errno = errno;
+    FL_LOGR_ERR("Timer wheel (%d) failed to read expirations, error %d, <%s>",
+                wheel->timerfd, save_errno, strerror(save_errno));
+  }
+  wheel->nwakeups++;
+  wheel->armed = 0;
+
+  fl_timer_wheel_advance(wheel, fl_timer_wheel_current_tick(wheel));
+
+  /* Timers are taken off the expired list one at a time, so that a timer
+   * method can stop or delete any other timer of this batch.
+   */
+  while ((timer = TAILQ_FIRST(&wheel->expired))) {
+    TAILQ_REMOVE(&wheel->expired, timer, wheel_lc);
+    FL_RESET_BIT(timer->flags, FL_TIMERF_EXPIRED | FL_TIMERF_ARMED);
+    wheel->ntimers--;
+#if (defined(ENABLE_INSTRUMENTATION))
+    timer->due_ns = fl_timer_tick_to_ns(wheel, timer->expires);
+#endif /* ENABLE_INSTRUMENTATION */
+
+    if (!FL_TIMER_IS_ONESHOT(timer)) {
+      u_int64_t interval = fl_timer_ts_to_ticks(&timer->its.it_interval);
+      u_int64_t noverruns = 0;
+
+      timer->expires += interval;
+      if (timer->expires <= wheel->now) {
+        noverruns = ((wheel->now - timer->expires) / interval) + 1;
+        timer->expires += noverruns * interval;
+      }
+      if (noverruns) {
+        FL_LOGR_ERR("Timer dispatch (%s, %s) detected %llu expirations",
+                    (timer->task) ? timer->task->name : "", timer->name,
+                    (unsigned long long) (noverruns + 1));
+      }
+      fl_timer_wheel_insert(wheel, timer);
     }
 
-    FL_ASSERT(fl_fd_isset(timerfd, FL_FD_OP_READ));
-    (*nfds)--;
-    /* We do not clear timer fd from the read operation (i.e. select_rbits).
-     * We only clear it from the exec_bits here.
-     */
-    FD_CLR(timerfd, fds);
     fl_timer_dispatch(timer);
+    nbatch++;
+  }
+
+  wheel->nexpired += nbatch;
+  if (nbatch > wheel->max_batch) {
+    wheel->max_batch = nbatch;
+  }
+
+  if (wheel->ntimers) {
+    (void) fl_timer_wheel_arm(wheel, fl_timer_wheel_next_tick(wheel));
   }
 
-  if (save_nfds && ((save_nfds - *nfds) > 0)) {
-    FL_LOGR_DEBUG("Processed %d timers", (save_nfds - *nfds));
+  if (nbatch) {
+    FL_LOGR_DEBUG("Processed %u timers", nbatch);
   }
 }
 
+static void fl_timer_sched_dispatch(fl_sched_event_t *event)
+{
+  fl_timer_invoke(event->owner);
+}
+
 static void fl_timer_dispatch(fl_timer_t *timer)
 {
-  register int fd = timer->timerfd;
+  if (fl_sched_enabled()) {
+    /* A periodic timer that expires again before it is dispatched is
+     * dispatched once.
+     */
+    fl_sched_event_queue(&timer->sched_event, FL_TASK_PRIORITY(timer->task));
+    return;
+  }
+
+  fl_timer_invoke(timer);
+}
+
+static void fl_timer_invoke(fl_timer_t *timer)
+{
   register fl_task_t *task = timer->task;
-  ssize_t rlen;
-  uint64_t nexp;
+  FL_HIST_NOW(start);
 
-  rlen = read(fd, &nexp, sizeof(uint64_t));
-  if (rlen != sizeof(uint64_t)) {
-    int save_errno = errno;
-    FL_LOGR_ERR("Timer dispatch (%s, %s, %d) failed to read expirations, "
-                "error %d, <%s>", (task) ? task->name : "", timer->name, fd,
-                save_errno, strerror(save_errno));
+  FL_LOGR_DEBUG("Timer dispatch (%s, %s) method started",
+                (task) ? task->name : "", timer->name);
+  timer->ndispatches++;
+#if (defined(ENABLE_INSTRUMENTATION))
+  FL_HIST_RECORD(&timer->hist[FL_TIMER_HIST_LATENESS],
+                 (start > timer->due_ns) ? (start - timer->due_ns) : 0);
+  fl_timer_invoking = timer;
+#endif /* ENABLE_INSTRUMENTATION */
+  timer->timer_method(timer->name, timer->app_data);
+  /* The timer may have been deleted by its method, it must not be accessed
+   * any further.
+   */
+#if (defined(ENABLE_INSTRUMENTATION))
+  {
+    u_int64_t elapsed = fl_hist_now_ns() - start;
+
+    if (fl_timer_invoking == timer) {
+      FL_HIST_RECORD(&timer->hist[FL_TIMER_HIST_DURATION], elapsed);
+      fl_timer_invoking = NULL;
+    }
+    if (task) {
+      FL_HIST_RECORD(&task->hist, elapsed);
+    }
   }
+#endif /* ENABLE_INSTRUMENTATION */
+}
+
+#if (defined(ENABLE_INSTRUMENTATION))
+/* Monotonic time (in nanoseconds) of a tick of the timing wheel */
+static u_int64_t fl_timer_tick_to_ns(fl_timer_wheel_t *wheel, u_int64_t tick)
+{
+  return ((u_int64_t) wheel->base.tv_sec * 1000000000ULL) +
+    wheel->base.tv_nsec + (tick * FL_TIMER_WHEEL_TICK_MS * 1000000ULL);
+}
+#endif /* ENABLE_INSTRUMENTATION */
 
-  if (nexp > 1) {
-    FL_LOGR_ERR("Timer dispatch (%s, %s, %d) detected %llu expirations",
-                (task) ? task->name : "", timer->name, fd,
-                (unsigned long long) nexp);
+/* Convert a relative time to ticks, rounding up so that a timer never fires
+ * before the requested time. A non zero time is at least one tick.
+ */
+static u_int64_t fl_timer_ts_to_ticks(const struct timespec *ts)
+{
+  const u_int64_t tick_ns = FL_TIMER_WHEEL_TICK_MS * 1000000ULL;
+  u_int64_t ns = ((u_int64_t) ts->tv_sec * 1000000000ULL) + ts->tv_nsec;
+
+  return (ns + tick_ns - 1) / tick_ns;
+}
+
+static u_int64_t fl_timer_wheel_current_tick(fl_timer_wheel_t *wheel)
+{
+  struct timespec ts;
+  int64_t ns;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  ns = ((int64_t) (ts.tv_sec - wheel->base.tv_sec) * 1000000000LL) +
+    (ts.tv_nsec - wheel->base.tv_nsec);
+
+  return (ns > 0) ? ((u_int64_t) ns / (FL_TIMER_WHEEL_TICK_MS * 1000000ULL)) : 0;
+}
+
+static void fl_timer_wheel_insert(fl_timer_wheel_t *wheel, fl_timer_t *timer)
+{
+  register u_int64_t expires = timer->expires;
+  register u_int64_t delta;
+  register int level, slot;
+
+  if (!FL_TEST_BIT(timer->flags, FL_TIMERF_ARMED)) {
+    FL_SET_BIT(timer->flags, FL_TIMERF_ARMED);
+    wheel->ntimers++;
   }
 
-  FL_LOGR_DEBUG("Timer dispatch (%s, %s, %d) method started",
-                (task) ? task->name : "", timer->name, fd);
-  timer->timer_method(timer->name, timer->app_data);
-  timer->ndispatches++;
-  FL_LOGR_DEBUG("Timer dispatch (%s, %s, %d) method completed",
-                (task) ? task->name : "", timer->name, fd);
+  if (expires <= wheel->now) {
+    FL_SET_BIT(timer->flags, FL_TIMERF_EXPIRED);
+    TAILQ_INSERT_TAIL(&wheel->expired, timer, wheel_lc);
+    return;
+  }
+
+  delta = expires - wheel->now;
+  if (delta > FL_TIMER_WHEEL_MAX_TICKS) {
+    /* Park it in the last level, it is reinserted when that slot cascades. */
+    expires = wheel->now + FL_TIMER_WHEEL_MAX_TICKS;
+    delta = FL_TIMER_WHEEL_MAX_TICKS;
+  }
+
+  for (level = 0; level < (FL_TIMER_WHEEL_LEVELS - 1); level++) {
+    if (delta < (((u_int64_t) 1) << FL_TIMER_LEVEL_SHIFT(level + 1))) {
+      break;
+    }
+  }
+
+  slot = (expires >> FL_TIMER_LEVEL_SHIFT(level)) & FL_TIMER_WHEEL_SLOT_MASK;
+  timer->wheel_level = level;
+  timer->wheel_slot = slot;
+  TAILQ_INSERT_TAIL(&wheel->slots[level][slot], timer, wheel_lc);
+  wheel->bitmap[level][slot / 64] |= ((u_int64_t) 1) << (slot % 64);
+}
+
+static void fl_timer_wheel_remove(fl_timer_wheel_t *wheel, fl_timer_t *timer)
+{
+  register int level = timer->wheel_level, slot = timer->wheel_slot;
+
+  FL_ASSERT(FL_TEST_BIT(timer->flags, FL_TIMERF_ARMED));
+
+  if (FL_TEST_BIT(timer->flags, FL_TIMERF_EXPIRED)) {
+    TAILQ_REMOVE(&wheel->expired, timer, wheel_lc);
+    FL_RESET_BIT(timer->flags, FL_TIMERF_EXPIRED);
+  } else {
+    TAILQ_REMOVE(&wheel->slots[level][slot], timer, wheel_lc);
+    if (TAILQ_EMPTY(&wheel->slots[level][slot])) {
+      wheel->bitmap[level][slot / 64] &= ~(((u_int64_t) 1) << (slot % 64));
+    }
+  }
+
+  FL_RESET_BIT(timer->flags, FL_TIMERF_ARMED);
+  wheel->ntimers--;
+}
+
+/* Find the first slot after slot 'from' (exclusive) that has timers. */
+static int fl_timer_wheel_next_slot(const u_int64_t *bitmap, int from)
+{
+  register int w, first = from + 1;
+
+  if (first >= FL_TIMER_WHEEL_SLOTS) {
+    return -1;
+  }
+
+  for (w = first / 64; w < FL_TIMER_WHEEL_BITMAP_LEN; w++) {
+    register u_int64_t bits = bitmap[w];
+
+    if (w == (first / 64)) {
+      bits &= ~((((u_int64_t) 1) << (first % 64)) - 1);
+    }
+    if (bits) {
+      return (w * 64) + __builtin_ctzll(bits);
+    }
+  }
+
+  return -1;
+}
+
+/* Earliest tick, after the current tick, at which the wheel has work to do:
+ * either a level 0 slot with timers, or a higher level slot that cascades.
+ */
+static u_int64_t fl_timer_wheel_next_tick(fl_timer_wheel_t *wheel)
+{
+  register int level;
+
+  /* The expired list is not considered here, it is always drained by
+   * fl_timers_dispatch() before the wheel is rearmed. Returning the current
+   * tick for it would stall fl_timer_wheel_advance().
+   */
+  for (level = 0; level < FL_TIMER_WHEEL_LEVELS; level++) {
+    register int shift = FL_TIMER_LEVEL_SHIFT(level);
+    register int w, any = 0, slot;
+    register u_int64_t rotation;
+
+    for (w = 0; w < FL_TIMER_WHEEL_BITMAP_LEN; w++) {
+      any |= (wheel->bitmap[level][w] != 0);
+    }
+    if (!any) {
+      continue;
+    }
+
+    rotation = wheel->now >> (shift + FL_TIMER_WHEEL_SLOT_BITS);
+    slot = fl_timer_wheel_next_slot(wheel->bitmap[level],
+                                     (wheel->now >> shift) &
+                                     FL_TIMER_WHEEL_SLOT_MASK);
+    if (slot >= 0) {
+      return (rotation << (shift + FL_TIMER_WHEEL_SLOT_BITS)) |
+        ((u_int64_t) slot << shift);
+    }
+
+    /* Timers of this level are in the next rotation. */
+    return (rotation + 1) << (shift + FL_TIMER_WHEEL_SLOT_BITS);
+  }
+
+  return FL_TIMER_WHEEL_NO_TICK;
+}
+
+static void fl_timer_wheel_cascade(fl_timer_wheel_t *wheel, int level)
+{
+  register int slot = (wheel->now >> FL_TIMER_LEVEL_SHIFT(level)) &
+    FL_TIMER_WHEEL_SLOT_MASK;
+  register fl_timer_t *timer;
+
+  while ((timer = TAILQ_FIRST(&wheel->slots[level][slot]))) {
+    TAILQ_REMOVE(&wheel->slots[level][slot], timer, wheel_lc);
+    fl_timer_wheel_insert(wheel, timer);
+  }
+  wheel->bitmap[level][slot / 64] &= ~(((u_int64_t) 1) << (slot % 64));
+}
+
+static void fl_timer_wheel_advance(fl_timer_wheel_t *wheel, u_int64_t target)
+{
+  while (wheel->now < target) {
+    register u_int64_t next = fl_timer_wheel_next_tick(wheel);
+    register int level, slot;
+    register fl_timer_t *timer;
+
+    if ((next == FL_TIMER_WHEEL_NO_TICK) || (next > target)) {
+      wheel->now = target;
+      break;
+    }
+    wheel->now = next;
+
+    /* Cascade the higher levels first, so that timers land in the level 0
+     * slot of the current tick before it is processed.
+     */
+    for (level = FL_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      u_int64_t mask = (((u_int64_t) 1) << FL_TIMER_LEVEL_SHIFT(level)) - 1;
+
+      if (!(wheel->now & mask)) {
+        fl_timer_wheel_cascade(wheel, level);
+      }
+    }
+
+    slot = wheel->now & FL_TIMER_WHEEL_SLOT_MASK;
+    while ((timer = TAILQ_FIRST(&wheel->slots[0][slot]))) {
+      TAILQ_REMOVE(&wheel->slots[0][slot], timer, wheel_lc);
+      FL_SET_BIT(timer->flags, FL_TIMERF_EXPIRED);
+      TAILQ_INSERT_TAIL(&wheel->expired, timer, wheel_lc);
+    }
+    wheel->bitmap[0][slot / 64] &= ~(((u_int64_t) 1) << (slot % 64));
+  }
+}
+
+static int fl_timer_wheel_arm(fl_timer_wheel_t *wheel, u_int64_t tick)
+{
+  struct itimerspec its;
+  u_int64_t ns;
+
+  memset(&its, 0, sizeof(its));
+  if (tick != FL_TIMER_WHEEL_NO_TICK) {
+    /* A zero it_value disarms the timerfd, fire at the earliest instead. */
+    ns = tick * FL_TIMER_WHEEL_TICK_MS * 1000000ULL;
+    its.it_value.tv_sec = wheel->base.tv_sec + (ns / 1000000000ULL);
+    its.it_value.tv_nsec = wheel->base.tv_nsec + (ns % 1000000000ULL);
+    if (its.it_value.tv_nsec >= 1000000000L) {
+      its.it_value.tv_sec++;
+      its.it_value.tv_nsec -= 1000000000L;
+    }
+    if (!its.it_value.tv_sec && !its.it_value.tv_nsec) {
+      its.it_value.tv_nsec = 1;
+    }
+  }
+
+  if (timerfd_settime(wheel->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    int save_errno = errno;
+    FL_LOGR_ERR("Arming timer wheel (%d) failed, error <%s>",
+                wheel->timerfd, strerror(save_errno));
+    errno = save_errno;
+    return -1;
+  }
+
+  wheel->armed = (tick != FL_TIMER_WHEEL_NO_TICK) ? tick : 0;
+  return 0;
 }
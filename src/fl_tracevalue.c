@@ -32,10 +32,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <string.h>
 
+#include "falco/fl_defs.h"
 #include "falco/fl_tracevalue.h"
 
 #define FLAGS_TRACE_STORE_BUFSIZ 2048
-static char flags_trace_store[FLAGS_TRACE_STORE_BUFSIZ];
+static FL_LOOP_LOCAL char flags_trace_store[FLAGS_TRACE_STORE_BUFSIZ];
 
 const char *fl_trace_value(const values_t *values, int value)
 {
@@ -0,0 +1,456 @@
+/*******************************************************************************
+BSD 3-Clause License
+
+Copyright (c) 2014 - 2020, NetworkArt Systems Private Limited (www.networkart.com).
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+
+#include "falco/fl_defs.h"
+#include "falco/fl_stdlib.h"
+#include "falco/fl_pool.h"
+#include "falco/fl_work.h"
+
+#define FL_WORK_MAX_WORKERS 1024
+
+/**
+ * @brief A worker thread and its queue of work.
+ */
+typedef struct fl_work_worker_t_ {
+  pthread_t thread;
+  u_int32_t id;
+  pthread_mutex_t lock;      ///< Protects the queue
+  TAILQ_HEAD(fl_work_queue_, fl_work_t_) queue;
+  u_int32_t nqueued;
+  atomic_ullong nrun;
+  atomic_ullong nstolen;     ///< Work taken from the queue of another worker
+} fl_work_worker_t;
+
+/**
+ * @brief The pool of worker threads, common to all the event loops.
+ */
+typedef struct fl_work_pool_t_ {
+  u_int32_t nworkers;
+  fl_work_worker_t *workers;
+  sem_t available;           ///< Work queued and not taken by a worker yet
+  atomic_uint next;          ///< Queue that receives the next work
+  pthread_mutex_t start_lock;
+  int started;
+} fl_work_pool_t;
+
+/**
+ * @brief Counters of the work submitted by an event loop.
+ */
+typedef struct fl_work_stats_t_ {
+  u_int64_t nsubmitted;
+  u_int64_t nwaited;         ///< Work that waited behind its strand
+  u_int64_t ndone;
+  u_int64_t ncancelled;
+} fl_work_stats_t;
+
+static fl_work_pool_t fl_work_pool = {
+  .start_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static u_int32_t fl_work_nworkers;
+
+static FL_LOOP_LOCAL fl_pool_t *fl_work_obj_pool;
+static FL_LOOP_LOCAL fl_pool_t *fl_work_strand_pool;
+static FL_LOOP_LOCAL fl_work_stats_t fl_work_stats;
+
+static int fl_work_pool_start(void);
+static void *fl_work_worker_main(void *arg);
+static fl_work_t *fl_work_take(fl_work_worker_t *worker);
+static void fl_work_enqueue(fl_work_t *work);
+static void fl_work_done(const char *name, void *app_data);
+static void fl_work_release(fl_work_t *work);
+
+int fl_work_cfg_workers(u_int32_t nworkers)
+{
+  if (nworkers > FL_WORK_MAX_WORKERS) {
+    FL_LOGR_ERR("Invalid number of workers (%u) configuration", nworkers);
+    return -1;
+  }
+  if (fl_work_pool.started) {
+    FL_LOGR_ERR("Workers can not be configured once they are started");
+    return -1;
+  }
+
+  fl_work_nworkers = nworkers;
+  return 0;
+}
+
+int fl_work_module_init(void)
+{
+  if (!fl_work_obj_pool) {
+    fl_work_obj_pool = fl_pool_create("Work", sizeof(fl_work_t), 0, 0);
+    fl_work_strand_pool = fl_pool_create("Work Strand",
+                                         sizeof(fl_work_strand_t), 0, 0);
+    if (!fl_work_obj_pool || !fl_work_strand_pool) {
+      FL_LOGR_ERR("Work pools creation failed");
+      return -1;
+    }
+  }
+
+  if (fl_work_nworkers && (fl_work_pool_start() < 0)) {
+    return -1;
+  }
+
+  FL_LOGR_INFO("Falco Work module initialized");
+  return 0;
+}
+
+int fl_work_module_dump(FILE *fd)
+{
+  fl_work_pool_t *pool = &fl_work_pool;
+  fl_work_stats_t *stats = &fl_work_stats;
+  fl_work_worker_t *worker;
+  u_int32_t i, nqueued;
+
+  fprintf(fd, "\n--------------------------------------------------------------------------------\n");
+  fprintf(fd, "Work\n");
+  fprintf(fd, "--------------------------------------------------------------------------------\n\n");
+
+  fprintf(fd, "Workers: %u\n", pool->nworkers);
+  fprintf(fd, "Submitted %llu, waited on strand %llu, done %llu, "
+          "cancelled %llu\n",
+          (unsigned long long) stats->nsubmitted,
+          (unsigned long long) stats->nwaited,
+          (unsigned long long) stats->ndone,
+          (unsigned long long) stats->ncancelled);
+
+  for (i = 0; i < pool->nworkers; i++) {
+    worker = &pool->workers[i];
+    (void) pthread_mutex_lock(&worker->lock);
+    nqueued = worker->nqueued;
+    (void) pthread_mutex_unlock(&worker->lock);
+
+    fprintf(fd, "    Worker %u: queued %u, run %llu, stolen %llu\n",
+            worker->id, nqueued,
+            (unsigned long long) atomic_load(&worker->nrun),
+            (unsigned long long) atomic_load(&worker->nstolen));
+  }
+
+  return 0;
+}
+
+fl_work_strand_t *fl_work_strand_create(void)
+{
+  fl_work_strand_t *strand;
+
+  if (!fl_work_strand_pool) {
+    FL_LOGR_ERR("Request to create a strand on a loop without work module");
+    return NULL;
+  }
+
+  FL_POOL_ALLOC(fl_work_strand_t, fl_work_strand_pool, strand,
+                "Work Strand");
+  if (!strand) {
+    return NULL;
+  }
+  TAILQ_INIT(&strand->queue);
+  return strand;
+}
+
+void fl_work_strand_close(fl_work_strand_t *strand)
+{
+  fl_work_t *work;
+
+  if (!strand || strand->closed) {
+    FL_ASSERT(0);
+    return;
+  }
+
+  strand->closed = 1;
+  while ((work = TAILQ_FIRST(&strand->queue))) {
+    TAILQ_REMOVE(&strand->queue, work, work_lc);
+    work->owner = NULL;
+    work->cancelled = 1;
+    fl_work_stats.ncancelled++;
+    work->done_method(work);
+    fl_work_release(work);
+  }
+
+  /* Otherwise, released once the running work is done */
+  if (!strand->running) {
+    FL_POOL_FREE(fl_work_strand_pool, strand, "Work Strand");
+  }
+}
+
+fl_work_t *fl_work_submit(fl_work_strand_t *strand, void *owner,
+                          fl_work_method_t method,
+                          fl_work_done_method_t done_method,
+                          void *app_data)
+{
+  fl_work_t *work;
+
+  FL_ASSERT(method && done_method);
+  if (!fl_work_pool.started || !fl_work_obj_pool || !fl_loop_self()) {
+    FL_LOGR_ERR("Request to submit work without workers");
+    return NULL;
+  }
+  if (!method || !done_method || (strand && strand->closed)) {
+    FL_LOGR_ERR("Request to submit invalid work");
+    return NULL;
+  }
+
+  FL_POOL_ALLOC(fl_work_t, fl_work_obj_pool, work, "Work");
+  if (!work) {
+    return NULL;
+  }
+  work->method = method;
+  work->done_method = done_method;
+  work->app_data = app_data;
+  work->owner = owner;
+  work->strand = strand;
+  work->loop = fl_loop_self();
+  fl_work_stats.nsubmitted++;
+
+  if (strand) {
+    if (strand->running) {
+      TAILQ_INSERT_TAIL(&strand->queue, work, work_lc);
+      fl_work_stats.nwaited++;
+      return work;
+    }
+    strand->running = work;
+  }
+
+  fl_work_enqueue(work);
+  return work;
+}
+
+static int fl_work_pool_start(void)
+{
+  fl_work_pool_t *pool = &fl_work_pool;
+  fl_work_worker_t *worker;
+  sigset_t set, oset;
+  u_int32_t i;
+  int rc = 0;
+
+  (void) pthread_mutex_lock(&pool->start_lock);
+  if (pool->started) {
+    goto out;
+  }
+
+  FL_ALLOC(fl_work_worker_t, fl_work_nworkers, pool->workers, "Workers");
+  if (!pool->workers || (sem_init(&pool->available, 0, 0) < 0)) {
+    rc = -1;
+    goto out;
+  }
+
+  /* Signals are delivered to the main loop only */
+  (void) sigfillset(&set);
+  (void) pthread_sigmask(SIG_SETMASK, &set, &oset);
+  for (i = 0; i < fl_work_nworkers; i++) {
+    worker = &pool->workers[i];
+    worker->id = i;
+    (void) pthread_mutex_init(&worker->lock, NULL);
+    TAILQ_INIT(&worker->queue);
+
+    rc = pthread_create(&worker->thread, NULL, fl_work_worker_main, worker);
+    if (rc) {
+      FL_LOGR_ERR("Worker %u thread creation failed, error %d <%s>",
+                  i, rc, strerror(rc));
+      rc = -1;
+      break;
+    }
+    pool->nworkers++;
+  }
+  (void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+  /* Workers that were started serve the work */
+  if (pool->nworkers) {
+    pool->started = 1;
+    FL_LOGR_INFO("Started %u workers", pool->nworkers);
+  }
+
+ out:
+  (void) pthread_mutex_unlock(&pool->start_lock);
+  return rc;
+}
+
+static void *fl_work_worker_main(void *arg)
+{
+  fl_work_worker_t *worker = arg;
+  fl_work_t *work;
+  int rc;
+
+  for (;;) {
+    /* Every post of the semaphore is a work queued in one of the queues */
+    while ((sem_wait(&fl_work_pool.available) < 0) && (errno == EINTR)) {
+    }
+
+    work = fl_work_take(worker);
+    FL_ASSERT(work);
+    if (!work) {
+      continue;
+    }
+
+    work->method(work);
+    atomic_fetch_add_explicit(&worker->nrun, 1, memory_order_relaxed);
+
+    /* The done method runs on the loop that submitted the work */
+    while ((rc = fl_loop_post(work->loop, "Work Done", fl_work_done,
+                              work)) < 0) {
+      if (errno != EAGAIN) {
+        FL_LOGR_ERR("Worker %u could not return work to loop (%s), "
+                    "error %d <%s>", worker->id, work->loop->name,
+                    errno, strerror(errno));
+        break;
+      }
+      (void) sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+static fl_work_t *fl_work_take(fl_work_worker_t *worker)
+{
+  fl_work_pool_t *pool = &fl_work_pool;
+  fl_work_worker_t *victim;
+  fl_work_t *work;
+  u_int32_t i;
+
+  (void) pthread_mutex_lock(&worker->lock);
+  work = TAILQ_FIRST(&worker->queue);
+  if (work) {
+    TAILQ_REMOVE(&worker->queue, work, work_lc);
+    worker->nqueued--;
+  }
+  (void) pthread_mutex_unlock(&worker->lock);
+  if (work) {
+    return work;
+  }
+
+  /* Steal the most recently queued work of another worker, the one its
+   * owner would get to last.
+   */
+  for (;;) {
+    for (i = 1; i < pool->nworkers; i++) {
+      victim = &pool->workers[(worker->id + i) % pool->nworkers];
+
+      (void) pthread_mutex_lock(&victim->lock);
+      work = TAILQ_LAST(&victim->queue, fl_work_queue_);
+      if (work) {
+        TAILQ_REMOVE(&victim->queue, work, work_lc);
+        victim->nqueued--;
+      }
+      (void) pthread_mutex_unlock(&victim->lock);
+
+      if (work) {
+        atomic_fetch_add_explicit(&worker->nstolen, 1, memory_order_relaxed);
+        return work;
+      }
+    }
+
+    /* The work that was counted is being queued */
+    (void) pthread_mutex_lock(&worker->lock);
+    work = TAILQ_FIRST(&worker->queue);
+    if (work) {
+      TAILQ_REMOVE(&worker->queue, work, work_lc);
+      worker->nqueued--;
+    }
+    (void) pthread_mutex_unlock(&worker->lock);
+    if (work) {
+      return work;
+    }
+    (void) sched_yield();
+  }
+}
+
+static void fl_work_enqueue(fl_work_t *work)
+{
+  fl_work_pool_t *pool = &fl_work_pool;
+  fl_work_worker_t *worker;
+
+  worker = &pool->workers[atomic_fetch_add_explicit(&pool->next, 1,
+                                                    memory_order_relaxed) %
+                          pool->nworkers];
+
+  (void) pthread_mutex_lock(&worker->lock);
+  TAILQ_INSERT_TAIL(&worker->queue, work, work_lc);
+  worker->nqueued++;
+  (void) pthread_mutex_unlock(&worker->lock);
+
+  (void) sem_post(&pool->available);
+}
+
+static void fl_work_done(const char *name, void *app_data)
+{
+  fl_work_t *work = app_data;
+  fl_work_strand_t *strand = work->strand;
+  fl_work_t *next;
+
+  if (strand) {
+    FL_ASSERT(strand->running == work);
+
+    if (strand->closed) {
+      work->owner = NULL;
+    } else if ((next = TAILQ_FIRST(&strand->queue))) {
+      /* The next work of the strand starts now, its done method runs after
+       * this one.
+       */
+      TAILQ_REMOVE(&strand->queue, next, work_lc);
+      strand->running = next;
+      fl_work_enqueue(next);
+    }
+  }
+
+  fl_work_stats.ndone++;
+  work->done_method(work);
+
+  /* Until here, the strand is held by this work, in case the done method
+   * submits to, or closes, the strand.
+   */
+  if (strand) {
+    if (strand->running == work) {
+      strand->running = NULL;
+      if (!strand->closed && (next = TAILQ_FIRST(&strand->queue))) {
+        TAILQ_REMOVE(&strand->queue, next, work_lc);
+        strand->running = next;
+        fl_work_enqueue(next);
+      }
+    }
+    if (strand->closed && !strand->running) {
+      FL_POOL_FREE(fl_work_strand_pool, strand, "Work Strand");
+    }
+  }
+  fl_work_release(work);
+}
+
+static void fl_work_release(fl_work_t *work)
+{
+  FL_POOL_FREE(fl_work_obj_pool, work, "Work");
+}